@@ -0,0 +1,519 @@
+/*
+    Microbenchmarks of the encode/decode kernels on the trigger and input
+    paths: CRC32, setTriggerProfile for every profile, the USB and BT
+    output report builders, the input report evaluator and the TRIGGER
+    payload (de)serializers.
+
+    Each benchmark is calibrated to a batch of about a tenth of --min-time,
+    then timed over BENCH_SAMPLES batches; the median batch gives ns/op.
+    operator new is counted in this executable (or by the library in a
+    DUALSENSITIVE_ALLOC_TRACKING build), so allocations/op and allocated
+    bytes/op cover everything the kernel does on the heap. Bytes/op is the
+    size of the data the kernel processes.
+
+    On Windows the suite also times the public API calls in SOLO and
+    SERVER mode against the simulated controller; the calibration batches
+    are their warm-up, so allocs/op shows what a steady stream of trigger
+    updates costs on the heap (the SERVER writer thread is not counted).
+
+    --json FILE writes the results as a baseline; --compare FILE runs the
+    suite against such a baseline and exits with 1 if a benchmark got
+    slower by more than --threshold percent or allocates more.
+
+    usage: dualsensitive-bench [--filter SUBSTRING] [--min-time MS]
+                               [--json FILE] [--compare FILE]
+                               [--threshold PERCENT]
+*/
+
+#include <dualsensitive.h>
+#include <protocol.h>
+#include <DS_CRC32.h>
+#include <DS5_Input.h>
+#include <DS5_Output.h>
+#include <DS5State.h>
+#include <alloc.h>
+#ifdef DUALSENSITIVE_BENCH_API
+#include <IO.h>
+#include <Device.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define BENCH_SAMPLES 9
+#define DEFAULT_MIN_TIME_MS 200
+#define DEFAULT_THRESHOLD_PERCENT 10.0
+// allocations/op above the baseline by more than this are a regression
+#define ALLOCS_TOLERANCE 0.01
+
+#define USB_INPUT_REPORT_SIZE 64
+#define BT_OUTPUT_REPORT_SIZE 78
+#define USB_OUTPUT_REPORT_SIZE 48
+#define BT_CRC_OFFSET 74
+// bytes of one trigger effect block in the output report
+#define TRIGGER_EFFECT_SIZE 11
+// UDP port of the SERVER mode API benchmarks
+#define BENCH_API_PORT 28474
+
+using Clock = std::chrono::steady_clock;
+
+#ifdef DUALSENSITIVE_ALLOC_TRACKING
+// the library replaces operator new in this build mode
+static alloc::Counts allocationCounts() {
+    return alloc::threadCounts();
+}
+#else
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+static alloc::Counts allocationCounts() {
+    alloc::Counts counts;
+    counts.allocations = allocations.load(std::memory_order_relaxed);
+    counts.bytes = allocatedBytes.load(std::memory_order_relaxed);
+    return counts;
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+#endif
+
+// results are folded into it so the kernels cannot be optimized away
+static volatile uint32_t sink;
+
+struct Options {
+    std::string filter;
+    int64_t minTimeMs = DEFAULT_MIN_TIME_MS;
+    std::string jsonPath;
+    std::string comparePath;
+    double thresholdPercent = DEFAULT_THRESHOLD_PERCENT;
+};
+
+struct Benchmark {
+    Benchmark(std::string name, size_t bytesPerOp, std::function<void()> run,
+              std::function<void()> setup = {})
+        : name(std::move(name)), bytesPerOp(bytesPerOp), run(std::move(run)),
+          setup(std::move(setup)) {}
+
+    std::string name;
+    size_t bytesPerOp;
+    std::function<void()> run;
+    // run once before the benchmark is measured, if set
+    std::function<void()> setup;
+};
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0.0;
+    double allocsPerOp = 0.0;
+    double allocBytesPerOp = 0.0;
+    size_t bytesPerOp = 0;
+};
+
+static int64_t elapsedNs(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+static Result measure(const Benchmark& benchmark, int64_t minTimeMs) {
+    // grow the batch until it takes a tenth of the time budget
+    int64_t batchTargetNs = minTimeMs * 1000000 / 10;
+    uint64_t batch = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+            benchmark.run();
+        if (elapsedNs(start) >= batchTargetNs || batch >= (1ull << 40))
+            break;
+        batch *= 2;
+    }
+
+    std::vector<double> samples;
+    alloc::Counts before = allocationCounts();
+    for (int sample = 0; sample < BENCH_SAMPLES; sample++) {
+        Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+            benchmark.run();
+        samples.push_back(static_cast<double>(elapsedNs(start)) / batch);
+    }
+    double ops = static_cast<double>(batch) * BENCH_SAMPLES;
+
+    std::sort(samples.begin(), samples.end());
+    Result result;
+    result.name = benchmark.name;
+    result.nsPerOp = samples[samples.size() / 2];
+    alloc::Counts after = allocationCounts();
+    result.allocsPerOp = (after.allocations - before.allocations) / ops;
+    result.allocBytesPerOp = (after.bytes - before.bytes) / ops;
+    result.bytesPerOp = benchmark.bytesPerOp;
+    return result;
+}
+
+struct ProfileCase {
+    const char* name;
+    TriggerProfile profile;
+    std::vector<uint8_t> extras;
+};
+
+// extras as used by the sample clients, so every profile takes its
+// encoding branch rather than the fallback
+static const std::vector<ProfileCase> profileCases = {
+    { "Normal", TriggerProfile::Normal, {} },
+    { "GameCube", TriggerProfile::GameCube, {} },
+    { "VerySoft", TriggerProfile::VerySoft, {} },
+    { "Soft", TriggerProfile::Soft, {} },
+    { "Medium", TriggerProfile::Medium, {} },
+    { "Hard", TriggerProfile::Hard, {} },
+    { "VeryHard", TriggerProfile::VeryHard, {} },
+    { "Hardest", TriggerProfile::Hardest, {} },
+    { "Rigid", TriggerProfile::Rigid, {} },
+    { "Choppy", TriggerProfile::Choppy, {} },
+    { "VibrateTrigger", TriggerProfile::VibrateTrigger, {} },
+    { "VibrateTriggerPulse", TriggerProfile::VibrateTriggerPulse, {} },
+    { "Resistance", TriggerProfile::Resistance, { 2, 5 } },
+    { "Galloping", TriggerProfile::Galloping, { 0, 9, 2, 6, 20 } },
+    { "Machine", TriggerProfile::Machine, { 1, 8, 3, 3, 184, 0 } },
+    { "Feedback", TriggerProfile::Feedback, { 3, 3 } },
+    { "Vibration", TriggerProfile::Vibration, { 3, 4, 14 } },
+    { "VibrateTrigger10Hz", TriggerProfile::VibrateTrigger10Hz, {} },
+    { "SlopeFeedback", TriggerProfile::SlopeFeedback, { 0, 5, 1, 8 } },
+    { "MultiplePositionFeeback", TriggerProfile::MultiplePositionFeeback, { 4, 7, 0, 2, 4, 6, 0, 3, 6, 0 } },
+    { "MultiplePositionVibration", TriggerProfile::MultiplePositionVibration, { 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8 } },
+    { "Bow", TriggerProfile::Bow, { 1, 4, 8, 8 } },
+    { "Weapon", TriggerProfile::Weapon, { 2, 5, 5 } },
+    { "SemiAutomaticGun", TriggerProfile::SemiAutomaticGun, { 2, 7, 8 } },
+    { "AutomaticGun", TriggerProfile::AutomaticGun, { 0, 8, 10 } },
+    { "Custom", TriggerProfile::Custom, { static_cast<uint8_t>(TriggerMode::Pulse_A), 40, 1, 2, 0, 0, 0, 0 } },
+};
+
+static void fillPattern(unsigned char* buffer, size_t size, unsigned seed) {
+    for (size_t i = 0; i < size; i++)
+        buffer[i] = static_cast<unsigned char>((i * 37 + seed * 101) ^ (i >> 2));
+}
+
+#ifdef DUALSENSITIVE_BENCH_API
+static DS5W::SimulatedDevice apiDevice = {};
+static bool apiRunning = false;
+static AgentMode apiMode = AgentMode::SOLO;
+
+static void stopApi() {
+    if (!apiRunning)
+        return;
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    apiRunning = false;
+}
+
+// (re)starts the library in a mode against the simulated controller; the
+// API benchmarks of one mode follow each other, so it switches once
+static void useMode(AgentMode mode) {
+    if (apiRunning && apiMode == mode)
+        return;
+    stopApi();
+    apiDevice.connection = DS5W::DeviceConnection::USB;
+    DS5W::setSimulatedDevice(&apiDevice);
+    apiRunning = dualsensitive::init(mode, "dualsensitive-bench.log", false, BENCH_API_PORT)
+        == dualsensitive::Status::Ok;
+    apiMode = mode;
+    if (!apiRunning)
+        std::cerr << "failed to start the library for the API benchmarks" << std::endl;
+}
+
+// the calls a game makes per frame, alternating between two settings so
+// every call is a real change
+static void addApiBenchmarks(std::vector<Benchmark>& benchmarks, const char* modeName, AgentMode mode) {
+    static const std::vector<uint8_t> weapon = { 2, 5, 5 };
+    static const std::vector<uint8_t> machine = { 1, 8, 3, 3, 184, 0 };
+    static unsigned flip = 0;
+    std::function<void()> setup = [mode] { useMode(mode); };
+    std::string prefix = std::string("api/") + modeName + "/";
+    benchmarks.push_back({ prefix + "setLeftTrigger", 0, [] {
+        if (flip++ & 1)
+            dualsensitive::setLeftTrigger(TriggerProfile::Weapon, weapon);
+        else
+            dualsensitive::setLeftTrigger(TriggerProfile::Machine, machine);
+    }, setup });
+    benchmarks.push_back({ prefix + "setRightTrigger", 0, [] {
+        if (flip++ & 1)
+            dualsensitive::setRightTrigger(TriggerProfile::Weapon, weapon);
+        else
+            dualsensitive::setRightTrigger(TriggerProfile::Machine, machine);
+    }, setup });
+    benchmarks.push_back({ prefix + "sendState", 0, [] {
+        dualsensitive::sendState();
+    }, setup });
+}
+#endif
+
+static std::vector<Benchmark> buildBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    static unsigned char crcBuffer[BT_OUTPUT_REPORT_SIZE];
+    fillPattern(crcBuffer, sizeof(crcBuffer), 1);
+    benchmarks.push_back({ "CRC32::compute/74", BT_CRC_OFFSET, [] {
+        sink = sink ^ __DS5W::CRC32::compute(crcBuffer, BT_CRC_OFFSET);
+    } });
+
+    static unsigned char triggerBuffer[TRIGGER_EFFECT_SIZE];
+    for (const ProfileCase& profileCase : profileCases) {
+        const ProfileCase* current = &profileCase;
+        benchmarks.push_back({ std::string("setTriggerProfile/") + profileCase.name,
+                TRIGGER_EFFECT_SIZE, [current] {
+            setTriggerProfile(triggerBuffer, current->profile, current->extras);
+            sink = sink ^ triggerBuffer[1];
+        } });
+    }
+
+    // both triggers set, as every write from dualsensitive.cpp does
+    static DS5W::DS5OutputState outputState;
+    outputState.rightRumble = 40;
+    outputState.lightbar = { 0, 64, 255 };
+    outputState.playerLeds.bitmask = 0x04;
+    outputState.playerLeds.brightness = DS5W::LedBrightness::MEDIUM;
+    outputState.triggerSettingEnabled = true;
+    outputState.leftTriggerSetting = { TriggerProfile::Weapon, { 2, 5, 5 }, 3 };
+    outputState.rightTriggerSetting = { TriggerProfile::Machine, { 1, 8, 3, 3, 184, 0 }, 6 };
+
+    static unsigned char outputBuffer[BT_OUTPUT_REPORT_SIZE];
+    benchmarks.push_back({ "createHidOutputBuffer/USB", USB_OUTPUT_REPORT_SIZE, [] {
+        memset(outputBuffer, 0, USB_OUTPUT_REPORT_SIZE);
+        outputBuffer[0x00] = 0x02;
+        __DS5W::Output::createHidOutputBuffer(&outputBuffer[1], &outputState);
+        sink = sink ^ outputBuffer[0x0B];
+    } });
+    // the BT report adds its header and the CRC32 trailer
+    benchmarks.push_back({ "createHidOutputBuffer/BT", BT_OUTPUT_REPORT_SIZE, [] {
+        memset(outputBuffer, 0, BT_OUTPUT_REPORT_SIZE);
+        outputBuffer[0x00] = 0x31;
+        outputBuffer[0x01] = 0x02;
+        __DS5W::Output::createHidOutputBuffer(&outputBuffer[2], &outputState);
+        uint32_t crc = __DS5W::CRC32::compute(outputBuffer, BT_CRC_OFFSET);
+        memcpy(&outputBuffer[BT_CRC_OFFSET], &crc, sizeof(crc));
+        sink = sink ^ outputBuffer[BT_CRC_OFFSET];
+    } });
+
+    static unsigned char inputBuffer[USB_INPUT_REPORT_SIZE];
+    static DS5W::DS5InputState inputState;
+    fillPattern(inputBuffer, sizeof(inputBuffer), 2);
+    inputBuffer[0] = 0x01;
+    benchmarks.push_back({ "evaluateHidInputBuffer", USB_INPUT_REPORT_SIZE, [] {
+        __DS5W::Input::evaluateHidInputBuffer(&inputBuffer[1], &inputState);
+        sink = sink ^ inputState.leftStick.x;
+    } });
+
+    // one USB report per millisecond: counter +1, sensor clock +3000
+    static DS5W::InputSequence inputSequence;
+    benchmarks.push_back({ "evaluateInputSequence", 0, [] {
+        inputState.reportCounter++;
+        inputState.sensorTimestamp += 3000;
+        __DS5W::Input::evaluateInputSequence(&inputSequence, &inputState);
+        sink = sink ^ inputState.reportsDropped;
+    } });
+
+    static const std::vector<uint8_t> payloadExtras = { 1, 8, 3, 3, 184, 0 };
+    static const std::vector<uint8_t> payload =
+        serializeTriggerPayload(Trigger::Left, TriggerProfile::Machine, payloadExtras);
+    benchmarks.push_back({ "serializeTriggerPayload", payload.size(), [] {
+        std::vector<uint8_t> serialized =
+            serializeTriggerPayload(Trigger::Left, TriggerProfile::Machine, payloadExtras);
+        sink = sink ^ serialized.back();
+    } });
+    // the deserializer takes the payload without its type byte
+    static const std::vector<uint8_t> payloadBody(payload.begin() + PAYLOAD_TYPE_SIZE, payload.end());
+    benchmarks.push_back({ "deserializeTriggerPayload", payloadBody.size(), [] {
+        Trigger trigger;
+        TriggerProfile profile;
+        std::vector<uint8_t> extras;
+        deserializeTriggerPayload(payloadBody, trigger, profile, extras);
+        sink = sink ^ static_cast<uint32_t>(extras.size());
+    } });
+
+#ifdef DUALSENSITIVE_BENCH_API
+    addApiBenchmarks(benchmarks, "solo", AgentMode::SOLO);
+    addApiBenchmarks(benchmarks, "server", AgentMode::SERVER);
+#endif
+    return benchmarks;
+}
+
+static void writeJson(std::ostream& out, const std::vector<Result>& results) {
+    out << std::fixed << std::setprecision(3)
+        << "{\"tool\":\"dualsensitive-bench\",\"benchmarks\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"name\":\"" << result.name << "\""
+            << ",\"nsPerOp\":" << result.nsPerOp
+            << ",\"allocsPerOp\":" << result.allocsPerOp
+            << ",\"allocBytesPerOp\":" << result.allocBytesPerOp
+            << ",\"bytesPerOp\":" << result.bytesPerOp << "}";
+    }
+    out << "\n]}" << std::endl;
+}
+
+static double numberAfter(const std::string& text, size_t from, size_t to, const char* key) {
+    size_t at = text.find(key, from);
+    if (at == std::string::npos || at >= to)
+        return 0.0;
+    return std::strtod(text.c_str() + at + strlen(key), nullptr);
+}
+
+// reads back what writeJson() wrote; not a general JSON parser
+static bool readBaseline(const std::string& path, std::vector<Result>& baseline) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string text = contents.str();
+
+    const std::string nameKey = "\"name\":\"";
+    size_t at = text.find(nameKey);
+    while (at != std::string::npos) {
+        size_t nameStart = at + nameKey.size();
+        size_t nameEnd = text.find('"', nameStart);
+        if (nameEnd == std::string::npos)
+            return false;
+        size_t next = text.find(nameKey, nameEnd);
+        size_t end = next == std::string::npos ? text.size() : next;
+        Result result;
+        result.name = text.substr(nameStart, nameEnd - nameStart);
+        result.nsPerOp = numberAfter(text, nameEnd, end, "\"nsPerOp\":");
+        result.allocsPerOp = numberAfter(text, nameEnd, end, "\"allocsPerOp\":");
+        result.allocBytesPerOp = numberAfter(text, nameEnd, end, "\"allocBytesPerOp\":");
+        result.bytesPerOp = static_cast<size_t>(numberAfter(text, nameEnd, end, "\"bytesPerOp\":"));
+        baseline.push_back(result);
+        at = next;
+    }
+    return true;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time" && hasValue) {
+            options.minTimeMs = std::max(10ll, std::strtoll(argv[++i], nullptr, 10));
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--compare" && hasValue) {
+            options.comparePath = argv[++i];
+        } else if (arg == "--threshold" && hasValue) {
+            options.thresholdPercent = std::max(0.0, std::strtod(argv[++i], nullptr));
+        } else {
+            std::cerr << "unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: dualsensitive-bench [--filter SUBSTRING] [--min-time MS]"
+                     " [--json FILE] [--compare FILE] [--threshold PERCENT]" << std::endl;
+        return 2;
+    }
+
+    std::vector<Result> baseline;
+    if (!options.comparePath.empty() && !readBaseline(options.comparePath, baseline)) {
+        std::cerr << "cannot read baseline " << options.comparePath << std::endl;
+        return 2;
+    }
+
+    std::vector<Result> results;
+    int regressions = 0;
+    std::cout << std::left << std::setw(44) << "benchmark" << std::right
+              << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op"
+              << std::setw(12) << "B alloc/op" << std::setw(10) << "bytes/op"
+              << std::setw(12) << "MB/s"
+              << (baseline.empty() ? "" : "   vs baseline") << "\n";
+    for (const Benchmark& benchmark : buildBenchmarks()) {
+        if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos)
+            continue;
+        if (benchmark.setup)
+            benchmark.setup();
+        Result result = measure(benchmark, options.minTimeMs);
+        results.push_back(result);
+        double megabytesPerS = result.nsPerOp > 0.0 ? result.bytesPerOp * 1e3 / result.nsPerOp : 0.0;
+        std::cout << std::left << std::setw(44) << result.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << result.nsPerOp
+                  << std::setprecision(2) << std::setw(12) << result.allocsPerOp
+                  << std::setprecision(1) << std::setw(12) << result.allocBytesPerOp
+                  << std::setw(10) << result.bytesPerOp
+                  << std::setprecision(1) << std::setw(12) << megabytesPerS;
+
+        auto base = std::find_if(baseline.begin(), baseline.end(),
+                [&](const Result& entry) { return entry.name == result.name; });
+        if (base != baseline.end()) {
+            double change = base->nsPerOp > 0.0 ? (result.nsPerOp / base->nsPerOp - 1.0) * 100.0 : 0.0;
+            bool slower = change > options.thresholdPercent;
+            bool allocates = result.allocsPerOp > base->allocsPerOp + ALLOCS_TOLERANCE;
+            std::cout << std::showpos << std::setprecision(1) << std::setw(10) << change << "%"
+                      << std::noshowpos;
+            if (slower || allocates) {
+                std::cout << "  REGRESSION" << (slower ? " (time)" : "") << (allocates ? " (allocs)" : "");
+                regressions++;
+            }
+        } else if (!baseline.empty()) {
+            std::cout << "       new";
+        }
+        std::cout << std::endl;
+    }
+
+#ifdef DUALSENSITIVE_BENCH_API
+    stopApi();
+#endif
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream file(options.jsonPath);
+        if (!file) {
+            std::cerr << "cannot write " << options.jsonPath << std::endl;
+            return 2;
+        }
+        writeJson(file, results);
+    }
+    if (regressions) {
+        std::cout << regressions << " regression(s) against " << options.comparePath << std::endl;
+        return 1;
+    }
+    return 0;
+}
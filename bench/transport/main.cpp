@@ -0,0 +1,147 @@
+/*
+    Measures set-to-apply latency of the CLIENT -> SERVER transports:
+    the time from handing a trigger payload to udp::send / shm::send until
+    the (simulated) controller receives the resulting output report.
+
+    The service runs in-process against DS5W's simulated device, so the
+    numbers cover the transport and the server path but no HID driver.
+
+    usage: transport-bench [iterations]
+*/
+
+#include <dualsensitive.h>
+#include <udp.h>
+#include <shm.h>
+#include <IO.h>
+#include <Device.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BENCH_PORT 28473
+#define WARMUP_ITERATIONS 200
+#define APPLY_TIMEOUT_MS 1000
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<uint64_t> appliedCount{0};
+static std::atomic<int64_t> lastApplyNs{0};
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+}
+
+static void onOutputReport(const unsigned char*, unsigned short, void*) {
+    lastApplyNs.store(nowNs());
+    appliedCount.fetch_add(1);
+}
+
+// TRIGGER payload for the right trigger, alternating between two profiles
+static std::vector<uint8_t> triggerPayload(size_t i) {
+    TriggerProfile profile = (i & 1) ? TriggerProfile::Soft : TriggerProfile::Hard;
+    return {
+        static_cast<uint8_t>(PayloadType::TRIGGER),
+        1, // right trigger
+        static_cast<uint8_t>(profile),
+        0  // no extras
+    };
+}
+
+struct Result {
+    std::vector<double> latenciesUs;
+    size_t timeouts = 0;
+};
+
+static Result run(const std::function<bool(const std::vector<uint8_t>&)>& send, size_t iterations) {
+    Result result;
+    result.latenciesUs.reserve(iterations);
+    for (size_t i = 0; i < WARMUP_ITERATIONS + iterations; i++) {
+        std::vector<uint8_t> payload = triggerPayload(i);
+        uint64_t expected = appliedCount.load() + 1;
+
+        int64_t start = nowNs();
+        if (!send(payload)) {
+            result.timeouts++;
+            continue;
+        }
+        auto deadline = Clock::now() + std::chrono::milliseconds(APPLY_TIMEOUT_MS);
+        while (appliedCount.load() < expected && Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        if (appliedCount.load() < expected) {
+            result.timeouts++;
+            continue;
+        }
+        if (i >= WARMUP_ITERATIONS) {
+            result.latenciesUs.push_back((lastApplyNs.load() - start) / 1000.0);
+        }
+    }
+    return result;
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1));
+    return sorted[index];
+}
+
+static void report(const std::string& name, Result result) {
+    std::sort(result.latenciesUs.begin(), result.latenciesUs.end());
+    std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << result.latenciesUs.size()
+              << std::setw(10) << result.timeouts
+              << std::setw(12) << percentile(result.latenciesUs, 50.0)
+              << std::setw(12) << percentile(result.latenciesUs, 99.0)
+              << std::setw(12) << (result.latenciesUs.empty() ? 0.0 : result.latenciesUs.back())
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+
+    DS5W::SimulatedDevice device = {};
+    device.connection = DS5W::DeviceConnection::USB;
+    device.onOutputReport = onOutputReport;
+    DS5W::setSimulatedDevice(&device);
+
+    if (dualsensitive::init(AgentMode::SERVER, "transport-bench.log", false, BENCH_PORT) != dualsensitive::Status::Ok) {
+        std::cerr << "failed to start the in-process service" << std::endl;
+        return 1;
+    }
+    if (udp::startClient(BENCH_PORT) != udp::Status::Success) {
+        std::cerr << "failed to start the UDP client" << std::endl;
+        return 1;
+    }
+    if (shm::startClient(BENCH_PORT) != shm::Status::Success) {
+        std::cerr << "failed to map the shared-memory ring" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(16) << "transport" << std::right
+              << std::setw(10) << "samples" << std::setw(10) << "timeouts"
+              << std::setw(12) << "p50 (us)" << std::setw(12) << "p99 (us)"
+              << std::setw(12) << "max (us)" << std::endl;
+
+    report("udp", run([](const std::vector<uint8_t>& payload) {
+        return udp::send(payload) == udp::Status::Success;
+    }, iterations));
+
+    report("shared-memory", run([](const std::vector<uint8_t>& payload) {
+        return shm::send(payload) == shm::Status::Success;
+    }, iterations));
+
+    shm::stopClient();
+    udp::stopClient();
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return 0;
+}
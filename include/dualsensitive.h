@@ -17,6 +17,11 @@
 #include <vector>
 #include <functional>
 
+namespace DS5W {
+    struct _DS5InputState;
+    typedef _DS5InputState DS5InputState;
+}
+
 /**
  * Defines the operating mode of the DualSensitive library.
  * - SOLO: Directly accesses and controls the DualSense controller.
@@ -34,10 +39,54 @@ enum class AgentMode {
  * Supported types:
  *  - BIND: bind packet with PID
  *  - TRIGGER: trigger packet (existing behavior)
+ *  - COMMAND: sequenced packet carrying one or more trigger settings
+ *  - ACK: reply of the service to a COMMAND that requested acknowledgement
+ *  - SUBSCRIBE: request for input state updates at a given rate
+ *  - INPUT: delta encoded input state sent by the service to subscribers
+ *  - TIME_SYNC: clock offset probe, answered by the service with its own
+ *    receive and send timestamps
+ *  - HELLO: readiness probe sent by a starting client
+ *  - READY: the service's answer to HELLO, with its current state
+ *  - STATS: metrics request, answered with the service's metrics in the
+ *    Prometheus text exposition format
  */
 enum class PayloadType : uint8_t {
     BIND,
-    TRIGGER
+    TRIGGER,
+    COMMAND,
+    ACK,
+    SUBSCRIBE,
+    INPUT,
+    TIME_SYNC,
+    HELLO,
+    READY,
+    STATS
+};
+
+/**
+ * Defines how CLIENT mode delivers payloads to the DualSensitive Service
+ *  - UDP: datagrams to the service's loopback port (default)
+ *  - SHARED_MEMORY: records in a memory-mapped ring shared with the service;
+ *    sending makes no system call while the service is busy. Falls back to
+ *    UDP when the ring is not available, and for each record that finds
+ *    it full.
+ */
+enum class Transport {
+    UDP,
+    SHARED_MEMORY
+};
+
+/**
+ * What CLIENT mode does with a trigger update that finds its send queue full
+ *  - DROP_OLDEST: discards the oldest queued update to make room
+ *  - COALESCE: keeps only the newest update per trigger until the sender
+ *    thread catches up (default)
+ *  - BLOCK: waits until the sender thread makes room
+ */
+enum class QueuePolicy {
+    DROP_OLDEST,
+    COALESCE,
+    BLOCK
 };
 
 
@@ -112,7 +161,13 @@ enum class TriggerProfile : int8_t {
     Custom,
 };
 
-void setTriggerProfile(unsigned char *buffer, TriggerProfile profile, std::vector<uint8_t> extras = {});
+// longest extras a trigger setting keeps; the longest built-in profile takes 11
+#define TRIGGER_EXTRAS_MAX 32
+
+void setTriggerProfile(unsigned char *buffer, TriggerProfile profile, const std::vector<uint8_t>& extras = {});
+// same, without the vector; extras past TRIGGER_EXTRAS_MAX are ignored
+void setTriggerProfile(unsigned char *buffer, TriggerProfile profile,
+                                    const uint8_t *extras, size_t extrasSize);
 
 
 /**
@@ -126,13 +181,452 @@ namespace dualsensitive {
         NoControllersDetected
     };
 
+    /**
+     * Outcome of a command on the service side, as reported in its
+     * acknowledgement
+     */
+    enum class ApplyResult : uint8_t {
+        Applied = 0,
+        Disabled,            // adaptive triggers are disabled on the service
+        DeviceDisconnected,  // the controller write failed
+        Rejected,            // the command was malformed
+        Overridden           // a higher priority client owns the trigger(s)
+    };
+
+    /**
+     * Coalescing window that holds trigger changes until sendState()
+     * (see setCoalescing())
+     */
+    constexpr uint32_t COALESCE_UNTIL_SEND_STATE = UINT32_MAX;
+
+    /**
+     * CLIENT mode link statistics. The ACK based fields need
+     * setAcknowledgements(); RTT percentiles cover the most recent 512
+     * acknowledgements.
+     */
+    struct LinkStats {
+        uint64_t sent = 0;              // commands sent requesting an ACK
+        uint64_t acknowledged = 0;      // ACKs received
+        uint64_t lost = 0;              // commands not acknowledged within 1s
+        uint64_t notApplied = 0;        // ACKs with a result other than Applied
+        uint32_t pending = 0;           // commands still waiting for their ACK
+        double rttP50Us = 0.0;
+        double rttP90Us = 0.0;
+        double rttP99Us = 0.0;
+        double rttMaxUs = 0.0;
+        double serviceTimeP50Us = 0.0;  // receive-to-write time on the service
+        uint32_t lastAckedSequence = 0;
+        ApplyResult lastResult = ApplyResult::Applied;
+        int64_t msSinceLastAck = -1;    // -1 if no ACK was received yet
+        uint64_t suppressed = 0;        // updates equal to the last sent value
+        uint64_t coalesced = 0;         // updates merged into another packet
+        int64_t clockOffsetNs = 0;      // service clock minus ours, see syncClock()
+        int64_t clockSyncDelayNs = -1;  // round trip of that estimate, -1 if never synced
+        uint64_t scheduled = 0;         // acknowledged commands sent with a deadline
+        double scheduleErrorP50Us = 0.0;// write completion minus deadline
+        double scheduleErrorP99Us = 0.0;
+        double scheduleErrorMaxUs = 0.0;
+        uint64_t queueDropped = 0;      // updates discarded by QueuePolicy::DROP_OLDEST
+        uint64_t queueMerged = 0;       // updates merged by QueuePolicy::COALESCE
+        uint64_t queueBlocked = 0;      // updates that waited under QueuePolicy::BLOCK
+        uint32_t queueHighWater = 0;    // most updates queued at once
+    };
+
+    /**
+     * How the service's controller is attached
+     */
+    enum class ControllerConnection : uint8_t {
+        None = 0,
+        USB,
+        Bluetooth
+    };
+
+    /**
+     * Service state reported by waitForService()
+     */
+    struct ServiceState {
+        bool listening = false;            // the service answered
+        bool controllerConnected = false;
+        ControllerConnection connection = ControllerConnection::None;
+        bool enabled = false;              // adaptive triggers enabled on the service
+        bool sharedMemory = false;         // its shared-memory ring is available
+    };
+
+    /**
+     * Network streaming mode options, see setNetworkMode()
+     */
+    struct NetworkOptions {
+        std::string address;               // SERVER: address to bind, e.g. "0.0.0.0";
+                                           // CLIENT: the service host's address
+        uint8_t redundancy = 1;            // extra copies of each full-state packet
+        uint32_t redundancySpacingMs = 2;  // time between copies of a trigger state (CLIENT)
+        uint32_t jitterBufferMs = 10;      // playout delay of input snapshots, 0 for none (CLIENT)
+        double packetLoss = 0.0;           // test shim: fraction of outgoing datagrams dropped
+        std::string token;                 // shared secret, at most 64 bytes; see setNetworkMode()
+        uint32_t sessionTimeoutMs = 3000;  // SERVER: network clients silent this long lose their triggers
+    };
+
+    /**
+     * Network streaming statistics, see getStreamStats()
+     */
+    struct StreamStats {
+        uint64_t fullStateSent = 0;        // full-state trigger packets, copies included (CLIENT)
+        uint64_t inputReceived = 0;        // input snapshots, copies included (CLIENT)
+        uint64_t inputDuplicates = 0;      // copies of snapshots already received
+        uint64_t inputLost = 0;            // sequence gaps: snapshots skipped over
+        uint64_t inputLate = 0;            // snapshots older than one already received
+        double inputLossRate = 0.0;        // inputLost over the snapshots sent
+        double latencyP50Us = 0.0;         // service read to arrival; across hosts
+        double latencyP99Us = 0.0;         // this needs syncClock()
+        double jitterUs = 0.0;             // interarrival jitter (RFC 3550)
+        uint64_t staleCommands = 0;        // commands ignored as copies or out of order (SERVER)
+        uint64_t shimDropped = 0;          // datagrams eaten by the packet loss shim
+    };
+
+    /**
+     * SERVER mode per-client counters, see getClientStats()
+     */
+    struct ClientStats {
+        uint32_t pid = 0;              // 0 if the client has not sent its PID
+        uint8_t priority = 0;
+        uint64_t updates = 0;          // trigger commands received
+        uint64_t throttled = 0;        // commands that arrived over budget
+        uint64_t deferredWrites = 0;   // merged over-budget updates applied later
+        uint64_t scheduleRejected = 0; // scheduled commands over the cap or too far ahead
+    };
+
+    /**
+     * Actuation latency of one connection type, see setActuationProbe()
+     */
+    struct ActuationStats {
+        uint64_t probes = 0;        // writes that changed a trigger setting
+        uint64_t measured = 0;      // probes whose feedback change was seen
+        uint64_t superseded = 0;    // probes overtaken by the next write
+        uint64_t timeouts = 0;      // probes with no change within the timeout
+        double minUs = 0.0;         // over the most recent measured probes
+        double p50Us = 0.0;
+        double p90Us = 0.0;
+        double p99Us = 0.0;
+        double maxUs = 0.0;
+    };
+
     bool isConnected(void);
 
     uint32_t getClientPid(void);
+
+    using ClientExitFunc = void(*)(uint32_t pid, uint32_t remainingClients);
+
+    /**
+     * SERVER mode only. The service watches the process of every client
+     * that sent its PID (see sendPidToServer()) and releases that client's
+     * triggers as soon as the process exits. The callback is then called
+     * on a system thread pool thread.
+     * @param callback   receives the exited PID and the number of bound
+     *                   clients still running
+     */
+    void setClientExitCallback(ClientExitFunc callback);
+
+    /**
+     * SERVER mode only. Limits each client to a token bucket of trigger
+     * updates. An update over budget is not dropped: it is merged with the
+     * client's later updates (latest wins per trigger) and applied as soon
+     * as the bucket has a token again.
+     * @param updatesPerSecond   refill rate, 0 for no limit (default)
+     * @param burst              bucket size, at least 1
+     */
+    void setSessionRateLimit(uint32_t updatesPerSecond, uint32_t burst);
+
+    /**
+     * SERVER mode only. Returns the counters of every current client.
+     */
+    std::vector<ClientStats> getClientStats(void);
+
+    using InputStateFunc = void(*)(const DS5W::DS5InputState& state);
+
+    /**
+     * CLIENT mode only. Asks the service to stream the controller's input
+     * state (sticks, triggers, trigger feedback, buttons, motion, touch,
+     * battery) at the given rate. Only changed bytes are sent, and nothing
+     * at all while the state does not change. Needs the UDP transport for
+     * the replies; calling it again changes the rate.
+     * @param rateHz     updates per second, 1 to 1000
+     * @param callback   (optional) called on the receive thread with every
+     *                   new snapshot
+     * @return true if the subscription request was sent
+     */
+    bool subscribeInput(uint16_t rateHz, InputStateFunc callback = nullptr);
+
+    /**
+     * CLIENT mode only. Stops the input state stream.
+     */
+    void unsubscribeInput(void);
+
+    /**
+     * CLIENT mode only. Copies the latest input state received.
+     * @return false if no complete snapshot was received yet
+     */
+    bool getInputState(DS5W::DS5InputState& state);
+
+    /**
+     * Returns this process's metrics in the Prometheus text exposition
+     * format: HID write latency and failures, reconnects, input reads, UDP
+     * and shared-memory traffic, malformed payloads, queue depths, trigger
+     * profile encoding time and the controller's input report rate, drops,
+     * interval and jitter (from the report counter and sensor clock of
+     * each report read). Recording is lock-free (per-thread counters and
+     * fixed-bucket histograms).
+     */
+    std::string getMetrics(void);
+
+    /**
+     * CLIENT mode only. Asks the service for its getMetrics() text with a
+     * STATS request.
+     * @param text       receives the service's metrics
+     * @param timeoutMs  how long to wait for the answer
+     * @return false if the service did not answer in time
+     */
+    bool getServiceMetrics(std::string& text, uint32_t timeoutMs = 250);
+
+    /**
+     * Returns the heap allocations counted around the public API calls of
+     * this process, one line per call site: calls, allocations, bytes and
+     * allocations per call. Sites in other threads (e.g. the SERVER mode
+     * writer) are listed too. Counting needs a build with the
+     * DUALSENSITIVE_ALLOC_TRACKING CMake option; otherwise the report says
+     * so and the calls cost nothing extra.
+     */
+    std::string getAllocationReport(void);
+
+    /**
+     * Starts recording spans of the trigger path in this process: client
+     * serialize, UDP send, service receive, payload decoding, trigger
+     * profile encoding, CRC32 and the HID write. Each thread records into
+     * its own buffer without locks; while no trace is running a span costs
+     * one relaxed atomic load. Starting again discards the previous trace.
+     */
+    void startTrace(void);
+
+    /**
+     * Stops recording spans.
+     */
+    void stopTrace(void);
+
+    /**
+     * Writes the spans of the last trace as Chrome trace event JSON, for
+     * chrome://tracing or https://ui.perfetto.dev. Call stopTrace() first.
+     * Timestamps are on the clockNs() clock, so the traces of a client and the
+     * service can be loaded together.
+     * @param path   the output file
+     * @return false if the file could not be written
+     */
+    bool writeTrace(const std::string& path);
+
+    /**
+     * Starts capturing every input report read from and output report
+     * written to the controller, with steady clock timestamps, into a
+     * compact binary file (buffered appends). ds-replay plays captures
+     * back against the simulated controller.
+     * @param path   the capture file, created or truncated
+     * @return false if the file could not be created or a capture is
+     *         already running
+     */
+    bool startRecording(const std::string& path);
+
+    /**
+     * Flushes and closes the capture file.
+     */
+    void stopRecording(void);
+
+    /**
+     * SOLO and SERVER mode. Measures actuation latency: every write that
+     * changes a trigger setting is timestamped, and the input reports that
+     * follow are watched until the controller's trigger feedback bytes
+     * change. The time in between, write to first input report showing
+     * the new effect, goes to a histogram per connection type (also in
+     * getMetrics()). The trigger must be left alone while measuring, and
+     * settings should alternate between different trigger modes, since
+     * only a mode change is certain to show in the feedback.
+     * In SOLO mode each such write waits for its feedback (at most
+     * 250 ms); in SERVER mode the writer thread reads the
+     * controller between writes while the probe is on. Enabling resets
+     * the statistics.
+     * @param enable   true to start measuring, false to stop
+     */
+    void setActuationProbe(bool enable);
+
+    /**
+     * Returns the actuation latencies measured over one connection type.
+     * @param connection   USB or Bluetooth
+     */
+    ActuationStats getActuationStats(ControllerConnection connection);
+
+    /**
+     * SERVER mode only. Reads the controller at the given rate and
+     * publishes each input state to a read-only shared-memory segment
+     * (the reads made for subscribeInput() clients are published too).
+     * @param rateHz     reads per second, 0 (default) to only publish the
+     *                   subscribers' reads, at most 1000
+     */
+    void setInputPublishing(uint16_t rateHz);
+
+    /**
+     * Copies the latest input state published by the service on the given
+     * port. Works from any process on the service's host, in any mode and
+     * without init(): the snapshot is read straight from shared memory
+     * under a seqlock, with no system call and no round trip to the
+     * service.
+     * @param state       receives the input state
+     * @param sequence    (optional) receives the number of reads published
+     *                    so far; a snapshot whose sequence did not move is
+     *                    not a new read
+     * @param timestampNs (optional) receives the time of the read,
+     *                    comparable with clockNs()
+     * @param port        the service's UDP port
+     * @return false if the service publishes nothing (yet) or has stopped
+     */
+    bool readInputSnapshot(DS5W::DS5InputState& state, uint64_t* sequence = nullptr,
+                    int64_t* timestampNs = nullptr, uint16_t port = 28472);
+
+    /**
+     * Sets the priority this client announces with sendPidToServer().
+     * When several clients use the service, each trigger follows the
+     * client with the highest priority that has set it; ties go to the
+     * most recent update.
+     * @param priority   0 (default) to 255
+     */
+    void setPriority(uint8_t priority);
+
     void sendPidToServer(void);
 
+    /**
+     * CLIENT mode only. Waits until the service answers, probing it every
+     * few milliseconds, so a client that has just launched the service can
+     * go on as soon as it listens instead of sleeping a fixed time. Call it
+     * after init(); with Transport::SHARED_MEMORY it also claims the ring if
+     * init() could not. Until the service has answered, trigger changes go
+     * out in the older one-trigger format, which every service version
+     * understands; deadlines and acknowledgements need the answer.
+     * @param timeoutMs   how long to wait
+     * @param state       (optional) receives the state the service reported
+     * @return true if the service answered within timeoutMs
+     */
+    bool waitForService(uint32_t timeoutMs, ServiceState* state = nullptr);
+
     void ensureConnected(void);
 
+    /**
+     * Selects the transport used in CLIENT mode (default: Transport::UDP).
+     * Must be called before init(). BIND payloads always use UDP.
+     * @param transport   UDP or SHARED_MEMORY.
+     */
+    void setTransport(Transport transport);
+
+    using QueueSaturationFunc = void(*)(bool saturated);
+
+    /**
+     * Configures the queue between the CLIENT mode trigger setters and the
+     * background thread that sends the updates, so setting a trigger never
+     * waits on a socket or a lock. From one game thread, handing an update
+     * over is wait-free under COALESCE; otherwise, or with several game
+     * threads, it is lock-free. Must be called before init().
+     * @param capacity   queued updates, rounded up to a power of two (default: 64)
+     * @param policy     what to do with an update that finds the queue full
+     *                   (default: QueuePolicy::COALESCE)
+     * @param callback   (optional) called with true on the caller's thread
+     *                   when an update finds the queue full, and with false
+     *                   on the sender thread once it has drained the queue
+     */
+    void setSendQueue(size_t capacity, QueuePolicy policy,
+                                        QueueSaturationFunc callback = nullptr);
+
+    /**
+     * Opts into network streaming so the service and a client can run on
+     * different hosts. Must be called before init(), in both processes.
+     * Trigger packets then carry the client's whole trigger state and a
+     * sequence number, so copies and reordering are harmless, and each one
+     * is repeated `redundancy` times. Input snapshots (see subscribeInput())
+     * are sent as timestamped full states, repeated on the following ticks,
+     * and played out through a small jitter buffer. Forces the UDP
+     * transport.
+     * A network client presents `token` in its HELLOs (waitForService()
+     * and a keepalive every second). A service with a token ignores every
+     * UDP packet of a client until one of them matched it; one without a
+     * token serves no other host. Clients on other hosts cannot be
+     * watched for exit, so the service drops the session of a network
+     * client silent for `sessionTimeoutMs` and releases its triggers. The
+     * token is not encrypted; it only keeps strangers and spoofed senders
+     * from getting replies or sessions.
+     * @param options   see NetworkOptions
+     */
+    void setNetworkMode(const NetworkOptions& options);
+
+    /**
+     * Returns the network streaming statistics.
+     */
+    StreamStats getStreamStats(void);
+
+    /**
+     * Requests an acknowledgement for every trigger command sent in CLIENT
+     * mode. The service replies once the command was written to the
+     * controller, with the write result and its own timestamps.
+     * Acknowledgements need the UDP transport.
+     * @param enable   true to request acknowledgements (default: false)
+     */
+    void setAcknowledgements(bool enable);
+
+    /**
+     * CLIENT mode only. Trigger updates equal to what was last sent are
+     * always dropped. With a non-zero window, changes are also held back
+     * and every change made within the window goes out as one packet;
+     * sendState() sends held changes right away.
+     * @param windowMs   0 to send each change immediately (default), the
+     *                   window in milliseconds, or COALESCE_UNTIL_SEND_STATE
+     */
+    void setCoalescing(uint32_t windowMs);
+
+    /**
+     * Returns the monotonic clock that deadlines passed to
+     * setLeftTriggerAt() / setRightTriggerAt() refer to, in nanoseconds.
+     */
+    int64_t clockNs(void);
+
+    /**
+     * CLIENT mode only. Estimates the offset between clockNs() and the
+     * service's clock with NTP-style exchanges and keeps the one with the
+     * shortest round trip. Until it succeeds both clocks are assumed equal,
+     * which holds for a service on the same machine. Needs the UDP
+     * transport for the replies.
+     * @param samples     exchanges to make (default: 8)
+     * @param timeoutMs   time allowed for all of them
+     * @return true if at least one exchange was answered
+     */
+    bool syncClock(uint32_t samples = 8, uint32_t timeoutMs = 250);
+
+    /**
+     * CLIENT mode only. Sends a left trigger change right away that the
+     * service holds back and writes to the controller at applyAtNs. Changes
+     * staged by setCoalescing() are sent first. With setAcknowledgements(),
+     * getLinkStats() reports how far the writes landed from their deadlines.
+     * @param applyAtNs        deadline on the clockNs() clock
+     * @param triggerProfile   The mode to set for the adaptive trigger
+     * @param extras           (optional) Additional parameters required by the trigger
+     */
+    void setLeftTriggerAt(int64_t applyAtNs, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras = {});
+
+    /**
+     * CLIENT mode only. Same as setLeftTriggerAt() for the right trigger.
+     */
+    void setRightTriggerAt(int64_t applyAtNs, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras = {});
+
+    /**
+     * Returns the link statistics gathered from acknowledgements.
+     * A growing `pending` count together with a growing `msSinceLastAck`
+     * indicates a wedged or exited service.
+     */
+    LinkStats getLinkStats(void);
+
     /**
      * Initializes the DualSensitive interface in the specified mode.
      * @param mode        SOLO, SERVER, or CLIENT.
@@ -158,14 +652,14 @@ namespace dualsensitive {
     * @param triggerProfile The mode to set for the adaptive trigger
     * @param extras (optional) Additional parameters required by the trigger
     */
-    void setLeftTrigger(TriggerProfile triggerProfile, std::vector<uint8_t> extras = {});
+    void setLeftTrigger(TriggerProfile triggerProfile, const std::vector<uint8_t>& extras = {});
 
     /**
     * Sets an adaptive trigger mode to the right trigger (i.e., R2)
     * @param   triggerProfile The mode to set for the adaptive trigger
     * @param   extras (optional) Additional parameters required by the trigger
     */
-    void setRightTrigger(TriggerProfile triggerProfile, std::vector<uint8_t> extras = {});
+    void setRightTrigger(TriggerProfile triggerProfile, const std::vector<uint8_t>& extras = {});
     /**
      * Sets an custom adaptive trigger mode to the left trigger (i.e., L2)
      *
@@ -178,7 +672,7 @@ namespace dualsensitive {
      * mode
      */
     void setLeftCustomTrigger(TriggerMode customMode,
-                                        std::vector<uint8_t> extras);
+                                        const std::vector<uint8_t>& extras);
     /**
      * Sets an custom adaptive trigger mode to the right trigger (i.e., R2)
      *
@@ -191,7 +685,13 @@ namespace dualsensitive {
      * mode
      */
     void setRightCustomTrigger(TriggerMode customMode,
-                                        std::vector<uint8_t> extras);
+                                        const std::vector<uint8_t>& extras);
+
+    /**
+     * Writes the current state to the controller. In CLIENT mode, has the
+     * sender thread send the trigger changes held back by setCoalescing()
+     * right after the updates queued before this call.
+     */
     void sendState(void);
 
     /**
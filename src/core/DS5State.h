@@ -272,9 +272,12 @@ namespace DS5W {
 	} TriggerEffect;
 
     // new structure for more options based on what's defind in dualsensitive.h
+    // (a fixed array, so the output state stays trivially copyable and
+    // setting a trigger never touches the heap)
 	typedef struct _TriggerSetting {
         TriggerProfile profile;
-        std::vector<unsigned char> extras;
+        unsigned char extras[TRIGGER_EXTRAS_MAX];
+        unsigned char extrasSize;
     } TriggerSetting;
 
 	/// <summary>
@@ -395,6 +398,36 @@ namespace DS5W {
 		/// EXPERIMAENTAL: Feedback of the right adaptive trigger (only when trigger effect is active)
 		/// </summary>
 		unsigned char rightTriggerFeedback;
+
+		/// <summary>
+		/// Report counter, incremented by the controller with every input report it sends (wraps at 256)
+		/// </summary>
+		unsigned char reportCounter;
+
+		/// <summary>
+		/// Sensor timestamp of the report in units of about 0.33 microseconds (wraps)
+		/// </summary>
+		unsigned int sensorTimestamp;
+
+		/// <summary>
+		/// Reports the controller sent since the previous report read from the device that were never read (lost on the link or flushed by a late reader; 0 for the first report)
+		/// </summary>
+		unsigned int reportsDropped;
+
+		/// <summary>
+		/// The report counter may have wrapped since the previous report and the report period is not known yet, so reportsDropped is a guess
+		/// </summary>
+		bool reportsAliased;
+
+		/// <summary>
+		/// Sensor time since the previous report read from the device in microseconds (0 for the first report)
+		/// </summary>
+		unsigned int reportIntervalUs;
+
+		/// <summary>
+		/// Smoothed variation of reportIntervalUs between reads in microseconds
+		/// </summary>
+		unsigned int reportJitterUs;
 	} DS5InputState;
 
 	typedef struct _DS5OutputState {
@@ -1,5 +1,13 @@
 #include "DS5_Input.h"
 
+#include <cstring>
+
+// Longest plausible time between two consecutive reports; longer intervals
+// between counter steps of one are taken as a wrapped counter
+#define INPUT_PERIOD_MAX_US 16000
+// Shortest plausible report period, until the real one is learned
+#define INPUT_PERIOD_MIN_US 250
+
 void __DS5W::Input::evaluateHidInputBuffer(unsigned char* hidInBuffer, DS5W::DS5InputState* ptrInputState) {
 	// Convert sticks to signed range
 	ptrInputState->leftStick.x = (char)(((short)(hidInBuffer[0x00] - 128)));
@@ -16,6 +24,10 @@ void __DS5W::Input::evaluateHidInputBuffer(unsigned char* hidInBuffer, DS5W::DS5
 	ptrInputState->buttonsA = hidInBuffer[0x08];
 	ptrInputState->buttonsB = hidInBuffer[0x09];
 
+	// Report counter and sensor timestamp
+	ptrInputState->reportCounter = hidInBuffer[0x06];
+	memcpy(&ptrInputState->sensorTimestamp, &hidInBuffer[0x1B], sizeof(ptrInputState->sensorTimestamp));
+
 	// Dpad
 	switch (hidInBuffer[0x07] & 0x0F) {
 		// Up
@@ -59,14 +71,16 @@ void __DS5W::Input::evaluateHidInputBuffer(unsigned char* hidInBuffer, DS5W::DS5
 	memcpy(&ptrInputState->gyroscope, &hidInBuffer[0x15], 2 * 3);
 
 	// Evaluate touch state 1
-	UINT32 touchpad1Raw = *(UINT32*)(&hidInBuffer[0x20]);
+	uint32_t touchpad1Raw;
+	memcpy(&touchpad1Raw, &hidInBuffer[0x20], sizeof(touchpad1Raw));
 	ptrInputState->touchPoint1.y = (touchpad1Raw & 0xFFF00000) >> 20;
 	ptrInputState->touchPoint1.x = (touchpad1Raw & 0x000FFF00) >> 8;
 	ptrInputState->touchPoint1.down = (touchpad1Raw & (1 << 7)) == 0;
 	ptrInputState->touchPoint1.id = (touchpad1Raw & 127);
 
 	// Evaluate touch state 2
-	UINT32 touchpad2Raw = *(UINT32*)(&hidInBuffer[0x24]);
+	uint32_t touchpad2Raw;
+	memcpy(&touchpad2Raw, &hidInBuffer[0x24], sizeof(touchpad2Raw));
 	ptrInputState->touchPoint2.y = (touchpad2Raw & 0xFFF00000) >> 20;
 	ptrInputState->touchPoint2.x = (touchpad2Raw & 0x000FFF00) >> 8;
 	ptrInputState->touchPoint2.down = (touchpad2Raw & (1 << 7)) == 0;
@@ -84,3 +98,53 @@ void __DS5W::Input::evaluateHidInputBuffer(unsigned char* hidInBuffer, DS5W::DS5
 	ptrInputState->battery.fullyCharged = (hidInBuffer[0x36] & 0x20);
 	ptrInputState->battery.level =  ((hidInBuffer[0x34] & 0x0F)*100)/8;
 }
+
+void __DS5W::Input::evaluateInputSequence(DS5W::InputSequence* ptrSequence, DS5W::DS5InputState* ptrInputState) {
+	ptrInputState->reportsAliased = false;
+	if (!ptrSequence->valid) {
+		// Nothing to compare the first report with
+		ptrInputState->reportsDropped = 0;
+		ptrInputState->reportIntervalUs = 0;
+	}
+	else {
+		// Unsigned differences handle the wrap of both; a counter that did not
+		// move (e.g. a simulated controller) counts as no drop
+		unsigned char step = (unsigned char)(ptrInputState->reportCounter - ptrSequence->lastCounter);
+		unsigned int intervalUs = (ptrInputState->sensorTimestamp - ptrSequence->lastTimestamp) / 3;
+		ptrInputState->reportsDropped = step ? step - 1 : 0;
+		ptrInputState->reportIntervalUs = intervalUs;
+
+		// Learn the report period from reads one report apart: P += (I - P) / 16
+		if (step == 1 && intervalUs && intervalUs <= INPUT_PERIOD_MAX_US) {
+			if (!ptrSequence->periodUs)
+				ptrSequence->periodUs = intervalUs;
+			else
+				ptrSequence->periodUs = (unsigned int)((int)ptrSequence->periodUs
+					+ ((int)intervalUs - (int)ptrSequence->periodUs) / 16);
+		}
+
+		// A reader slower than half the counter range may have seen it wrap:
+		// count the reports from the sensor time instead, or flag the guess
+		if (ptrSequence->periodUs) {
+			if (intervalUs >= 128 * ptrSequence->periodUs) {
+				unsigned int reports = (intervalUs + ptrSequence->periodUs / 2) / ptrSequence->periodUs;
+				ptrInputState->reportsDropped = reports ? reports - 1 : 0;
+			}
+		}
+		else if (intervalUs >= 128 * INPUT_PERIOD_MIN_US) {
+			ptrInputState->reportsAliased = true;
+		}
+
+		// Interarrival jitter: J += (|D| - J) / 16
+		if (ptrSequence->lastIntervalUs && ptrInputState->reportIntervalUs) {
+			float delta = (float)ptrInputState->reportIntervalUs - (float)ptrSequence->lastIntervalUs;
+			ptrSequence->jitterUs += ((delta < 0 ? -delta : delta) - ptrSequence->jitterUs) / 16.0f;
+		}
+	}
+	ptrInputState->reportJitterUs = (unsigned int)(ptrSequence->jitterUs + 0.5f);
+
+	ptrSequence->valid = true;
+	ptrSequence->lastCounter = ptrInputState->reportCounter;
+	ptrSequence->lastTimestamp = ptrInputState->sensorTimestamp;
+	ptrSequence->lastIntervalUs = ptrInputState->reportIntervalUs;
+}
@@ -13,8 +13,6 @@
 #include <Device.h>
 #include <DS5State.h>
 
-#include <Windows.h>
-
 namespace __DS5W {
 	namespace Input {
 		/// <summary>
@@ -24,5 +22,12 @@ namespace __DS5W {
 		/// <param name="ptrInputState">Input state to be set</param>
 		/// <returns></returns>
 		void evaluateHidInputBuffer(unsigned char* hidInBuffer, DS5W::DS5InputState* ptrInputState);
+
+		/// <summary>
+		/// Sets the drop, interval and jitter fields of an evaluated input state against the previous report of the same device
+		/// </summary>
+		/// <param name="ptrSequence">Sequence of the device (updated)</param>
+		/// <param name="ptrInputState">Input state evaluated from the report just read</param>
+		void evaluateInputSequence(DS5W::InputSequence* ptrSequence, DS5W::DS5InputState* ptrInputState);
 	}
 }
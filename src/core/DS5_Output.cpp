@@ -16,6 +16,10 @@
 
 #include "DS5_Output.h"
 #include "logger.h"
+#include <metrics.h>
+#include <trace.h>
+
+#include <algorithm>
 
 void __DS5W::Output::createHidOutputBuffer(unsigned char* hidOutBuffer, DS5W::DS5OutputState* ptrOutputState) {
 	// Feature mask
@@ -62,7 +66,9 @@ void __DS5W::Output::createHidOutputBuffer(unsigned char* hidOutBuffer, DS5W::DS
 }
 
 void __DS5W::Output::processTriggerSetting(DS5W::TriggerSetting *setting, unsigned char *buffer) {
-    setTriggerProfile(buffer, setting->profile, setting->extras);
+    metrics::ScopedTimer timer(metrics::Histogram::ProfileEncode);
+    TRACE_SPAN("setTriggerProfile");
+    setTriggerProfile(buffer, setting->profile, setting->extras, setting->extrasSize);
 }
 
 void __DS5W::Output::processTrigger(DS5W::TriggerEffect* ptrEffect, unsigned char* buffer) {
@@ -104,7 +110,7 @@ void __DS5W::Output::processTrigger(DS5W::TriggerEffect* ptrEffect, unsigned cha
 			buffer[0x05] = ptrEffect->EffectEx.middleForce;
 			buffer[0x06] = ptrEffect->EffectEx.endForce;
 			// Frequency
-			buffer[0x09] = max(1, ptrEffect->EffectEx.frequency / 2);
+			buffer[0x09] = std::max(1, ptrEffect->EffectEx.frequency / 2);
 
 			break;
 
@@ -146,7 +152,7 @@ void __DS5W::Output::processTrigger(DS5W::TriggerEffect* ptrEffect, unsigned cha
 			break;
 		// No resistance / default
 		case DS5W::TriggerEffectType::NoResitance:
-			__fallthrough;
+			[[fallthrough]];
 		default:
 			// All zero
 			buffer[0x00] = 0x00;
@@ -14,8 +14,6 @@
 #include <Device.h>
 #include <DS5State.h>
 
-#include <Windows.h>
-
 namespace __DS5W {
 	namespace Output {
 		/// <summary>
@@ -1,7 +1,7 @@
 #include "DS_CRC32.h"
 
 // Hash tabel
-const UINT32 __DS5W::CRC32::hashTable[256] = {
+const uint32_t __DS5W::CRC32::hashTable[256] = {
     0xd202ef8d, 0xa505df1b, 0x3c0c8ea1, 0x4b0bbe37, 0xd56f2b94, 0xa2681b02, 0x3b614ab8, 0x4c667a2e,
     0xdcd967bf, 0xabde5729, 0x32d70693, 0x45d03605, 0xdbb4a3a6, 0xacb39330, 0x35bac28a, 0x42bdf21c,
     0xcfb5ffe9, 0xb8b2cf7f, 0x21bb9ec5, 0x56bcae53, 0xc8d83bf0, 0xbfdf0b66, 0x26d65adc, 0x51d16a4a,
@@ -37,11 +37,11 @@ const UINT32 __DS5W::CRC32::hashTable[256] = {
 };
 
 // Hash seed
-const UINT32 __DS5W::CRC32::crcSeed = 0xeada2d49;
+const uint32_t __DS5W::CRC32::crcSeed = 0xeada2d49;
 
-UINT32 __DS5W::CRC32::compute(unsigned char* buffer, size_t len) {
+uint32_t __DS5W::CRC32::compute(unsigned char* buffer, size_t len) {
     // Start point
-    UINT32 result = crcSeed;
+    uint32_t result = crcSeed;
     
     // Foreach element in arrray
     for (size_t i = 0; i < len; i++) {
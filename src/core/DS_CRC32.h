@@ -13,7 +13,8 @@
 #include <Device.h>
 #include <DS5State.h>
 
-#include <Windows.h>
+#include <cstddef>
+#include <cstdint>
 
 namespace __DS5W {
 	/// <summary>
@@ -24,12 +25,12 @@ namespace __DS5W {
 		/// <summary>
 		/// Fast lookup precalculated byte crc hashes
 		/// </summary>
-		const static UINT32 hashTable[256];
+		const static uint32_t hashTable[256];
 
 		/// <summary>
 		/// Start seed for crc hash
 		/// </summary>
-		const static UINT32 crcSeed;
+		const static uint32_t crcSeed;
 
 
 	public:
@@ -39,6 +40,6 @@ namespace __DS5W {
 		/// <param name="buffer">Input buffer</param>
 		/// <param name="len">Length of buffer</param>
 		/// <returns>Computed crc value</returns>
-		static UINT32 compute(unsigned char* buffer, size_t len);
+		static uint32_t compute(unsigned char* buffer, size_t len);
 	};
 }
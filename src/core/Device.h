@@ -46,6 +46,66 @@ namespace DS5W {
 		} _internal;
 	} DeviceEnumInfo;
 
+	/// <summary>
+	/// Simulated controller that stands in for real HID hardware (benchmarks and tools)
+	/// </summary>
+	typedef struct _SimulatedDevice {
+		/// <summary>
+		/// Connection type the simulated controller reports
+		/// </summary>
+		DeviceConnection connection;
+
+		/// <summary>
+		/// Called with every output report written to the controller (report id included)
+		/// </summary>
+		void (*onOutputReport)(const unsigned char* report, unsigned short length, void* userData);
+
+		/// <summary>
+		/// (Optional) Fills the next input report (report id included). Returning false simulates a removed device
+		/// </summary>
+		bool (*onInputReport)(unsigned char* report, unsigned short length, void* userData);
+
+		/// <summary>
+		/// User pointer handed to both callbacks
+		/// </summary>
+		void* userData;
+	} SimulatedDevice;
+
+	/// <summary>
+	/// Report counter and sensor time of the last input report read from a device
+	/// </summary>
+	typedef struct _InputSequence {
+		/// <summary>
+		/// A report was read since the device was (re)connected
+		/// </summary>
+		bool valid;
+
+		/// <summary>
+		/// Report counter of the last report
+		/// </summary>
+		unsigned char lastCounter;
+
+		/// <summary>
+		/// Sensor timestamp of the last report
+		/// </summary>
+		unsigned int lastTimestamp;
+
+		/// <summary>
+		/// Interval before the last report in microseconds (0 if unknown)
+		/// </summary>
+		unsigned int lastIntervalUs;
+
+		/// <summary>
+		/// Smoothed sensor time between two consecutive reports in microseconds (0 until learned)
+		/// </summary>
+		unsigned int periodUs;
+
+		/// <summary>
+		/// Interarrival jitter of the reports in microseconds (smoothed like RFC 3550 does)
+		/// </summary>
+		float jitterUs;
+	} InputSequence;
+
 	/// <summary>
 	/// Device context
 	/// </summary>
@@ -101,6 +161,19 @@ namespace DS5W {
             /// </summary>
             unsigned short featureReportLen;
 
+            /// <summary>
+            /// Simulated controller backing this context (nullptr for real
+            /// HID devices). When set, reports are routed to its callbacks
+            /// instead of ReadFile / WriteFile.
+            /// </summary>
+            const SimulatedDevice* simulated;
+
+            /// <summary>
+            /// Sequence of the input reports read so far, to find the ones
+            /// that were never read (reset on every (re)connect)
+            /// </summary>
+            InputSequence inputSequence;
+
 		}_internal;
 	} DeviceContext;
 }
@@ -13,8 +13,12 @@
 #include <DS_CRC32.h>
 #include <DS5_Input.h>
 #include <DS5_Output.h>
+#include <trace.h>
+#include <recorder.h>
 
+#ifndef NOMINMAX
 #define NOMINMAX
+#endif
 
 #include <Windows.h>
 #include <malloc.h>
@@ -24,17 +28,94 @@
 #include <SetupAPI.h>
 #include <hidsdi.h>
 
+#include <atomic>
 
 #define SONY_VENDOR_ID 0x054C
 #define DUALSENSE_ID 0x0CE6
 #define DUALSENSE_EDGE_ID 0x0DF2
 
+// Device path reported for the simulated controller
+#define SIMULATED_DEVICE_PATH L"\\\\?\\dualsensitive#simulated"
+
+// Simulated controller installed by setSimulatedDevice() (nullptr = real hardware)
+static std::atomic<const DS5W::SimulatedDevice*> simulatedDevice = nullptr;
+
+// Read one input report into the context's hid buffer
+static bool readReport(DS5W::DeviceContext* ptrContext, unsigned short length) {
+	const DS5W::SimulatedDevice* sim = ptrContext->_internal.simulated;
+	if (sim) {
+		if (!sim->onInputReport) {
+			// Neutral report: only the report id is set
+			ZeroMemory(&ptrContext->_internal.hidBuffer[1], length - 1);
+			return true;
+		}
+		return sim->onInputReport(ptrContext->_internal.hidBuffer, length, sim->userData);
+	}
+
+	DWORD bytesRead = 0;
+	return ReadFile(ptrContext->_internal.deviceHandle, ptrContext->_internal.hidBuffer, length, &bytesRead, NULL);
+}
+
+// Write the context's hid buffer as one output report
+static bool writeReport(DS5W::DeviceContext* ptrContext, unsigned short length) {
+	// covers the simulated device too, so traces of test runs show the write
+	TRACE_SPAN("WriteFile");
+	const DS5W::SimulatedDevice* sim = ptrContext->_internal.simulated;
+	if (sim) {
+		if (sim->onOutputReport) {
+			sim->onOutputReport(ptrContext->_internal.hidBuffer, length, sim->userData);
+		}
+		return true;
+	}
+
+	DWORD bytesWritten = 0;
+	return WriteFile(ptrContext->_internal.deviceHandle, ptrContext->_internal.hidBuffer, length, &bytesWritten, NULL);
+}
+
+// Append the report in the context's hid buffer to the running capture, if any
+static void recordReport(DS5W::DeviceContext* ptrContext, recorder::Direction direction, unsigned short length) {
+	if (recorder::isActive()) {
+		recorder::capture(direction, (uint8_t)ptrContext->_internal.connection, ptrContext->_internal.hidBuffer, length);
+	}
+}
+
+// Report lengths match the caps of a real DualSense
+static void initSimulatedContext(const DS5W::SimulatedDevice* sim, DS5W::DeviceContext* ptrContext) {
+	bool bt = sim->connection == DS5W::DeviceConnection::BT;
+	ptrContext->_internal.inputReportLen   = bt ? 78 : 64;
+	ptrContext->_internal.outputReportLen  = bt ? 78 : 48;
+	ptrContext->_internal.featureReportLen = 64;
+	ptrContext->_internal.connection = sim->connection;
+	ptrContext->_internal.deviceHandle = NULL;
+	ptrContext->_internal.simulated = sim;
+	ptrContext->_internal.connected = true;
+	ptrContext->_internal.inputSequence = {};
+}
+
+DS5W_API void DS5W::setSimulatedDevice(const DS5W::SimulatedDevice* ptrDevice) {
+	simulatedDevice.store(ptrDevice);
+}
+
 DS5W_API DS5W_ReturnValue DS5W::enumDevices(void* ptrBuffer, unsigned int inArrLength, unsigned int* requiredLength, bool pointerToArray) {
 	// Check for invalid non expected buffer
 	if (inArrLength && !ptrBuffer) {
 		inArrLength = 0;
 	}
 
+	// Simulated controller replaces all hardware
+	const DS5W::SimulatedDevice* sim = simulatedDevice.load();
+	if (sim) {
+		if (inArrLength) {
+			DS5W::DeviceEnumInfo* ptrInfo = pointerToArray ? (DS5W::DeviceEnumInfo*)ptrBuffer : ((DS5W::DeviceEnumInfo**)ptrBuffer)[0];
+			wcscpy_s(ptrInfo->_internal.path, 260, SIMULATED_DEVICE_PATH);
+			ptrInfo->_internal.connection = sim->connection;
+		}
+		if (requiredLength) {
+			*requiredLength = 1;
+		}
+		return inArrLength ? DS5W_OK : DS5W_E_INSUFFICIENT_BUFFER;
+	}
+
 	// Get all hid devices from devs
 	HANDLE hidDiHandle = SetupDiGetClassDevs(&GUID_DEVINTERFACE_HID, NULL, NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
 	if (!hidDiHandle || (hidDiHandle == INVALID_HANDLE_VALUE)) {
@@ -187,6 +268,14 @@ DS5W_API DS5W_ReturnValue DS5W::initDeviceContext(DS5W::DeviceEnumInfo* ptrEnumI
 		return DS5W_E_INVALID_ARGS;
 	}
 
+	// Simulated controller
+	const DS5W::SimulatedDevice* sim = simulatedDevice.load();
+	if (sim && wcscmp(ptrEnumInfo->_internal.path, SIMULATED_DEVICE_PATH) == 0) {
+		initSimulatedContext(sim, ptrContext);
+		wcscpy_s(ptrContext->_internal.devicePath, 260, ptrEnumInfo->_internal.path);
+		return DS5W_OK;
+	}
+
 	// Connect to device
 	HANDLE deviceHandle = CreateFileW(ptrEnumInfo->_internal.path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, NULL, NULL);
 	if (!deviceHandle || (deviceHandle == INVALID_HANDLE_VALUE)) {
@@ -214,6 +303,8 @@ DS5W_API DS5W_ReturnValue DS5W::initDeviceContext(DS5W::DeviceEnumInfo* ptrEnumI
 	ptrContext->_internal.connected = true;
 	ptrContext->_internal.connection = ptrEnumInfo->_internal.connection;
 	ptrContext->_internal.deviceHandle = deviceHandle;
+	ptrContext->_internal.simulated = nullptr;
+	ptrContext->_internal.inputSequence = {};
 	wcscpy_s(ptrContext->_internal.devicePath, 260, ptrEnumInfo->_internal.path);
 
 	// Get input report length
@@ -243,7 +334,7 @@ DS5W_API DS5W_ReturnValue DS5W::initDeviceContext(DS5W::DeviceEnumInfo* ptrEnumI
 
 DS5W_API void DS5W::freeDeviceContext(DS5W::DeviceContext* ptrContext) {
 	// Check if handle is existing
-	if (ptrContext->_internal.deviceHandle) {
+	if (ptrContext->_internal.deviceHandle || ptrContext->_internal.simulated) {
 		// Send zero output report to disable all onging outputs
 		DS5W::DS5OutputState os;
 		ZeroMemory(&os, sizeof(DS5W::DS5OutputState));
@@ -260,8 +351,11 @@ DS5W_API void DS5W::freeDeviceContext(DS5W::DeviceContext* ptrContext) {
 		DS5W::setDeviceOutputState(ptrContext, &os);
 
 		// Close handle
-		CloseHandle(ptrContext->_internal.deviceHandle);
+		if (ptrContext->_internal.deviceHandle) {
+			CloseHandle(ptrContext->_internal.deviceHandle);
+		}
 		ptrContext->_internal.deviceHandle = NULL;
+		ptrContext->_internal.simulated = nullptr;
 	}
 	
 	// Unset bool
@@ -277,6 +371,16 @@ DS5W_API DS5W_ReturnValue DS5W::reconnectDevice(DS5W::DeviceContext* ptrContext)
 		return DS5W_E_INVALID_ARGS;
 	}
 
+	// Simulated controller
+	if (wcscmp(ptrContext->_internal.devicePath, SIMULATED_DEVICE_PATH) == 0) {
+		const DS5W::SimulatedDevice* sim = simulatedDevice.load();
+		if (!sim) {
+			return DS5W_E_DEVICE_REMOVED;
+		}
+		initSimulatedContext(sim, ptrContext);
+		return DS5W_OK;
+	}
+
 	// Connect to device
 	HANDLE deviceHandle = CreateFileW(ptrContext->_internal.devicePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, NULL, NULL);
 	if (!deviceHandle || (deviceHandle == INVALID_HANDLE_VALUE)) {
@@ -303,6 +407,7 @@ DS5W_API DS5W_ReturnValue DS5W::reconnectDevice(DS5W::DeviceContext* ptrContext)
 	// Write to conext
 	ptrContext->_internal.connected = true;
 	ptrContext->_internal.deviceHandle = deviceHandle;
+	ptrContext->_internal.inputSequence = {};
 
 	// Return ok
 	return DS5W_OK;
@@ -320,7 +425,9 @@ DS5W_API DS5W_ReturnValue DS5W::getDeviceInputState(DS5W::DeviceContext* ptrCont
 	}
 
 	// Get the most recent package
-	HidD_FlushQueue(ptrContext->_internal.deviceHandle);
+	if (!ptrContext->_internal.simulated) {
+		HidD_FlushQueue(ptrContext->_internal.deviceHandle);
+	}
 
 	// Get input report length
 	//unsigned short inputReportLength = 0;
@@ -335,16 +442,18 @@ DS5W_API DS5W_ReturnValue DS5W::getDeviceInputState(DS5W::DeviceContext* ptrCont
 	}
 
 	// Get device input
-	DWORD bytesRead = 0;
-	if (!ReadFile(ptrContext->_internal.deviceHandle, ptrContext->_internal.hidBuffer, inputReportLength, &bytesRead, NULL)) {
+	if (!readReport(ptrContext, inputReportLength)) {
 		// Close handle and set error state
-		CloseHandle(ptrContext->_internal.deviceHandle);
+		if (ptrContext->_internal.deviceHandle) {
+			CloseHandle(ptrContext->_internal.deviceHandle);
+		}
 		ptrContext->_internal.deviceHandle = NULL;
 		ptrContext->_internal.connected = false;
 
 		// Return error
 		return DS5W_E_DEVICE_REMOVED;
 	}
+	recordReport(ptrContext, recorder::Direction::Input, inputReportLength);
 
 	// Evaluete input buffer
 	if (ptrContext->_internal.connection == DS5W::DeviceConnection::BT) {
@@ -354,6 +463,7 @@ DS5W_API DS5W_ReturnValue DS5W::getDeviceInputState(DS5W::DeviceContext* ptrCont
 		// Else it is USB so call its evaluator
 		__DS5W::Input::evaluateHidInputBuffer(&ptrContext->_internal.hidBuffer[1], ptrInputState);
 	}
+	__DS5W::Input::evaluateInputSequence(&ptrContext->_internal.inputSequence, ptrInputState);
 	
 	// Return ok
 	return DS5W_OK;
@@ -385,7 +495,11 @@ DS5W_API DS5W_ReturnValue DS5W::setDeviceOutputState(DS5W::DeviceContext* ptrCon
 		__DS5W::Output::createHidOutputBuffer(&ptrContext->_internal.hidBuffer[2], ptrOutputState);
 
 		// Hash
-		const UINT32 crcChecksum = __DS5W::CRC32::compute(ptrContext->_internal.hidBuffer, 74);
+		UINT32 crcChecksum;
+		{
+			TRACE_SPAN("CRC32");
+			crcChecksum = __DS5W::CRC32::compute(ptrContext->_internal.hidBuffer, 74);
+		}
 
 		ptrContext->_internal.hidBuffer[0x4A] = (unsigned char)((crcChecksum & 0x000000FF) >> 0UL);
 		ptrContext->_internal.hidBuffer[0x4B] = (unsigned char)((crcChecksum & 0x0000FF00) >> 8UL);
@@ -402,16 +516,18 @@ DS5W_API DS5W_ReturnValue DS5W::setDeviceOutputState(DS5W::DeviceContext* ptrCon
 	}
 
 	// Write to controller
-	DWORD bytesWritten = 0;
-	if (!WriteFile(ptrContext->_internal.deviceHandle, ptrContext->_internal.hidBuffer, outputReportLength, &bytesWritten, NULL)) {
+	if (!writeReport(ptrContext, outputReportLength)) {
 		// Close handle and set error state
-		CloseHandle(ptrContext->_internal.deviceHandle);
+		if (ptrContext->_internal.deviceHandle) {
+			CloseHandle(ptrContext->_internal.deviceHandle);
+		}
 		ptrContext->_internal.deviceHandle = NULL;
 		ptrContext->_internal.connected = false;
 
 		// Return error
 		return DS5W_E_DEVICE_REMOVED;
 	}
+	recordReport(ptrContext, recorder::Direction::Output, outputReportLength);
 
 	// OK 
 	return DS5W_OK;
@@ -78,4 +78,10 @@ namespace DS5W {
 	/// <param name="ptrOutputState">Pointer to output state to be set</param>
 	/// <returns>Result of call</returns>
 	DS5W_API DS5W_ReturnValue setDeviceOutputState(DS5W::DeviceContext* ptrContext, DS5W::DS5OutputState* ptrOutputState);
+
+	/// <summary>
+	/// Install a simulated controller. While set, enumDevices reports it as the only device and its contexts do no HID I/O
+	/// </summary>
+	/// <param name="ptrDevice">Simulated device (must outlive its use) or nullptr to go back to real hardware</param>
+	DS5W_API void setSimulatedDevice(const DS5W::SimulatedDevice* ptrDevice);
 }
@@ -0,0 +1,207 @@
+/*
+    alloc.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#include <alloc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+    // plain thread_local counters: operator new must not allocate or lock
+    thread_local uint64_t threadAllocations = 0;
+    thread_local uint64_t threadBytes = 0;
+
+    std::atomic<alloc::Site*> sites{nullptr};
+}
+
+#ifdef DUALSENSITIVE_ALLOC_TRACKING
+
+namespace {
+
+    void* countedAlloc(size_t size) {
+        threadAllocations++;
+        threadBytes += size;
+        return std::malloc(size ? size : 1);
+    }
+
+    void* countedAlignedAlloc(size_t size, std::align_val_t alignment) {
+        threadAllocations++;
+        threadBytes += size;
+        size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+        return _aligned_malloc(size ? size : 1, align);
+#else
+        void* pointer = nullptr;
+        return posix_memalign(&pointer, align, size ? size : 1) == 0 ? pointer : nullptr;
+#endif
+    }
+
+    void alignedFree(void* pointer) {
+#ifdef _WIN32
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+}
+
+void* operator new(size_t size) {
+    if (void* pointer = countedAlloc(size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* pointer = countedAlignedAlloc(size, alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    alignedFree(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    alignedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    alignedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+    alignedFree(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept {
+    alignedFree(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept {
+    alignedFree(pointer);
+}
+
+#endif
+
+namespace alloc {
+
+    Counts threadCounts() {
+        Counts counts;
+        counts.allocations = threadAllocations;
+        counts.bytes = threadBytes;
+        return counts;
+    }
+
+    Site::Site(const char* name) : name(name) {
+        Site* head = sites.load(std::memory_order_relaxed);
+        do {
+            next = head;
+        } while (!sites.compare_exchange_weak(head, this,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    Scope::~Scope() {
+        Counts end = threadCounts();
+        site.calls.fetch_add(1, std::memory_order_relaxed);
+        site.allocations.fetch_add(end.allocations - start.allocations, std::memory_order_relaxed);
+        site.bytes.fetch_add(end.bytes - start.bytes, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (Site* site = sites.load(std::memory_order_acquire); site; site = site->next) {
+            site->calls.store(0, std::memory_order_relaxed);
+            site->allocations.store(0, std::memory_order_relaxed);
+            site->bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Counts siteCounts(const std::string& name, uint64_t* calls) {
+        Counts counts;
+        if (calls)
+            *calls = 0;
+        for (Site* site = sites.load(std::memory_order_acquire); site; site = site->next) {
+            if (name != site->name)
+                continue;
+            counts.allocations += site->allocations.load(std::memory_order_relaxed);
+            counts.bytes += site->bytes.load(std::memory_order_relaxed);
+            if (calls)
+                *calls += site->calls.load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+    std::string report() {
+        std::string text;
+        if (!isTracking())
+            return "allocation tracking is not built in (DUALSENSITIVE_ALLOC_TRACKING)\n";
+        char line[160];
+        for (Site* site = sites.load(std::memory_order_acquire); site; site = site->next) {
+            uint64_t calls = site->calls.load(std::memory_order_relaxed);
+            uint64_t allocations = site->allocations.load(std::memory_order_relaxed);
+            uint64_t bytes = site->bytes.load(std::memory_order_relaxed);
+            snprintf(line, sizeof(line), "%-28s calls %-10llu allocations %-10llu bytes %-12llu per call %.2f\n",
+                    site->name, static_cast<unsigned long long>(calls),
+                    static_cast<unsigned long long>(allocations),
+                    static_cast<unsigned long long>(bytes),
+                    calls ? static_cast<double>(allocations) / calls : 0.0);
+            text += line;
+        }
+        return text;
+    }
+}
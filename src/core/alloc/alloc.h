@@ -0,0 +1,111 @@
+/*
+    alloc.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Heap allocation accounting. Built with DUALSENSITIVE_ALLOC_TRACKING (the
+// CMake option of the same name), the library replaces the global
+// operator new and counts every allocation, and its bytes, in a counter
+// of the allocating thread. ALLOC_SCOPE() sites then add up what their
+// scope allocated on the calling thread, so steady-state API calls can be
+// checked to stay off the heap. Without the option nothing is replaced
+// and ALLOC_SCOPE() compiles to nothing.
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define ALLOC_CONCAT_INNER(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_INNER(a, b)
+
+// Adds the allocations of the rest of the enclosing scope on the calling
+// thread to the site name. name must be a string literal (only the
+// pointer is stored). Sites nest: an outer site includes its inner ones
+#ifdef DUALSENSITIVE_ALLOC_TRACKING
+#define ALLOC_SCOPE(name)                                               \
+    static alloc::Site ALLOC_CONCAT(allocSite, __LINE__)(name);         \
+    alloc::Scope ALLOC_CONCAT(allocScope, __LINE__)(ALLOC_CONCAT(allocSite, __LINE__))
+#else
+#define ALLOC_SCOPE(name) do {} while (0)
+#endif
+
+namespace alloc {
+
+    struct Counts {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    /**
+     * Returns true if this build counts allocations.
+     */
+    constexpr bool isTracking() {
+#ifdef DUALSENSITIVE_ALLOC_TRACKING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Returns the allocations made by the calling thread since it started;
+     * all zero unless isTracking().
+     */
+    Counts threadCounts();
+
+    /**
+     * One ALLOC_SCOPE() site. Sites register themselves on first use in a
+     * lock-free list that report() walks; they are never unregistered.
+     */
+    class Site {
+    public:
+        explicit Site(const char* name);
+        Site(const Site&) = delete;
+        Site& operator=(const Site&) = delete;
+
+        const char* const name;
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> bytes{0};
+        Site* next = nullptr;
+    };
+
+    /**
+     * Adds the allocations the calling thread makes during its lifetime,
+     * and one call, to a site.
+     */
+    class Scope {
+    public:
+        explicit Scope(Site& site) : site(site), start(threadCounts()) {}
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Site& site;
+        Counts start;
+    };
+
+    /**
+     * Zeroes the counts of every site, e.g. at the end of a warm-up.
+     */
+    void reset();
+
+    /**
+     * Returns the counts of the site with the given name, zero if it has
+     * not been entered yet.
+     * @param calls   (optional) receives the calls of the site
+     */
+    Counts siteCounts(const std::string& name, uint64_t* calls = nullptr);
+
+    /**
+     * Formats the sites as one line each: name, calls, allocations,
+     * allocated bytes and allocations per call.
+     */
+    std::string report();
+}
@@ -0,0 +1,128 @@
+/*
+    lockfree.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Lock-free building blocks shared by the library's hot paths.
+//
+// BoundedQueue is a fixed-capacity multi-producer/multi-consumer queue of
+// copyable items, after Dmitry Vyukov's bounded MPMC queue: every cell
+// carries a sequence number telling producers and consumers whose turn it
+// is, so neither side ever takes a lock or allocates after construction.
+// A single producer finishes push() in a bounded number of steps.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define LOCKFREE_CACHE_LINE_SIZE 64
+
+namespace lockfree {
+
+    template<typename T>
+    class BoundedQueue {
+    public:
+        /**
+         * @param capacity   number of items, rounded up to a power of two
+         */
+        explicit BoundedQueue(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            mask = size - 1;
+            cells.reset(new Cell[size]);
+            for (size_t i = 0; i < size; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            head.store(0, std::memory_order_relaxed);
+            tail.store(0, std::memory_order_relaxed);
+        }
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        /**
+         * Appends an item.
+         * @return false if the queue is full
+         */
+        bool push(const T& item) {
+            size_t position = head.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells[position & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0) {
+                    // the cell is free for this lap; claim it
+                    if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        cell.item = item;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    // still holds an item of the previous lap
+                    return false;
+                } else {
+                    position = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * Takes the oldest item.
+         * @return false if the queue is empty
+         */
+        bool pop(T& item) {
+            size_t position = tail.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells[position & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+                if (difference == 0) {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        item = cell.item;
+                        // free the cell for the producers' next lap
+                        cell.sequence.store(position + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // approximate while other threads push or pop
+        size_t size() const {
+            size_t pushed = head.load(std::memory_order_acquire);
+            size_t popped = tail.load(std::memory_order_acquire);
+            return pushed > popped ? pushed - popped : 0;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+    private:
+        struct alignas(LOCKFREE_CACHE_LINE_SIZE) Cell {
+            std::atomic<size_t> sequence;
+            T item;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        // producers and the consumer each get their own cache line
+        alignas(LOCKFREE_CACHE_LINE_SIZE) std::atomic<size_t> head; // next push
+        alignas(LOCKFREE_CACHE_LINE_SIZE) std::atomic<size_t> tail; // next pop
+    };
+}
@@ -1,13 +1,143 @@
 
-#include "Logger.h"
+#include "logger.h"
+#include <lockfree.h>
 #include <filesystem>
+#include <algorithm>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <streambuf>
+#include <thread>
+
+#define LOG_QUEUE_CAPACITY 4096
+
+namespace {
+
+    struct LogRecord {
+        Logger::Level level;
+        uint16_t length;
+        char text[LOG_LINE_MAX];
+    };
+
+    // stream buffer over a fixed array; whatever does not fit is dropped
+    class LineBuffer : public std::streambuf {
+    public:
+        LineBuffer() { reset(); }
+        void reset() { setp(text, text + LOG_LINE_MAX); }
+        const char* data() const { return pbase(); }
+        size_t size() const { return static_cast<size_t>(pptr() - pbase()); }
+    private:
+        char text[LOG_LINE_MAX];
+    };
+
+    struct LineStream {
+        LineBuffer buffer;
+        std::ostream stream;
+        std::ios_base::fmtflags defaults;
+        LineStream() : stream(&buffer), defaults(stream.flags()) {}
+    };
+
+    // The writer thread is detached and runs until the process exits, so
+    // everything it touches lives on the heap and is never destroyed
+    struct Backend {
+        lockfree::BoundedQueue<LogRecord> records{LOG_QUEUE_CAPACITY};
+        // guards the output, and wakes the writer while it is parked
+        std::mutex mutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable flushedCondition;
+        std::ostream* out = &std::cout;
+        std::unique_ptr<std::ofstream> file;
+        std::once_flag started;
+        std::atomic<bool> parked{false};
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> dropped{0};
+        uint64_t written = 0;       // under mutex
+        uint64_t reportedDrops = 0; // writer only
+    };
+
+    LineStream& lineStream() {
+        static thread_local LineStream line;
+        return line;
+    }
+
+    Backend& backend() {
+        static Backend* instance = new Backend();
+        return *instance;
+    }
+
+    const char* prefix(Logger::Level level) {
+        switch (level) {
+            case Logger::Level::Debug: return "[DEBUG] ";
+            case Logger::Level::Info:  return "[INFO] ";
+            case Logger::Level::Error:
+            default:                   return "[ERROR] ";
+        }
+    }
+
+    void writerLoop(Backend& b) {
+        LogRecord record;
+        std::unique_lock<std::mutex> lock(b.mutex);
+        while (true) {
+            uint64_t batch = 0;
+            while (b.records.pop(record)) {
+                (*b.out) << prefix(record.level);
+                b.out->write(record.text, record.length);
+                b.out->put('\n');
+                batch++;
+            }
+            uint64_t dropped = b.dropped.load(std::memory_order_relaxed);
+            bool dropsNoted = dropped != b.reportedDrops;
+            if (dropsNoted) {
+                (*b.out) << prefix(Logger::Level::Error) << "Log queue full, dropped "
+                    << dropped - b.reportedDrops << " messages\n";
+                b.reportedDrops = dropped;
+            }
+            if (batch || dropsNoted) {
+                b.out->flush();
+                b.written += batch;
+                b.flushedCondition.notify_all();
+                continue;
+            }
+
+            // pairs with the fence in submit(): either the producer sees
+            // us parked or we see its record
+            b.parked = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (b.records.empty())
+                b.wakeCondition.wait(lock);
+            b.parked = false;
+        }
+    }
+
+    void submit(Logger::Level level, const char* text, size_t length) {
+        Backend& b = backend();
+        std::call_once(b.started, [&b]() {
+            std::thread(writerLoop, std::ref(b)).detach();
+        });
+
+        LogRecord record;
+        record.level = level;
+        record.length = static_cast<uint16_t>(std::min<size_t>(length, LOG_LINE_MAX));
+        memcpy(record.text, text, record.length);
+        if (!b.records.push(record)) {
+            b.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        b.accepted.fetch_add(1, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!b.parked.load(std::memory_order_relaxed))
+            return;
+        {
+            std::lock_guard<std::mutex> lock(b.mutex);
+        }
+        b.wakeCondition.notify_one();
+    }
+}
 
 namespace Logger {
 
     static std::atomic_bool debugEnabled = false;
-    static std::ostream* logOut = &std::cout;
-    static std::unique_ptr<std::ofstream> logFile;
-    static std::mutex logMutex;
 
     void init(bool enableDebug) {
         debugEnabled.store(enableDebug);
@@ -18,34 +148,60 @@ namespace Logger {
     }
 
     bool setLogFile(const std::string& filePath) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        logFile = std::make_unique<std::ofstream> ( 
+        Backend& b = backend();
+        std::lock_guard<std::mutex> lock(b.mutex);
+        b.file = std::make_unique<std::ofstream> (
                 filePath,
                 std::ios::out | std::ios::app
         );
-        if (logFile && logFile->is_open()) {
-            logOut = logFile.get();
+        if (b.file && b.file->is_open()) {
+            b.out = b.file.get();
             return true;
         } else {
-            logFile.reset();
-            logOut = &std::cout;
+            b.file.reset();
+            b.out = &std::cout;
             return false;
         }
     }
 
     void debugImpl(const std::string& message) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        (*logOut) << "[DEBUG] " << message << std::endl;
+        submit(Level::Debug, message.data(), message.size());
     }
 
     void infoImpl(const std::string& message) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        (*logOut) << "[INFO] " << message << std::endl;
+        submit(Level::Info, message.data(), message.size());
     }
 
     void errorImpl(const std::string& message) {
-        std::lock_guard<std::mutex> lock(logMutex);
-        (*logOut) << "[ERROR] " << message << std::endl;
+        submit(Level::Error, message.data(), message.size());
+    }
+
+    std::ostream& beginLine() {
+        LineStream& line = lineStream();
+        line.buffer.reset();
+        line.stream.clear();
+        line.stream.flags(line.defaults);
+        line.stream.width(0);
+        line.stream.precision(6);
+        line.stream.fill(' ');
+        return line.stream;
+    }
+
+    void commitLine(Level level) {
+        const LineStream& line = lineStream();
+        submit(level, line.buffer.data(), line.buffer.size());
+    }
+
+    void flush(unsigned timeoutMs) {
+        Backend& b = backend();
+        uint64_t target = b.accepted.load();
+        std::unique_lock<std::mutex> lock(b.mutex);
+        b.flushedCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                [&b, target]() { return b.written >= target; });
+    }
+
+    uint64_t getDropped() {
+        return backend().dropped.load();
     }
 
 }
@@ -8,9 +8,35 @@
 #include <atomic>
 #include <memory>
 #include <mutex>
+#include <chrono>
+#include <cstdint>
 
+// longest message kept; the rest of a longer one is cut off
+#define LOG_LINE_MAX 256
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_NONE 3
+
+// sites below this level are compiled out entirely, arguments included
+// (set through the DUALSENSITIVE_LOG_MIN_LEVEL CMake option)
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Messages are formatted on the calling thread into a per-thread buffer
+// and handed to a lock-free queue; a background thread writes them out in
+// batches with one flush per batch. When the queue is full the message is
+// dropped and counted instead of blocking the caller.
 namespace Logger {
 
+    enum class Level : uint8_t {
+        Debug,
+        Info,
+        Error
+    };
+
     void init(bool enableDebug);
     bool isDebugEnabled();
 
@@ -21,30 +47,92 @@ namespace Logger {
     void infoImpl(const std::string& message);
     void errorImpl(const std::string& message);
 
+    // returns this thread's line stream, emptied; no allocation
+    std::ostream& beginLine();
+    // queues what was written to the line stream since beginLine()
+    void commitLine(Level level);
+
+    // waits until every message queued so far is written, or the timeout
+    void flush(unsigned timeoutMs = 1000);
+
+    // messages dropped because the queue was full
+    uint64_t getDropped();
+
+    // Lets one log site through at most once per interval; the next
+    // message that gets through reports how many were held back
+    class RateLimit {
+    public:
+        explicit RateLimit(unsigned intervalMs) : intervalNs(intervalMs * 1000000LL) {}
+
+        // true if this occurrence may be logged; suppressed receives the
+        // number of occurrences held back since the last one logged
+        bool allow(uint64_t& suppressed) {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t next = nextNs.load(std::memory_order_relaxed);
+            if (now < next || !nextNs.compare_exchange_strong(next, now + intervalNs,
+                        std::memory_order_relaxed)) {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            suppressed = skipped.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+    private:
+        const int64_t intervalNs;
+        std::atomic<int64_t> nextNs{0};
+        std::atomic<uint64_t> skipped{0};
+    };
+
 } // namespace Logger
 
-// Macro stream interface
-#define DEBUG_PRINT(expr)                                      \
+// Macro stream interface; a site below LOG_MIN_LEVEL compiles to nothing,
+// otherwise it only formats if enabled holds
+#define LOG_AT(level, minLevel, enabled, expr)                 \
     do {                                                       \
-        if (Logger::isDebugEnabled()) {                        \
-            std::ostringstream oss__;                          \
-            oss__ << expr;                                     \
-            Logger::debugImpl(oss__.str());                    \
+        if constexpr (LOG_MIN_LEVEL <= minLevel) {             \
+            if (enabled) {                                     \
+                Logger::beginLine() << expr;                   \
+                Logger::commitLine(level);                     \
+            }                                                  \
         }                                                      \
     } while (0)
 
-#define INFO_PRINT(expr)                                       \
+// at most one message per intervalMs from this site
+#define LOG_LIMITED_AT(level, minLevel, enabled, intervalMs, expr) \
     do {                                                       \
-        std::ostringstream oss__;                              \
-        oss__ << expr;                                         \
-        Logger::infoImpl(oss__.str());                         \
+        if constexpr (LOG_MIN_LEVEL <= minLevel) {             \
+            static Logger::RateLimit limit__(intervalMs);      \
+            uint64_t suppressed__ = 0;                         \
+            if ((enabled) && limit__.allow(suppressed__)) {    \
+                std::ostream& line__ = Logger::beginLine();    \
+                line__ << expr;                                \
+                if (suppressed__)                              \
+                    line__ << " (suppressed " << suppressed__  \
+                        << " similar messages)";               \
+                Logger::commitLine(level);                     \
+            }                                                  \
+        }                                                      \
     } while (0)
 
+#define DEBUG_PRINT(expr)                                      \
+    LOG_AT(Logger::Level::Debug, LOG_LEVEL_DEBUG, Logger::isDebugEnabled(), expr)
+
+#define INFO_PRINT(expr)                                       \
+    LOG_AT(Logger::Level::Info, LOG_LEVEL_INFO, true, expr)
+
 #define ERROR_PRINT(expr)                                      \
-    do {                                                       \
-        std::ostringstream oss__;                              \
-        oss__ << expr;                                         \
-        Logger::errorImpl(oss__.str());                        \
-    } while (0)
+    LOG_AT(Logger::Level::Error, LOG_LEVEL_ERROR, true, expr)
+
+#define DEBUG_PRINT_LIMITED(intervalMs, expr)                  \
+    LOG_LIMITED_AT(Logger::Level::Debug, LOG_LEVEL_DEBUG,      \
+            Logger::isDebugEnabled(), intervalMs, expr)
+
+#define INFO_PRINT_LIMITED(intervalMs, expr)                   \
+    LOG_LIMITED_AT(Logger::Level::Info, LOG_LEVEL_INFO, true, intervalMs, expr)
+
+#define ERROR_PRINT_LIMITED(intervalMs, expr)                  \
+    LOG_LIMITED_AT(Logger::Level::Error, LOG_LEVEL_ERROR, true, intervalMs, expr)
 
 #endif // LOGGER_H
@@ -0,0 +1,231 @@
+/*
+    metrics.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Lock-free metrics registry. Counters and histograms live in per-thread
+// shards: a thread claims a shard on its first update and is its only
+// writer, so an update is a relaxed load and store on a cache line no other
+// thread writes. Shards are pushed onto a list that is never shrunk; a
+// thread that exits hands its shard back for reuse, keeping its totals.
+
+#include <metrics.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#define CACHE_LINE_SIZE 64
+
+namespace {
+
+    constexpr int64_t bucketBoundsNs[] = { METRICS_BUCKET_BOUNDS_NS };
+    static_assert(sizeof(bucketBoundsNs) / sizeof(bucketBoundsNs[0]) + 1 == METRICS_BUCKETS,
+            "one bucket per bound plus the overflow bucket");
+
+    constexpr size_t COUNTERS = static_cast<size_t>(metrics::Counter::Count);
+    constexpr size_t HISTOGRAMS = static_cast<size_t>(metrics::Histogram::Count);
+    constexpr size_t GAUGES = static_cast<size_t>(metrics::Gauge::Count);
+
+    struct ShardHistogram {
+        std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sumNs;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic<uint64_t> counters[COUNTERS];
+        ShardHistogram histograms[HISTOGRAMS];
+        std::atomic<bool> inUse;
+        Shard* next;
+    };
+
+    std::atomic<Shard*> shards = nullptr;
+    std::atomic<int64_t> gauges[GAUGES];
+
+    // single writer per shard, so no read-modify-write is needed
+    inline void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    Shard* claimShard() {
+        for (Shard* shard = shards.load(std::memory_order_acquire); shard; shard = shard->next) {
+            bool free = false;
+            if (shard->inUse.compare_exchange_strong(free, true, std::memory_order_acquire))
+                return shard;
+        }
+        // value-initialized, so every atomic starts at zero
+        Shard* shard = new Shard();
+        shard->inUse.store(true, std::memory_order_relaxed);
+        Shard* head = shards.load(std::memory_order_relaxed);
+        do {
+            shard->next = head;
+        } while (!shards.compare_exchange_weak(head, shard,
+                    std::memory_order_release, std::memory_order_relaxed));
+        return shard;
+    }
+
+    struct ShardOwner {
+        Shard* shard = claimShard();
+        ~ShardOwner() { shard->inUse.store(false, std::memory_order_release); }
+    };
+
+    Shard& localShard() {
+        static thread_local ShardOwner owner;
+        return *owner.shard;
+    }
+
+    struct Description {
+        const char* name;
+        const char* help;
+    };
+
+    const Description counterNames[COUNTERS] = {
+        { "dualsensitive_hid_writes_total", "Output reports written to the controller" },
+        { "dualsensitive_hid_write_failures_total", "Output reports that failed to write" },
+        { "dualsensitive_input_reads_total", "Input reports read from the controller" },
+        { "dualsensitive_input_read_failures_total", "Input reports that failed to read" },
+        { "dualsensitive_reconnect_attempts_total", "Attempts to reach a lost controller" },
+        { "dualsensitive_reconnects_total", "Attempts that got the controller back" },
+        { "dualsensitive_udp_in_total", "Datagrams received" },
+        { "dualsensitive_udp_out_total", "Datagrams sent" },
+        { "dualsensitive_udp_dropped_total", "Datagrams not sent (socket errors, loss shim)" },
+        { "dualsensitive_payloads_malformed_total", "Payloads rejected by the service" },
+        { "dualsensitive_shm_in_total", "Shared-memory ring records consumed" },
+        { "dualsensitive_shm_out_total", "Shared-memory ring records published" },
+        { "dualsensitive_shm_fallbacks_total", "Records sent over UDP because the ring was full" },
+        { "dualsensitive_shm_resyncs_total", "Bogus ring heads skipped by the consumer" },
+        { "dualsensitive_input_reports_dropped_total", "Input reports the controller sent that were never read" },
+        { "dualsensitive_payloads_unauthorized_total", "Network datagrams ignored for lack of the token" },
+    };
+
+    const Description histogramNames[HISTOGRAMS] = {
+        { "dualsensitive_hid_write_seconds", "Time to write one output report" },
+        { "dualsensitive_input_read_seconds", "Time to read one input report" },
+        { "dualsensitive_reconnect_seconds", "Time spent reconnecting the controller" },
+        { "dualsensitive_profile_encode_seconds", "Time to encode one trigger profile" },
+        { "dualsensitive_actuation_usb_seconds", "Output write to trigger feedback change (USB)" },
+        { "dualsensitive_actuation_bt_seconds", "Output write to trigger feedback change (Bluetooth)" },
+        { "dualsensitive_input_report_interval_seconds", "Controller sensor time between two input reports read" },
+    };
+
+    const Description gaugeNames[GAUGES] = {
+        { "dualsensitive_send_queue_depth", "CLIENT mode send queue depth" },
+        { "dualsensitive_ring_depth", "Shared-memory ring depth" },
+        { "dualsensitive_scheduled_commands", "Commands waiting for their deadline" },
+        { "dualsensitive_sessions", "Client sessions on the service" },
+        { "dualsensitive_input_report_rate", "Input reports per second the controller sent" },
+        { "dualsensitive_input_report_jitter_microseconds", "Interarrival jitter of the input reports read" },
+    };
+
+    void header(std::string& out, const Description& metric, const char* type) {
+        out += "# HELP ";
+        out += metric.name;
+        out += ' ';
+        out += metric.help;
+        out += "\n# TYPE ";
+        out += metric.name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+}
+
+namespace metrics {
+
+    void add(Counter counter, uint64_t amount) {
+        bump(localShard().counters[static_cast<size_t>(counter)], amount);
+    }
+
+    void observe(Histogram histogram, int64_t durationNs) {
+        if (durationNs < 0)
+            durationNs = 0;
+        size_t bucket = 0;
+        while (bucket < METRICS_BUCKETS - 1 && durationNs > bucketBoundsNs[bucket])
+            bucket++;
+        ShardHistogram& shard = localShard().histograms[static_cast<size_t>(histogram)];
+        bump(shard.buckets[bucket], 1);
+        bump(shard.count, 1);
+        bump(shard.sumNs, static_cast<uint64_t>(durationNs));
+    }
+
+    void set(Gauge gauge, int64_t value) {
+        gauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() {
+        Snapshot result;
+        for (Shard* shard = shards.load(std::memory_order_acquire); shard; shard = shard->next) {
+            for (size_t i = 0; i < COUNTERS; i++)
+                result.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < HISTOGRAMS; i++) {
+                const ShardHistogram& source = shard->histograms[i];
+                HistogramSnapshot& target = result.histograms[i];
+                for (size_t b = 0; b < METRICS_BUCKETS; b++)
+                    target.buckets[b] += source.buckets[b].load(std::memory_order_relaxed);
+                target.count += source.count.load(std::memory_order_relaxed);
+                target.sumNs += source.sumNs.load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < GAUGES; i++)
+            result.gauges[i] = gauges[i].load(std::memory_order_relaxed);
+        return result;
+    }
+
+    std::string exposition(const Snapshot& snapshot) {
+        std::string out;
+        out.reserve(8192);
+        char line[160];
+        for (size_t i = 0; i < COUNTERS; i++) {
+            header(out, counterNames[i], "counter");
+            snprintf(line, sizeof(line), "%s %llu\n", counterNames[i].name,
+                    static_cast<unsigned long long>(snapshot.counters[i]));
+            out += line;
+        }
+        for (size_t i = 0; i < GAUGES; i++) {
+            header(out, gaugeNames[i], "gauge");
+            snprintf(line, sizeof(line), "%s %lld\n", gaugeNames[i].name,
+                    static_cast<long long>(snapshot.gauges[i]));
+            out += line;
+        }
+        for (size_t i = 0; i < HISTOGRAMS; i++) {
+            const HistogramSnapshot& histogram = snapshot.histograms[i];
+            const char* name = histogramNames[i].name;
+            header(out, histogramNames[i], "histogram");
+            // buckets are cumulative in the exposition format
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+                cumulative += histogram.buckets[b];
+                if (b < METRICS_BUCKETS - 1) {
+                    snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name,
+                            bucketBoundsNs[b] / 1e9, static_cast<unsigned long long>(cumulative));
+                } else {
+                    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                            static_cast<unsigned long long>(cumulative));
+                }
+                out += line;
+            }
+            snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %llu\n", name,
+                    histogram.sumNs / 1e9, name,
+                    static_cast<unsigned long long>(histogram.count));
+            out += line;
+        }
+        return out;
+    }
+
+    ScopedTimer::ScopedTimer(Histogram histogram)
+        : histogram(histogram), startNs(nowNs()) {}
+
+    ScopedTimer::~ScopedTimer() {
+        observe(histogram, nowNs() - startNs);
+    }
+
+    int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
@@ -0,0 +1,121 @@
+/*
+    metrics.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+
+// upper bounds of the latency histogram buckets in nanoseconds, 100 ns to
+// 1 s; a last bucket takes everything above
+#define METRICS_BUCKET_BOUNDS_NS \
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, \
+    500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000, \
+    100000000, 250000000, 1000000000
+#define METRICS_BUCKETS 22
+
+namespace metrics {
+
+    enum class Counter : uint8_t {
+        HidWrites,          // output reports written
+        HidWriteFailures,
+        InputReads,         // input reports read
+        InputReadFailures,
+        ReconnectAttempts,
+        Reconnects,         // attempts that got a controller back
+        UdpIn,              // datagrams received
+        UdpOut,             // datagrams sent
+        UdpDropped,         // datagrams not sent: socket errors and loss shim
+        PayloadsMalformed,  // payloads rejected by the service, any transport
+        ShmIn,              // ring records consumed
+        ShmOut,             // ring records published
+        ShmFallbacks,       // records sent over UDP as the ring was full
+        ShmResyncs,         // times the consumer found a bogus ring head
+        InputReportsDropped, // reports the controller sent that were never read
+        PayloadsUnauthorized, // network mode datagrams from peers without the token
+        Count
+    };
+
+    enum class Histogram : uint8_t {
+        HidWrite,           // setDeviceOutputState() calls
+        InputRead,          // getDeviceInputState() calls
+        Reconnect,          // from noticing the disconnect to giving up or succeeding
+        ProfileEncode,      // one trigger profile into the output report
+        ActuationUsb,       // output write to trigger feedback change, USB
+        ActuationBt,        // same over Bluetooth
+        InputReportInterval, // controller sensor time between two reports read
+        Count
+    };
+
+    enum class Gauge : uint8_t {
+        SendQueueDepth,     // CLIENT mode send queue, at the last enqueue
+        RingDepth,          // shared-memory ring, at the last consumer wakeup
+        ScheduledCommands,  // commands waiting in the timer wheel
+        Sessions,           // client sessions on the service
+        InputReportRate,    // reports per second the controller sent, over ~1 s
+        InputReportJitter,  // interarrival jitter of the reports read, microseconds
+        Count
+    };
+
+    struct HistogramSnapshot {
+        uint64_t buckets[METRICS_BUCKETS] = {};
+        uint64_t count = 0;
+        uint64_t sumNs = 0;
+    };
+
+    struct Snapshot {
+        uint64_t counters[static_cast<size_t>(Counter::Count)] = {};
+        HistogramSnapshot histograms[static_cast<size_t>(Histogram::Count)];
+        int64_t gauges[static_cast<size_t>(Gauge::Count)] = {};
+    };
+
+    /**
+     * Adds to a counter. Lock-free: every thread updates its own shard,
+     * which snapshot() sums up.
+     */
+    void add(Counter counter, uint64_t amount = 1);
+
+    /**
+     * Records one duration in a latency histogram (per-thread, like add()).
+     */
+    void observe(Histogram histogram, int64_t durationNs);
+
+    /**
+     * Sets a gauge; the last value set wins.
+     */
+    void set(Gauge gauge, int64_t value);
+
+    /**
+     * Sums the shards of all threads, past and present, into one snapshot.
+     * Each value is read atomically; the snapshot as a whole is not.
+     */
+    Snapshot snapshot();
+
+    /**
+     * Formats a snapshot in the Prometheus text exposition format.
+     */
+    std::string exposition(const Snapshot& snapshot);
+
+    /**
+     * Records the lifetime of the scope in a histogram.
+     */
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Histogram histogram);
+        ~ScopedTimer();
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+    private:
+        Histogram histogram;
+        int64_t startNs;
+    };
+
+    // monotonic nanoseconds, same clock as dualsensitive::clockNs()
+    int64_t nowNs();
+}
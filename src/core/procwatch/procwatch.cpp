@@ -0,0 +1,117 @@
+/*
+    procwatch.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Client liveness tracking for the service. Each watched process handle is
+// registered with RegisterWaitForSingleObject, so an exit is reported within
+// a thread pool dispatch and an idle service makes no wakeups at all.
+
+#include <procwatch.h>
+#include <Windows.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+    struct Watch {
+        uint32_t pid;
+        HANDLE process;
+        HANDLE wait;
+        procwatch::ExitFunc onExit;
+    };
+
+    // whoever removes a watch from this list owns it and releases it
+    std::mutex watchMutex;
+    std::vector<Watch*> watches;
+
+    bool take(Watch* watch) {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        auto it = std::find(watches.begin(), watches.end(), watch);
+        if (it == watches.end())
+            return false;
+        watches.erase(it);
+        return true;
+    }
+
+    VOID CALLBACK onProcessSignaled(PVOID context, BOOLEAN) {
+        Watch* watch = static_cast<Watch*>(context);
+        // unwatch() got here first; it waits for this callback to return
+        if (!take(watch))
+            return;
+        // non-blocking unregister, the only kind allowed in the callback
+        UnregisterWaitEx(watch->wait, NULL);
+        CloseHandle(watch->process);
+        watch->onExit(watch->pid);
+        delete watch;
+    }
+
+    // waits for a running callback, then releases the watch
+    void release(Watch* watch) {
+        UnregisterWaitEx(watch->wait, INVALID_HANDLE_VALUE);
+        CloseHandle(watch->process);
+        delete watch;
+    }
+}
+
+namespace procwatch {
+
+    Status watch(uint32_t pid, ExitFunc onExit) {
+        if (!onExit) {
+            return Status::CallbackNotProvided;
+        }
+
+        std::lock_guard<std::mutex> lock(watchMutex);
+        for (const Watch* existing : watches) {
+            if (existing->pid == pid)
+                return Status::Success;
+        }
+
+        HANDLE handle = OpenProcess(SYNCHRONIZE, FALSE, pid);
+        if (!handle) {
+            return Status::ProcessNotFound;
+        }
+
+        Watch* entry = new Watch { pid, handle, NULL, onExit };
+        // the callback cannot run before the entry is listed: it needs
+        // watchMutex, which is held until this function returns
+        if (!RegisterWaitForSingleObject(&entry->wait, handle, onProcessSignaled,
+                entry, INFINITE, WT_EXECUTEONLYONCE)) {
+            CloseHandle(handle);
+            delete entry;
+            return Status::WaitFailed;
+        }
+        watches.push_back(entry);
+        return Status::Success;
+    }
+
+    void unwatch(uint32_t pid) {
+        Watch* removed = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            auto it = std::find_if(watches.begin(), watches.end(),
+                    [pid](const Watch* watch) { return watch->pid == pid; });
+            if (it == watches.end())
+                return;
+            removed = *it;
+            watches.erase(it);
+        }
+        release(removed);
+    }
+
+    void unwatchAll() {
+        std::vector<Watch*> removed;
+        {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            removed.swap(watches);
+        }
+        for (Watch* watch : removed)
+            release(watch);
+    }
+}
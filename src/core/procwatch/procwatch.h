@@ -0,0 +1,50 @@
+/*
+    procwatch.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#pragma once
+#include <cstdint>
+
+namespace procwatch {
+
+    enum class Status {
+        Success,
+        ProcessNotFound,
+        WaitFailed,
+        CallbackNotProvided
+    };
+
+    using ExitFunc = void(*)(uint32_t pid);
+
+    /**
+     * Calls onExit once the given process exits. Nothing polls: the wait is
+     * registered with the system thread pool, which runs onExit on one of
+     * its threads when the process handle is signaled.
+     * Watching an already watched process has no effect.
+     *
+     * @param pid    The process to watch.
+     * @param onExit Called with the PID after the process has exited.
+     * @return Status::Success if the process is being watched.
+     *         Status::ProcessNotFound if the process does not exist (anymore).
+     *         Status::WaitFailed if the wait could not be registered.
+     *         Status::CallbackNotProvided if no callback function was supplied.
+     */
+    Status watch(uint32_t pid, ExitFunc onExit);
+
+    /**
+     * Stops watching the given process. Returns once a running exit
+     * callback for it has finished.
+     */
+    void unwatch(uint32_t pid);
+
+    /**
+     * Stops watching all processes.
+     */
+    void unwatchAll();
+}
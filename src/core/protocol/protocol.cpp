@@ -0,0 +1,470 @@
+/*
+    protocol.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    05.2025 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#include <protocol.h>
+#include <logger.h>
+#include <trace.h>
+#include <algorithm>
+
+// little-endian helpers
+
+static void putU32(std::vector<uint8_t>& buffer, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        buffer.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static void putU64(std::vector<uint8_t>& buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        buffer.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static void putU16(uint8_t* data, uint16_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+}
+
+static uint16_t getU16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t* data) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= static_cast<uint32_t>(data[i]) << (8 * i);
+    return value;
+}
+
+static uint64_t getU64(const uint8_t* data) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return value;
+}
+
+// appends trigger, profile, extras size and extras
+static void putTriggerRecord(std::vector<uint8_t>& buffer, Trigger trigger,
+                        TriggerProfile profile, const std::vector<uint8_t>& extras) {
+    buffer.push_back(static_cast<uint8_t>(trigger));                // 1 byte
+    buffer.push_back(static_cast<int8_t>(profile));                 // 1 byte
+    buffer.push_back(static_cast<uint8_t>(extras.size()));          // 1 byte
+    buffer.insert(buffer.end(), extras.begin(), extras.end());      // extras
+}
+
+// parses one trigger record; returns the bytes consumed or 0 if malformed
+static size_t getTriggerRecord(const uint8_t* data, size_t size, TriggerCommand& command) {
+    if (size < MIN_PAYLOAD_SIZE) {
+        ERROR_PRINT("buffer size less than expected!");
+        return 0;
+    }
+    command.trigger = static_cast<Trigger>(data[TRIGGER_INDEX]);
+    command.profile = static_cast<TriggerProfile>(static_cast<int8_t>(data[PROFILE_INDEX]));
+    uint8_t extrasSize = data[EXTRAS_SIZE_INDEX];
+
+    if (size < static_cast<size_t>(EXTRAS_BUFFER_INDEX + extrasSize)) {
+        ERROR_PRINT("extras found corrupted!");
+        return 0;
+    }
+
+    command.extras.assign(data + EXTRAS_BUFFER_INDEX, data + EXTRAS_BUFFER_INDEX + extrasSize);
+    return EXTRAS_BUFFER_INDEX + extrasSize;
+}
+
+std::vector<uint8_t> serializeBindPayload(uint32_t pid, uint8_t priority) {
+    std::vector<uint8_t> buffer;
+    buffer.push_back(static_cast<uint8_t>(PayloadType::BIND));  // 1 byte
+    buffer.push_back((pid >>  0) & 0xFF);
+    buffer.push_back((pid >>  8) & 0xFF);
+    buffer.push_back((pid >> 16) & 0xFF);
+    buffer.push_back((pid >> 24) & 0xFF);
+    buffer.push_back(priority);                                 // 1 byte
+    return buffer;
+}
+
+bool deserializeBindPayload(const std::vector<uint8_t>& buffer, uint32_t& pid, uint8_t& priority) {
+
+    if (buffer.size() < PID_SIZE) {
+        ERROR_PRINT("Bind PID payload too small!");
+        return false;
+    }
+    pid = (buffer[0]) | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24);
+    priority = buffer.size() > PID_SIZE ? buffer[PID_SIZE] : 0;
+    INFO_PRINT("Bound to client PID: " << pid << " (priority " << static_cast<int>(priority) << ")");
+    return true;
+}
+
+std::vector<uint8_t> serializeTriggerPayload(Trigger trigger, TriggerProfile profile, const std::vector<uint8_t>& extras) {
+    std::vector<uint8_t> buffer;
+    buffer.push_back(static_cast<uint8_t>(PayloadType::TRIGGER));   // 1 byte
+    putTriggerRecord(buffer, trigger, profile, extras);
+    return buffer;
+}
+
+bool deserializeTriggerPayload(const std::vector<uint8_t>& buffer, Trigger& trigger, TriggerProfile& profile, std::vector<uint8_t>& extras) {
+    TRACE_SPAN("deserializeTriggerPayload");
+    TriggerCommand command;
+    if (!getTriggerRecord(buffer.data(), buffer.size(), command))
+        return false;
+    trigger = command.trigger;
+    profile = command.profile;
+    extras = std::move(command.extras);
+    return true;
+}
+
+bool deserializeTriggerPayload(const uint8_t* data, size_t size, TriggerCommand& command) {
+    TRACE_SPAN("deserializeTriggerPayload");
+    return getTriggerRecord(data, size, command) != 0;
+}
+
+std::vector<uint8_t> serializeCommandPayload(uint8_t flags, uint32_t sequence,
+                                const TriggerCommand* commands, size_t count,
+                                int64_t applyAtNs) {
+    std::vector<uint8_t> buffer;
+    buffer.push_back(static_cast<uint8_t>(PayloadType::COMMAND));   // 1 byte
+    buffer.push_back(flags);                                        // 1 byte
+    putU32(buffer, sequence);                                       // 4 bytes
+    buffer.push_back(static_cast<uint8_t>(count));                  // 1 byte
+    if (flags & COMMAND_APPLY_AT)
+        putU64(buffer, static_cast<uint64_t>(applyAtNs));           // 8 bytes
+    for (size_t i = 0; i < count; i++) {
+        putTriggerRecord(buffer, commands[i].trigger, commands[i].profile, commands[i].extras);
+    }
+    return buffer;
+}
+
+bool deserializeCommandPayload(const std::vector<uint8_t>& buffer, uint8_t& flags,
+                                uint32_t& sequence, std::vector<TriggerCommand>& commands,
+                                int64_t& applyAtNs) {
+    TRACE_SPAN("deserializeCommandPayload");
+    if (buffer.size() < COMMAND_HEADER_SIZE) {
+        ERROR_PRINT("Command payload too small!");
+        return false;
+    }
+    flags = buffer[1];
+    sequence = getU32(&buffer[2]);
+    uint8_t count = buffer[6];
+
+    size_t offset = COMMAND_HEADER_SIZE;
+    applyAtNs = 0;
+    if (flags & COMMAND_APPLY_AT) {
+        if (buffer.size() < COMMAND_HEADER_SIZE + APPLY_AT_SIZE) {
+            ERROR_PRINT("Command deadline missing!");
+            return false;
+        }
+        applyAtNs = static_cast<int64_t>(getU64(&buffer[offset]));
+        offset += APPLY_AT_SIZE;
+    }
+
+    commands.resize(count);
+    for (uint8_t i = 0; i < count; i++) {
+        size_t consumed = getTriggerRecord(&buffer[0] + offset, buffer.size() - offset, commands[i]);
+        if (!consumed) {
+            commands.clear();
+            return false;
+        }
+        // the service could not stage it, so it must not be acknowledged
+        // as applied
+        if (commands[i].trigger != Trigger::Left && commands[i].trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type in command!");
+            commands.clear();
+            return false;
+        }
+        offset += consumed;
+    }
+    return true;
+}
+
+std::vector<uint8_t> serializeAckPayload(const AckPayload& ack) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(ACK_PAYLOAD_SIZE);
+    buffer.push_back(static_cast<uint8_t>(PayloadType::ACK));       // 1 byte
+    putU32(buffer, ack.sequence);                                   // 4 bytes
+    buffer.push_back(static_cast<uint8_t>(ack.result));             // 1 byte
+    putU64(buffer, static_cast<uint64_t>(ack.receivedNs));          // 8 bytes
+    putU64(buffer, static_cast<uint64_t>(ack.appliedNs));           // 8 bytes
+    return buffer;
+}
+
+bool deserializeAckPayload(const std::vector<uint8_t>& buffer, AckPayload& ack) {
+    if (buffer.size() < ACK_PAYLOAD_SIZE) {
+        ERROR_PRINT("Ack payload too small!");
+        return false;
+    }
+    ack.sequence = getU32(&buffer[1]);
+    ack.result = static_cast<dualsensitive::ApplyResult>(buffer[5]);
+    ack.receivedNs = static_cast<int64_t>(getU64(&buffer[6]));
+    ack.appliedNs = static_cast<int64_t>(getU64(&buffer[14]));
+    return true;
+}
+
+std::vector<uint8_t> serializeTimeSyncPayload(const TimeSyncPayload& sync) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(TIME_SYNC_PAYLOAD_SIZE);
+    buffer.push_back(static_cast<uint8_t>(PayloadType::TIME_SYNC)); // 1 byte
+    putU32(buffer, sync.id);                                        // 4 bytes
+    putU64(buffer, static_cast<uint64_t>(sync.clientSendNs));       // 8 bytes
+    putU64(buffer, static_cast<uint64_t>(sync.serviceReceiveNs));   // 8 bytes
+    putU64(buffer, static_cast<uint64_t>(sync.serviceSendNs));      // 8 bytes
+    return buffer;
+}
+
+bool deserializeTimeSyncPayload(const std::vector<uint8_t>& buffer, TimeSyncPayload& sync) {
+    if (buffer.size() < TIME_SYNC_PAYLOAD_SIZE) {
+        ERROR_PRINT("Time sync payload too small!");
+        return false;
+    }
+    sync.id = getU32(&buffer[1]);
+    sync.clientSendNs = static_cast<int64_t>(getU64(&buffer[5]));
+    sync.serviceReceiveNs = static_cast<int64_t>(getU64(&buffer[13]));
+    sync.serviceSendNs = static_cast<int64_t>(getU64(&buffer[21]));
+    return true;
+}
+
+std::vector<uint8_t> serializeHelloPayload(uint32_t nonce, const std::string* token) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(HELLO_PAYLOAD_SIZE + 1 + HELLO_TOKEN_MAX);
+    buffer.push_back(static_cast<uint8_t>(PayloadType::HELLO));     // 1 byte
+    putU32(buffer, nonce);                                          // 4 bytes
+    if (token) {
+        size_t size = std::min<size_t>(token->size(), HELLO_TOKEN_MAX);
+        buffer.push_back(static_cast<uint8_t>(size));               // 1 byte
+        buffer.insert(buffer.end(), token->begin(), token->begin() + size);
+    }
+    return buffer;
+}
+
+bool deserializeHelloPayload(const std::vector<uint8_t>& buffer, uint32_t& nonce) {
+    if (buffer.size() < HELLO_PAYLOAD_SIZE) {
+        ERROR_PRINT("Hello payload too small!");
+        return false;
+    }
+    nonce = getU32(&buffer[1]);
+    return true;
+}
+
+bool deserializeHelloToken(const std::vector<uint8_t>& buffer, std::string& token) {
+    if (buffer.size() <= HELLO_PAYLOAD_SIZE)
+        return false;
+    size_t size = buffer[HELLO_PAYLOAD_SIZE];
+    if (size > HELLO_TOKEN_MAX || buffer.size() != HELLO_PAYLOAD_SIZE + 1 + size) {
+        ERROR_PRINT("Hello token malformed!");
+        return false;
+    }
+    token.assign(buffer.begin() + HELLO_PAYLOAD_SIZE + 1, buffer.end());
+    return true;
+}
+
+std::vector<uint8_t> serializeReadyPayload(const ReadyPayload& ready) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(READY_PAYLOAD_SIZE);
+    buffer.push_back(static_cast<uint8_t>(PayloadType::READY));     // 1 byte
+    putU32(buffer, ready.nonce);                                    // 4 bytes
+    buffer.push_back(ready.flags);                                  // 1 byte
+    buffer.push_back(static_cast<uint8_t>(ready.connection));       // 1 byte
+    return buffer;
+}
+
+bool deserializeReadyPayload(const std::vector<uint8_t>& buffer, ReadyPayload& ready) {
+    if (buffer.size() < READY_PAYLOAD_SIZE) {
+        ERROR_PRINT("Ready payload too small!");
+        return false;
+    }
+    if (buffer[6] > static_cast<uint8_t>(dualsensitive::ControllerConnection::Bluetooth)) {
+        ERROR_PRINT("Unknown controller connection: " << static_cast<int>(buffer[6]));
+        return false;
+    }
+    ready.nonce = getU32(&buffer[1]);
+    ready.flags = buffer[5];
+    ready.connection = static_cast<dualsensitive::ControllerConnection>(buffer[6]);
+    return true;
+}
+
+std::vector<uint8_t> serializeStatsPayload(uint32_t id, const std::string& text) {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(STATS_HEADER_SIZE + text.size());
+    buffer.push_back(static_cast<uint8_t>(PayloadType::STATS));     // 1 byte
+    putU32(buffer, id);                                             // 4 bytes
+    buffer.insert(buffer.end(), text.begin(), text.end());          // text
+    return buffer;
+}
+
+bool deserializeStatsPayload(const std::vector<uint8_t>& buffer, uint32_t& id, std::string& text) {
+    if (buffer.size() < STATS_HEADER_SIZE) {
+        ERROR_PRINT("Stats payload too small!");
+        return false;
+    }
+    id = getU32(&buffer[1]);
+    text.assign(buffer.begin() + STATS_HEADER_SIZE, buffer.end());
+    return true;
+}
+
+std::vector<uint8_t> serializeSubscribePayload(uint16_t rateHz, uint8_t flags,
+                                uint8_t repeats) {
+    bool extended = flags || repeats;
+    std::vector<uint8_t> buffer(extended ? SUBSCRIBE_EXTENDED_SIZE : SUBSCRIBE_PAYLOAD_SIZE);
+    buffer[0] = static_cast<uint8_t>(PayloadType::SUBSCRIBE);        // 1 byte
+    putU16(&buffer[1], rateHz);                                     // 2 bytes
+    if (extended) {
+        buffer[3] = flags;                                          // 1 byte
+        buffer[4] = repeats;                                        // 1 byte
+    }
+    return buffer;
+}
+
+bool deserializeSubscribePayload(const std::vector<uint8_t>& buffer, uint16_t& rateHz,
+                                uint8_t& flags, uint8_t& repeats) {
+    if (buffer.size() < SUBSCRIBE_PAYLOAD_SIZE) {
+        ERROR_PRINT("Subscribe payload too small!");
+        return false;
+    }
+    rateHz = getU16(&buffer[1]);
+    flags = 0;
+    repeats = 0;
+    if (buffer.size() >= SUBSCRIBE_EXTENDED_SIZE) {
+        flags = buffer[3];
+        repeats = buffer[4];
+    }
+    return true;
+}
+
+// packed layout:
+//  0-3   left stick x/y, right stick x/y
+//  4-5   left/right trigger position
+//  6-8   buttonsAndDpad, buttonsA, buttonsB
+//  9-14  accelerometer x/y/z (int16)
+//  15-20 gyroscope x/y/z (int16)
+//  21-25 touch point 1: x, y (uint16), down << 7 | id
+//  26-30 touch point 2
+//  31    battery level
+//  32    charging | fully charged << 1 | headphone << 2
+//  33-34 left/right trigger feedback
+
+static void packTouch(const DS5W::Touch& touch, uint8_t* packed) {
+    putU16(packed, static_cast<uint16_t>(touch.x));
+    putU16(packed + 2, static_cast<uint16_t>(touch.y));
+    packed[4] = (touch.down ? 0x80 : 0x00) | (touch.id & 0x7F);
+}
+
+static void unpackTouch(const uint8_t* packed, DS5W::Touch& touch) {
+    touch.x = getU16(packed);
+    touch.y = getU16(packed + 2);
+    touch.down = packed[4] & 0x80;
+    touch.id = packed[4] & 0x7F;
+}
+
+static void packVector(const DS5W::Vector3& vector, uint8_t* packed) {
+    putU16(packed, static_cast<uint16_t>(vector.x));
+    putU16(packed + 2, static_cast<uint16_t>(vector.y));
+    putU16(packed + 4, static_cast<uint16_t>(vector.z));
+}
+
+static void unpackVector(const uint8_t* packed, DS5W::Vector3& vector) {
+    vector.x = static_cast<short>(getU16(packed));
+    vector.y = static_cast<short>(getU16(packed + 2));
+    vector.z = static_cast<short>(getU16(packed + 4));
+}
+
+void packInputState(const DS5W::DS5InputState& state, uint8_t* packed) {
+    packed[0] = static_cast<uint8_t>(state.leftStick.x);
+    packed[1] = static_cast<uint8_t>(state.leftStick.y);
+    packed[2] = static_cast<uint8_t>(state.rightStick.x);
+    packed[3] = static_cast<uint8_t>(state.rightStick.y);
+    packed[4] = state.leftTrigger;
+    packed[5] = state.rightTrigger;
+    packed[6] = state.buttonsAndDpad;
+    packed[7] = state.buttonsA;
+    packed[8] = state.buttonsB;
+    packVector(state.accelerometer, packed + 9);
+    packVector(state.gyroscope, packed + 15);
+    packTouch(state.touchPoint1, packed + 21);
+    packTouch(state.touchPoint2, packed + 26);
+    packed[31] = state.battery.level;
+    packed[32] = (state.battery.chargin ? 0x01 : 0x00)
+        | (state.battery.fullyCharged ? 0x02 : 0x00)
+        | (state.headPhoneConnected ? 0x04 : 0x00);
+    packed[33] = state.leftTriggerFeedback;
+    packed[34] = state.rightTriggerFeedback;
+}
+
+void unpackInputState(const uint8_t* packed, DS5W::DS5InputState& state) {
+    state.leftStick.x = static_cast<char>(packed[0]);
+    state.leftStick.y = static_cast<char>(packed[1]);
+    state.rightStick.x = static_cast<char>(packed[2]);
+    state.rightStick.y = static_cast<char>(packed[3]);
+    state.leftTrigger = packed[4];
+    state.rightTrigger = packed[5];
+    state.buttonsAndDpad = packed[6];
+    state.buttonsA = packed[7];
+    state.buttonsB = packed[8];
+    unpackVector(packed + 9, state.accelerometer);
+    unpackVector(packed + 15, state.gyroscope);
+    unpackTouch(packed + 21, state.touchPoint1);
+    unpackTouch(packed + 26, state.touchPoint2);
+    state.battery.level = packed[31];
+    state.battery.chargin = packed[32] & 0x01;
+    state.battery.fullyCharged = packed[32] & 0x02;
+    state.headPhoneConnected = packed[32] & 0x04;
+    state.leftTriggerFeedback = packed[33];
+    state.rightTriggerFeedback = packed[34];
+}
+
+std::vector<uint8_t> serializeInputPayload(uint32_t sequence, const uint8_t* packed,
+                                const uint8_t* previous, int64_t timestampNs) {
+    std::vector<uint8_t> buffer(INPUT_HEADER_SIZE);
+    buffer.reserve(INPUT_HEADER_SIZE + INPUT_TIMESTAMP_SIZE + PACKED_INPUT_SIZE);
+    buffer[0] = static_cast<uint8_t>(PayloadType::INPUT);            // 1 byte
+    for (int i = 0; i < 4; i++)                                     // 4 bytes
+        buffer[1 + i] = (sequence >> (8 * i)) & 0xFF;
+    buffer[5] = (previous ? 0 : INPUT_KEYFRAME)                     // 1 byte
+        | (timestampNs ? INPUT_TIMESTAMPED : 0);
+    if (timestampNs)
+        putU64(buffer, static_cast<uint64_t>(timestampNs));         // 8 bytes
+    for (int i = 0; i < PACKED_INPUT_SIZE; i++) {                   // 5 bytes mask
+        if (previous && previous[i] == packed[i])
+            continue;
+        buffer[6 + i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+        buffer.push_back(packed[i]);                                // changed bytes
+    }
+    return buffer;
+}
+
+bool deserializeInputPayload(const std::vector<uint8_t>& buffer, uint32_t& sequence,
+                                uint8_t& flags, uint8_t* packed,
+                                int64_t* timestampNs) {
+    if (buffer.size() < INPUT_HEADER_SIZE) {
+        ERROR_PRINT("Input payload too small!");
+        return false;
+    }
+    sequence = getU32(&buffer[1]);
+    flags = buffer[5];
+    const uint8_t* mask = &buffer[6];
+
+    size_t offset = INPUT_HEADER_SIZE;
+    int64_t timestamp = 0;
+    if (flags & INPUT_TIMESTAMPED) {
+        if (buffer.size() < INPUT_HEADER_SIZE + INPUT_TIMESTAMP_SIZE) {
+            ERROR_PRINT("Input timestamp missing!");
+            return false;
+        }
+        timestamp = static_cast<int64_t>(getU64(&buffer[offset]));
+        offset += INPUT_TIMESTAMP_SIZE;
+    }
+    if (timestampNs)
+        *timestampNs = timestamp;
+    for (int i = 0; i < PACKED_INPUT_SIZE; i++) {
+        if (!(mask[i / 8] & (1 << (i % 8))))
+            continue;
+        if (offset >= buffer.size()) {
+            ERROR_PRINT("Input payload truncated!");
+            return false;
+        }
+        packed[i] = buffer[offset++];
+    }
+    return true;
+}
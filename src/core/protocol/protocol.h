@@ -0,0 +1,234 @@
+/*
+    protocol.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    05.2025 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Wire format of the payloads exchanged between CLIENT and SERVER mode.
+// Every payload starts with one PayloadType byte; multi-byte integers are
+// little endian.
+
+#pragma once
+#include <dualsensitive.h>
+#include <DS5State.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#define TRIGGER_INDEX 0
+#define PROFILE_INDEX 1
+#define EXTRAS_SIZE_INDEX 2
+#define MIN_PAYLOAD_SIZE 3
+#define PAYLOAD_TYPE_SIZE 1
+#define PID_SIZE 4
+#define EXTRAS_BUFFER_INDEX 3
+
+// COMMAND: type, flags, sequence (4), count, [applyAt (8) if
+// COMMAND_APPLY_AT], then count trigger records
+#define COMMAND_HEADER_SIZE 7
+#define APPLY_AT_SIZE 8
+// ACK: type, sequence (4), result, received (8), applied (8)
+#define ACK_PAYLOAD_SIZE 22
+// SUBSCRIBE: type, rate in Hz (2), 0 to unsubscribe, then optionally
+// SubscribeFlags and the number of repeats of each snapshot
+#define SUBSCRIBE_PAYLOAD_SIZE 3
+#define SUBSCRIBE_EXTENDED_SIZE 5
+// TIME_SYNC: type, id (4), client send (8), service receive (8),
+// service send (8); the service fills in the last two
+#define TIME_SYNC_PAYLOAD_SIZE 29
+// HELLO: type, nonce (4), then in network mode the token length and the
+// token, which older services ignore
+#define HELLO_PAYLOAD_SIZE 5
+#define HELLO_TOKEN_MAX 64
+// READY: type, nonce (4), ReadyFlags, ControllerConnection
+#define READY_PAYLOAD_SIZE 7
+// STATS: type, id (4), then the metrics text (empty in the request)
+#define STATS_HEADER_SIZE 5
+
+// DS5InputState packed into a fixed little-endian byte layout
+#define PACKED_INPUT_SIZE 35
+// INPUT: type, sequence (4), flags, one bit per packed byte (5),
+// [service timestamp (8) if INPUT_TIMESTAMPED], then the packed bytes
+// whose bit is set
+#define INPUT_MASK_SIZE 5
+#define INPUT_HEADER_SIZE 11
+#define INPUT_TIMESTAMP_SIZE 8
+
+enum class Trigger : uint8_t {
+    Left = 0,
+    Right = 1
+};
+
+/**
+ * Flags of a COMMAND payload
+ *  - COMMAND_ACK_REQUESTED: the service replies with an ACK payload once the
+ *    command has been written to the controller (UDP only)
+ *  - COMMAND_APPLY_AT: the command carries a deadline on the service's
+ *    clock and is held back until then
+ *  - COMMAND_FULL_STATE: the command carries the client's whole trigger
+ *    state (network mode)
+ * Commands without COMMAND_APPLY_AT are ignored unless their sequence is
+ * newer than the last one applied from that client, so copies, reordered
+ * packets and records overtaken on the other transport are harmless.
+ */
+enum CommandFlags : uint8_t {
+    COMMAND_ACK_REQUESTED = 0x01,
+    COMMAND_APPLY_AT = 0x02,
+    COMMAND_FULL_STATE = 0x04
+};
+
+/**
+ * Flags of a SUBSCRIBE payload
+ *  - SUBSCRIBE_FULL_STATE: every INPUT is a timestamped keyframe, and each
+ *    new snapshot is repeated on the following ticks (network mode)
+ */
+enum SubscribeFlags : uint8_t {
+    SUBSCRIBE_FULL_STATE = 0x01
+};
+
+/**
+ * Service state flags of a READY payload
+ *  - READY_COMMANDS: the service takes COMMAND payloads; until a client
+ *    has seen it, it sends TRIGGER payloads, which every service takes
+ */
+enum ReadyFlags : uint8_t {
+    READY_CONTROLLER_CONNECTED = 0x01,
+    READY_ENABLED = 0x02,
+    READY_SHARED_MEMORY = 0x04,
+    READY_COMMANDS = 0x08
+};
+
+/**
+ * Flags of an INPUT payload
+ *  - INPUT_KEYFRAME: carries every packed byte; the receiver can start (or
+ *    resync after a lost update) from it
+ *  - INPUT_TIMESTAMPED: carries the service's time of the read
+ */
+enum InputFlags : uint8_t {
+    INPUT_KEYFRAME = 0x01,
+    INPUT_TIMESTAMPED = 0x02
+};
+
+/**
+ * One trigger assignment, as carried by TRIGGER and COMMAND payloads
+ */
+struct TriggerCommand {
+    Trigger trigger;
+    TriggerProfile profile;
+    std::vector<uint8_t> extras;
+};
+
+/**
+ * Contents of a TIME_SYNC payload, NTP style: with t3 the client's receive
+ * time, offset = ((t1 - t0) + (t2 - t3)) / 2 and
+ * delay = (t3 - t0) - (t2 - t1)
+ */
+struct TimeSyncPayload {
+    uint32_t id;
+    int64_t clientSendNs;       // t0
+    int64_t serviceReceiveNs;   // t1
+    int64_t serviceSendNs;      // t2
+};
+
+/**
+ * Contents of a READY payload; nonce echoes the HELLO it answers
+ */
+struct ReadyPayload {
+    uint32_t nonce;
+    uint8_t flags;
+    dualsensitive::ControllerConnection connection;
+};
+
+/**
+ * Contents of an ACK payload. Timestamps are the service's monotonic clock
+ * in nanoseconds.
+ */
+struct AckPayload {
+    uint32_t sequence;
+    dualsensitive::ApplyResult result;
+    int64_t receivedNs;
+    int64_t appliedNs;
+};
+
+// BIND: type, pid (4), priority (optional, older clients omit it)
+std::vector<uint8_t> serializeBindPayload(uint32_t pid, uint8_t priority);
+
+// buffer starts after the payload type byte; priority is 0 if absent
+bool deserializeBindPayload(const std::vector<uint8_t>& buffer, uint32_t& pid, uint8_t& priority);
+
+std::vector<uint8_t> serializeTriggerPayload(Trigger trigger, TriggerProfile profile, const std::vector<uint8_t>& extras);
+
+// buffer starts after the payload type byte
+bool deserializeTriggerPayload(const std::vector<uint8_t>& buffer, Trigger& trigger, TriggerProfile& profile, std::vector<uint8_t>& extras);
+
+// same, from the bytes after the payload type byte; command.extras keeps
+// its capacity, so a reused command does not allocate
+bool deserializeTriggerPayload(const uint8_t* data, size_t size, TriggerCommand& command);
+
+// applyAtNs is only written if flags has COMMAND_APPLY_AT
+std::vector<uint8_t> serializeCommandPayload(uint8_t flags, uint32_t sequence,
+                                const TriggerCommand* commands, size_t count,
+                                int64_t applyAtNs = 0);
+
+// buffer is the whole payload; flags and sequence are set even when the
+// trigger records turn out to be malformed, so the sender can be answered.
+// applyAtNs is 0 unless flags has COMMAND_APPLY_AT
+bool deserializeCommandPayload(const std::vector<uint8_t>& buffer, uint8_t& flags,
+                                uint32_t& sequence, std::vector<TriggerCommand>& commands,
+                                int64_t& applyAtNs);
+
+std::vector<uint8_t> serializeAckPayload(const AckPayload& ack);
+
+// buffer is the whole payload
+bool deserializeAckPayload(const std::vector<uint8_t>& buffer, AckPayload& ack);
+
+std::vector<uint8_t> serializeTimeSyncPayload(const TimeSyncPayload& sync);
+
+// buffer is the whole payload
+bool deserializeTimeSyncPayload(const std::vector<uint8_t>& buffer, TimeSyncPayload& sync);
+
+// token, if given, is appended as the network mode credentials (at most
+// HELLO_TOKEN_MAX bytes)
+std::vector<uint8_t> serializeHelloPayload(uint32_t nonce, const std::string* token = nullptr);
+
+// buffer is the whole payload
+bool deserializeHelloPayload(const std::vector<uint8_t>& buffer, uint32_t& nonce);
+
+// buffer is the whole payload; false if the HELLO carries no token
+bool deserializeHelloToken(const std::vector<uint8_t>& buffer, std::string& token);
+
+std::vector<uint8_t> serializeReadyPayload(const ReadyPayload& ready);
+
+// buffer is the whole payload
+bool deserializeReadyPayload(const std::vector<uint8_t>& buffer, ReadyPayload& ready);
+
+std::vector<uint8_t> serializeStatsPayload(uint32_t id, const std::string& text = "");
+
+// buffer is the whole payload
+bool deserializeStatsPayload(const std::vector<uint8_t>& buffer, uint32_t& id, std::string& text);
+
+std::vector<uint8_t> serializeSubscribePayload(uint16_t rateHz, uint8_t flags = 0,
+                                uint8_t repeats = 0);
+
+// buffer is the whole payload; flags and repeats are 0 if absent
+bool deserializeSubscribePayload(const std::vector<uint8_t>& buffer, uint16_t& rateHz,
+                                uint8_t& flags, uint8_t& repeats);
+
+void packInputState(const DS5W::DS5InputState& state, uint8_t* packed);
+void unpackInputState(const uint8_t* packed, DS5W::DS5InputState& state);
+
+// delta against previous, or a keyframe if previous is null; a delta
+// without changes is only INPUT_HEADER_SIZE bytes long. A non-zero
+// timestampNs is sent along with INPUT_TIMESTAMPED
+std::vector<uint8_t> serializeInputPayload(uint32_t sequence, const uint8_t* packed,
+                                const uint8_t* previous, int64_t timestampNs = 0);
+
+// buffer is the whole payload; the bytes it carries are written into packed
+// and the timestamp, if any, into timestampNs (0 otherwise)
+bool deserializeInputPayload(const std::vector<uint8_t>& buffer, uint32_t& sequence,
+                                uint8_t& flags, uint8_t* packed,
+                                int64_t* timestampNs = nullptr);
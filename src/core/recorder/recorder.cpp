@@ -0,0 +1,152 @@
+/*
+    recorder.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#include <recorder.h>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+    const char MAGIC[4] = { 'D', 'S', 'H', 'R' };
+
+    std::mutex fileMutex;
+    FILE* captureFile = nullptr;
+    std::vector<char> fileBuffer;
+    uint64_t captured = 0;
+
+    void putU16(uint8_t* out, uint16_t value) {
+        out[0] = static_cast<uint8_t>(value);
+        out[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    void putU64(uint8_t* out, uint64_t value) {
+        for (int i = 0; i < 8; i++)
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    uint16_t getU16(const uint8_t* in) {
+        return static_cast<uint16_t>(in[0] | (in[1] << 8));
+    }
+
+    uint64_t getU64(const uint8_t* in) {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++)
+            value |= static_cast<uint64_t>(in[i]) << (8 * i);
+        return value;
+    }
+
+    int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+namespace recorder {
+
+    std::atomic<bool> active = false;
+
+    Status start(const std::string& path) {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (captureFile)
+            return Status::AlreadyRecording;
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return Status::FileOpenFailed;
+        fileBuffer.resize(RECORDER_BUFFER_SIZE);
+        setvbuf(file, fileBuffer.data(), _IOFBF, fileBuffer.size());
+
+        uint8_t header[RECORDER_HEADER_SIZE] = {};
+        memcpy(header, MAGIC, sizeof(MAGIC));
+        putU16(&header[4], RECORDER_FILE_VERSION);
+        fwrite(header, 1, sizeof(header), file);
+
+        captureFile = file;
+        captured = 0;
+        active.store(true, std::memory_order_release);
+        return Status::Success;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        active.store(false, std::memory_order_release);
+        if (!captureFile)
+            return;
+        fclose(captureFile);
+        captureFile = nullptr;
+        // the buffer belonged to the file; release it with it
+        std::vector<char>().swap(fileBuffer);
+    }
+
+    void capture(Direction direction, uint8_t connection, const uint8_t* report, uint16_t length) {
+        if (!isActive())
+            return;
+        uint8_t header[RECORDER_RECORD_HEADER_SIZE];
+        putU64(&header[0], static_cast<uint64_t>(nowNs()));
+        header[8] = static_cast<uint8_t>(direction);
+        header[9] = connection;
+        putU16(&header[10], length);
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        // stop() may have won the race for the lock
+        if (!captureFile)
+            return;
+        fwrite(header, 1, sizeof(header), captureFile);
+        fwrite(report, 1, length, captureFile);
+        captured++;
+    }
+
+    uint64_t getCaptured() {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        return captured;
+    }
+
+    Reader::~Reader() {
+        close();
+    }
+
+    Status Reader::open(const std::string& path) {
+        close();
+        file = fopen(path.c_str(), "rb");
+        if (!file)
+            return Status::FileOpenFailed;
+        uint8_t header[RECORDER_HEADER_SIZE];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header)
+                || memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+            close();
+            return Status::BadHeader;
+        }
+        if (getU16(&header[4]) > RECORDER_FILE_VERSION) {
+            close();
+            return Status::UnsupportedVersion;
+        }
+        return Status::Success;
+    }
+
+    bool Reader::next(Record& record) {
+        if (!file)
+            return false;
+        uint8_t header[RECORDER_RECORD_HEADER_SIZE];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header))
+            return false;
+        record.timestampNs = static_cast<int64_t>(getU64(&header[0]));
+        record.direction = static_cast<Direction>(header[8]);
+        record.connection = header[9];
+        record.report.resize(getU16(&header[10]));
+        return fread(record.report.data(), 1, record.report.size(), file) == record.report.size();
+    }
+
+    void Reader::close() {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+}
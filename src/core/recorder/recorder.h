@@ -0,0 +1,117 @@
+/*
+    recorder.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Capture file of the HID traffic of a controller. The file is an 8-byte
+// header ("DSHR", version (2), reserved (2)) followed by records of
+// timestamp (8), direction, connection, length (2) and the report bytes,
+// report id included. Integers are little endian; timestamps are steady
+// clock nanoseconds.
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define RECORDER_FILE_VERSION 1
+#define RECORDER_HEADER_SIZE 8
+#define RECORDER_RECORD_HEADER_SIZE 12
+// stdio buffer of the capture file, so a report is a memcpy most of the time
+#define RECORDER_BUFFER_SIZE (1 << 20)
+
+namespace recorder {
+
+    enum class Status {
+        Success,
+        FileOpenFailed,
+        AlreadyRecording,
+        BadHeader,
+        UnsupportedVersion
+    };
+
+    enum class Direction : uint8_t {
+        Input = 0,      // report read from the controller
+        Output = 1      // report written to the controller
+    };
+
+    struct Record {
+        int64_t timestampNs;
+        Direction direction;
+        uint8_t connection;     // DS5W::DeviceConnection value
+        std::vector<uint8_t> report;
+    };
+
+    // set by start() and stop(); read on every report
+    extern std::atomic<bool> active;
+
+    inline bool isActive() {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Creates (or truncates) a capture file and starts appending every
+     * report passed to capture() to it.
+     *
+     * @param path The capture file.
+     * @return Status::Success if recording started.
+     *         Status::FileOpenFailed if the file could not be created.
+     *         Status::AlreadyRecording if a capture is already running.
+     */
+    Status start(const std::string& path);
+
+    /**
+     * Flushes and closes the capture file. Has no effect if no capture is
+     * running.
+     */
+    void stop();
+
+    /**
+     * Appends one report with the current time. Does nothing unless a
+     * capture is running; safe to call from any thread.
+     */
+    void capture(Direction direction, uint8_t connection, const uint8_t* report, uint16_t length);
+
+    /**
+     * Returns the number of reports captured since start().
+     */
+    uint64_t getCaptured();
+
+    /**
+     * Reads a capture file record by record.
+     */
+    class Reader {
+    public:
+        Reader() = default;
+        ~Reader();
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        /**
+         * @param path The capture file.
+         * @return Status::Success if the file is a capture this build reads.
+         *         Status::FileOpenFailed if the file could not be opened.
+         *         Status::BadHeader if it is not a capture file.
+         *         Status::UnsupportedVersion if it was written by a newer version.
+         */
+        Status open(const std::string& path);
+
+        /**
+         * @return false at the end of the file; a truncated last record
+         *         (e.g. from a crash while recording) is treated as the end
+         */
+        bool next(Record& record);
+
+        void close();
+
+    private:
+        FILE* file = nullptr;
+    };
+}
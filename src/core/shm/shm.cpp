@@ -0,0 +1,541 @@
+/*
+    shm.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+
+// Shared-memory transport between DualSensitive client and server modes.
+// The service owns a memory-mapped single-producer/single-consumer ring of
+// fixed-size records. The client publishes a record with two atomic stores;
+// the consumer thread only parks on a named auto-reset event when the ring
+// is empty, and the producer only signals that event when it sees the
+// consumer parked.
+// A second, read-only segment holds the latest controller input snapshot
+// under a seqlock for any local process to copy.
+// The producer can write anything into the ring, so the consumer keeps its
+// own tail and only takes head from shared memory, checked against it.
+
+#include <shm.h>
+#include <metrics.h>
+#include <trace.h>
+#include <Windows.h>
+#include <sddl.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <cstring>
+
+#define CACHE_LINE_SIZE 64
+#define RING_CAPACITY 256 // must be a power of two
+#define RECORD_SIZE CACHE_LINE_SIZE
+#define RING_MAGIC 0x44535352 // "DSSR"
+#define CONSUMER_WAIT_MS 1000
+#define INPUT_MAGIC 0x44534953 // "DSIS"
+#define INPUT_STATE_MAX 512
+#define INPUT_READ_RETRIES 1024
+#define INPUT_READERS_MAX 4
+
+namespace {
+
+    struct Record {
+        uint16_t size;
+        uint8_t data[RECORD_SIZE - sizeof(uint16_t)];
+    };
+
+    // head, tail and the sleep flag each get their own cache line so the
+    // producer and consumer never write to the same line
+    struct Ring {
+        uint32_t magic;
+        uint32_t capacity;
+        alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> producerPid;
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // next slot to write
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // next slot to read
+        alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> consumerSleeping;
+        alignas(CACHE_LINE_SIZE) Record records[RING_CAPACITY];
+    };
+
+    // seqlock: the sequence is odd while the publisher writes; a reader
+    // copies timestamp and state and keeps the copy only if the sequence
+    // was even and has not moved meanwhile
+    struct InputSegment {
+        std::atomic<uint32_t> magic;    // cleared when the service stops
+        uint32_t stateSize;
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> sequence;
+        int64_t timestampNs;
+        uint8_t state[INPUT_STATE_MAX];
+    };
+
+    static_assert(sizeof(Record) == RECORD_SIZE, "record must fill one cache line");
+    static_assert((RING_CAPACITY & (RING_CAPACITY - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring atomics must be address-free");
+
+    std::wstring objectName(uint16_t port, const wchar_t* suffix) {
+        return L"Local\\DualSensitive-" + std::to_wstring(port) + suffix;
+    }
+
+    // string SID of the user this process runs as, empty if unknown
+    std::wstring processUserSid() {
+        std::wstring sid;
+        HANDLE token = NULL;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+            return sid;
+        DWORD size = 0;
+        GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+        std::vector<uint8_t> buffer(size);
+        wchar_t* text = nullptr;
+        if (size && GetTokenInformation(token, TokenUser, buffer.data(), size, &size)
+                && ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(buffer.data())->User.Sid, &text)) {
+            sid = text;
+            LocalFree(text);
+        }
+        CloseHandle(token);
+        return sid;
+    }
+
+    // The service usually runs elevated while the game does not. Elevation
+    // keeps the user SID, so the ring and its doorbell grant full access to
+    // the service's user besides SYSTEM and the administrators, and nothing
+    // to other users. The input snapshot is readable by everyone but only
+    // writable by SYSTEM and the administrators (the elevated service), so
+    // the game and other users cannot forge it.
+    // Without a descriptor the objects get the default security, which
+    // keeps a non-elevated client out; it then sends over UDP.
+    struct SharedSecurity {
+        PSECURITY_DESCRIPTOR descriptor = nullptr;
+        SECURITY_ATTRIBUTES attributes = {};
+
+        explicit SharedSecurity(bool snapshot) {
+            std::wstring sddl = L"D:P(A;;GA;;;SY)(A;;GA;;;BA)";
+            if (snapshot) {
+                sddl += L"(A;;GR;;;WD)";
+            } else {
+                std::wstring user = processUserSid();
+                if (!user.empty())
+                    sddl += L"(A;;GA;;;" + user + L")";
+            }
+            if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                        sddl.c_str(), SDDL_REVISION_1, &descriptor, nullptr)) {
+                descriptor = nullptr;
+                return;
+            }
+            attributes.nLength = sizeof(attributes);
+            attributes.lpSecurityDescriptor = descriptor;
+            attributes.bInheritHandle = FALSE;
+        }
+
+        ~SharedSecurity() {
+            if (descriptor)
+                LocalFree(descriptor);
+        }
+
+        SECURITY_ATTRIBUTES* get() {
+            return descriptor ? &attributes : nullptr;
+        }
+    };
+
+    bool isProcessAlive(uint32_t pid) {
+        HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+        if (!h) return false;
+        DWORD result = WaitForSingleObject(h, 0);
+        CloseHandle(h);
+        return result == WAIT_TIMEOUT;
+    }
+}
+
+// consumer (service) side
+static HANDLE serverMapping = NULL;
+static HANDLE serverDoorbell = NULL;
+static Ring* serverRing = nullptr;
+static std::thread consumerThread;
+static std::atomic<bool> serverRunning = false;
+static CallbackFunc recordHandler = nullptr;
+static BatchEndFunc batchEndHandler = nullptr;
+
+// producer (client) side
+static HANDLE clientMapping = NULL;
+static HANDLE clientDoorbell = NULL;
+static Ring* clientRing = nullptr;
+// the ring has a single producer; threads of the client process take turns
+static std::mutex producerMutex;
+
+// input snapshot publisher (service) and readers
+static HANDLE publisherMapping = NULL;
+// the writer thread publishes while the service starts and stops it
+static std::atomic<InputSegment*> publisherSegment = nullptr;
+static size_t publishedSize = 0;
+// one read-only mapping per service port read from; a mapping stays until
+// closeInput(), so readInput() looks its port up without a lock
+struct InputReader {
+    std::atomic<uint16_t> port{0};  // set before segment is published
+    std::atomic<const InputSegment*> segment{nullptr};
+    HANDLE mapping = NULL;
+};
+static InputReader readers[INPUT_READERS_MAX];
+
+static const InputSegment* findReader(uint16_t serverPort) {
+    for (InputReader& reader : readers) {
+        const InputSegment* segment = reader.segment.load(std::memory_order_acquire);
+        if (segment && reader.port.load(std::memory_order_relaxed) == serverPort)
+            return segment;
+    }
+    return nullptr;
+}
+
+static std::mutex initMutex;
+
+namespace shm {
+
+    Status startServer(uint16_t serverPort, CallbackFunc callback, BatchEndFunc batchEnd) {
+        if (!callback) {
+            return Status::CallbackNotProvided;
+        }
+
+        std::lock_guard<std::mutex> lock(initMutex);
+
+        if (serverRunning) return Status::ServerAlreadyRunning;
+
+        recordHandler = callback;
+        batchEndHandler = batchEnd;
+
+        SharedSecurity security(false);
+        serverMapping = CreateFileMappingW(
+                INVALID_HANDLE_VALUE, security.get(), PAGE_READWRITE,
+                0, sizeof(Ring), objectName(serverPort, L"-ring").c_str()
+        );
+        if (!serverMapping) {
+            return Status::MappingFailed;
+        }
+
+        serverRing = static_cast<Ring*>(
+                MapViewOfFile(serverMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Ring))
+        );
+        if (!serverRing) {
+            CloseHandle(serverMapping);
+            serverMapping = NULL;
+            return Status::MappingFailed;
+        }
+
+        serverDoorbell = CreateEventW(
+                security.get(), FALSE, FALSE,
+                objectName(serverPort, L"-doorbell").c_str()
+        );
+        if (!serverDoorbell) {
+            UnmapViewOfFile(serverRing);
+            CloseHandle(serverMapping);
+            serverRing = nullptr;
+            serverMapping = NULL;
+            return Status::EventCreationFailed;
+        }
+
+        // a leftover mapping from a crashed service may still hold records;
+        // start from an empty ring either way
+        serverRing->capacity = RING_CAPACITY;
+        serverRing->tail.store(serverRing->head.load());
+        serverRing->consumerSleeping.store(0);
+        serverRing->magic = RING_MAGIC;
+
+        serverRunning = true;
+        consumerThread = std::thread([]() {
+            Ring* ring = serverRing;
+            std::vector<uint8_t> payload;
+            payload.reserve(sizeof(Record::data));
+            // records carry no return address
+            const udp::Peer producer;
+            // ours; the copy in the ring only tells the producer
+            uint64_t tail = ring->tail.load();
+            while (serverRunning) {
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                if (head - tail > RING_CAPACITY) {
+                    // a head no producer can reach (a bogus write to the
+                    // ring): skip to it rather than walk billions of slots
+                    metrics::add(metrics::Counter::ShmResyncs);
+                    tail = head;
+                    ring->tail.store(tail, std::memory_order_release);
+                    continue;
+                }
+                if (tail != head) {
+                    metrics::set(metrics::Gauge::RingDepth, static_cast<int64_t>(head - tail));
+                    metrics::add(metrics::Counter::ShmIn, head - tail);
+                    // drain everything published so far as one batch
+                    for (; tail != head; tail++) {
+                        const Record& record = ring->records[tail & (RING_CAPACITY - 1)];
+                        uint16_t size = record.size;
+                        if (size > sizeof(record.data)) size = sizeof(record.data);
+                        payload.assign(record.data, record.data + size);
+                        ring->tail.store(tail + 1, std::memory_order_release);
+                        if (size > 0 && recordHandler) {
+                            TRACE_SPAN("shm.receive");
+                            recordHandler(payload, producer);
+                        }
+                    }
+                    if (batchEndHandler) batchEndHandler();
+                    continue;
+                }
+
+                // announce the nap, then re-check: a producer that published
+                // before seeing the flag is caught here, one that publishes
+                // after will see the flag and ring the doorbell
+                ring->consumerSleeping.store(1);
+                if (ring->head.load() == tail) {
+                    WaitForSingleObject(serverDoorbell, CONSUMER_WAIT_MS);
+                }
+                ring->consumerSleeping.store(0);
+            }
+        });
+
+        return Status::Success;
+    }
+
+    void stopServer() {
+        std::lock_guard<std::mutex> lock(initMutex);
+
+        if (!serverRunning) return;
+        serverRunning = false;
+
+        SetEvent(serverDoorbell); // wake the consumer NOW
+        if (consumerThread.joinable()) {
+            consumerThread.join();
+        }
+
+        serverRing->magic = 0;
+        UnmapViewOfFile(serverRing);
+        CloseHandle(serverMapping);
+        CloseHandle(serverDoorbell);
+        serverRing = nullptr;
+        serverMapping = NULL;
+        serverDoorbell = NULL;
+    }
+
+    uint32_t getProducerPid() {
+        Ring* ring = serverRing;
+        return ring ? ring->producerPid.load() : 0;
+    }
+
+    Status startClient(uint16_t serverPort) {
+        std::lock_guard<std::mutex> lock(initMutex);
+        if (clientRing)
+            return Status::ClientAlreadyRunning;
+
+        clientMapping = OpenFileMappingW(
+                FILE_MAP_ALL_ACCESS, FALSE, objectName(serverPort, L"-ring").c_str()
+        );
+        if (!clientMapping) {
+            return Status::MappingFailed;
+        }
+
+        Ring* ring = static_cast<Ring*>(
+                MapViewOfFile(clientMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Ring))
+        );
+        if (!ring || ring->magic != RING_MAGIC || ring->capacity != RING_CAPACITY) {
+            if (ring) UnmapViewOfFile(ring);
+            CloseHandle(clientMapping);
+            clientMapping = NULL;
+            return Status::MappingFailed;
+        }
+
+        // claim the producer slot; take it over if its owner has died
+        uint32_t pid = static_cast<uint32_t>(GetCurrentProcessId());
+        uint32_t owner = 0;
+        while (!ring->producerPid.compare_exchange_strong(owner, pid)) {
+            if (owner == pid) break;
+            if (isProcessAlive(owner)) {
+                UnmapViewOfFile(ring);
+                CloseHandle(clientMapping);
+                clientMapping = NULL;
+                return Status::ProducerBusy;
+            }
+        }
+
+        clientDoorbell = OpenEventW(
+                EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE,
+                objectName(serverPort, L"-doorbell").c_str()
+        );
+        if (!clientDoorbell) {
+            ring->producerPid.store(0);
+            UnmapViewOfFile(ring);
+            CloseHandle(clientMapping);
+            clientMapping = NULL;
+            return Status::EventCreationFailed;
+        }
+
+        clientRing = ring;
+        return Status::Success;
+    }
+
+    Status send(const std::vector<uint8_t>& payload) {
+        std::lock_guard<std::mutex> lock(producerMutex);
+        Ring* ring = clientRing;
+        if (!ring)
+            return Status::NotInitialized;
+        if (payload.size() > sizeof(Record::data))
+            return Status::PayloadTooLarge;
+
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= RING_CAPACITY)
+            return Status::RingFull;
+
+        Record& record = ring->records[head & (RING_CAPACITY - 1)];
+        record.size = static_cast<uint16_t>(payload.size());
+        memcpy(record.data, payload.data(), payload.size());
+        ring->head.store(head + 1);
+        metrics::add(metrics::Counter::ShmOut);
+
+        // pairs with the consumer's flag-then-recheck above
+        if (ring->consumerSleeping.load()) {
+            SetEvent(clientDoorbell);
+        }
+        return Status::Success;
+    }
+
+    void stopClient() {
+        std::lock_guard<std::mutex> initLock(initMutex);
+        std::lock_guard<std::mutex> lock(producerMutex);
+        if (!clientRing) return;
+
+        uint32_t pid = static_cast<uint32_t>(GetCurrentProcessId());
+        clientRing->producerPid.compare_exchange_strong(pid, 0);
+        UnmapViewOfFile(clientRing);
+        CloseHandle(clientMapping);
+        CloseHandle(clientDoorbell);
+        clientRing = nullptr;
+        clientMapping = NULL;
+        clientDoorbell = NULL;
+    }
+
+    Status startInputPublisher(uint16_t serverPort, size_t stateSize) {
+        if (stateSize > INPUT_STATE_MAX)
+            return Status::SizeMismatch;
+
+        std::lock_guard<std::mutex> lock(initMutex);
+        if (publisherSegment)
+            return Status::ServerAlreadyRunning;
+
+        SharedSecurity security(true);
+        publisherMapping = CreateFileMappingW(
+                INVALID_HANDLE_VALUE, security.get(), PAGE_READWRITE,
+                0, sizeof(InputSegment), objectName(serverPort, L"-input").c_str()
+        );
+        if (!publisherMapping) {
+            return Status::MappingFailed;
+        }
+        InputSegment* segment = static_cast<InputSegment*>(
+                MapViewOfFile(publisherMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(InputSegment))
+        );
+        if (!segment) {
+            CloseHandle(publisherMapping);
+            publisherMapping = NULL;
+            return Status::MappingFailed;
+        }
+
+        // readers still mapping a previous service's segment share this one;
+        // the sequence carries on, so it never goes back for them
+        uint64_t sequence = segment->sequence.load();
+        if (sequence & 1)
+            segment->sequence.store(sequence + 1);
+        segment->stateSize = static_cast<uint32_t>(stateSize);
+        segment->magic.store(INPUT_MAGIC, std::memory_order_release);
+        publishedSize = stateSize;
+        publisherSegment.store(segment, std::memory_order_release);
+        return Status::Success;
+    }
+
+    void publishInput(const void* state, int64_t timestampNs) {
+        InputSegment* segment = publisherSegment.load(std::memory_order_acquire);
+        if (!segment)
+            return;
+        uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+        segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->timestampNs = timestampNs;
+        memcpy(segment->state, state, publishedSize);
+        segment->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void stopInputPublisher() {
+        std::lock_guard<std::mutex> lock(initMutex);
+        InputSegment* segment = publisherSegment.exchange(nullptr);
+        if (!segment) return;
+
+        // readers keep the segment mapped; this tells them it went stale
+        segment->magic.store(0, std::memory_order_release);
+        UnmapViewOfFile(segment);
+        CloseHandle(publisherMapping);
+        publisherMapping = NULL;
+    }
+
+    Status readInput(uint16_t serverPort, void* state, size_t stateSize,
+                    uint64_t& sequence, int64_t& timestampNs) {
+        const InputSegment* segment = findReader(serverPort);
+        if (!segment) {
+            std::lock_guard<std::mutex> lock(initMutex);
+            segment = findReader(serverPort);
+            if (!segment) {
+                InputReader* reader = std::find_if(std::begin(readers), std::end(readers),
+                        [](const InputReader& candidate) { return !candidate.segment.load(); });
+                if (reader == std::end(readers))
+                    return Status::MappingFailed;
+                HANDLE mapping = OpenFileMappingW(
+                        FILE_MAP_READ, FALSE, objectName(serverPort, L"-input").c_str()
+                );
+                if (!mapping)
+                    return Status::MappingFailed;
+                segment = static_cast<const InputSegment*>(
+                        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(InputSegment))
+                );
+                if (!segment) {
+                    CloseHandle(mapping);
+                    return Status::MappingFailed;
+                }
+                reader->mapping = mapping;
+                reader->port.store(serverPort, std::memory_order_relaxed);
+                reader->segment.store(segment, std::memory_order_release);
+            }
+        }
+        if (segment->magic.load(std::memory_order_acquire) != INPUT_MAGIC)
+            return Status::NotPublishing;
+        if (segment->stateSize != stateSize)
+            return Status::SizeMismatch;
+
+        for (int attempt = 0; attempt < INPUT_READ_RETRIES; attempt++) {
+            uint64_t before = segment->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (before == 0)
+                return Status::NoSnapshot;
+            int64_t timestamp = segment->timestampNs;
+            memcpy(state, segment->state, stateSize);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment->sequence.load(std::memory_order_relaxed) != before)
+                continue;
+            // the service stopped while we copied
+            if (segment->magic.load(std::memory_order_relaxed) != INPUT_MAGIC)
+                return Status::NotPublishing;
+            sequence = before / 2;
+            timestampNs = timestamp;
+            return Status::Success;
+        }
+        return Status::SnapshotBusy;
+    }
+
+    void closeInput() {
+        std::lock_guard<std::mutex> lock(initMutex);
+        for (InputReader& reader : readers) {
+            const InputSegment* segment = reader.segment.exchange(nullptr);
+            if (!segment)
+                continue;
+            UnmapViewOfFile(segment);
+            CloseHandle(reader.mapping);
+            reader.mapping = NULL;
+        }
+    }
+}
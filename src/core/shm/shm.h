@@ -0,0 +1,154 @@
+/*
+    shm.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// the ring hands records to the same handler type as the UDP server
+#include <udp.h>
+
+namespace shm {
+
+    enum class Status {
+        Success,
+        MappingFailed,
+        EventCreationFailed,
+        CallbackNotProvided,
+        ServerAlreadyRunning,
+        ClientAlreadyRunning,
+        ProducerBusy,
+        PayloadTooLarge,
+        RingFull,
+        NotInitialized,
+        SizeMismatch,
+        NoSnapshot,
+        SnapshotBusy,
+        NotPublishing
+    };
+
+    /**
+     * Creates the shared-memory command ring for the given port and starts
+     * a consumer thread that hands every record to the callback.
+     * The consumer only sleeps (on a named event) while the ring is empty.
+     * Each wakeup drains all published records and then calls batchEnd once.
+     *
+     * @param serverPort The service port; used to name the shared objects.
+     * @param callback   A function that receives the raw bytes of each record.
+     * @param batchEnd   (optional) Called after each drained batch.
+     * @return Status::Success if the ring was created and the consumer started.
+     *         Status::MappingFailed if the file mapping could not be created.
+     *         Status::EventCreationFailed if the wake-up event could not be created.
+     *         Status::CallbackNotProvided if no callback function was supplied.
+     *         Status::ServerAlreadyRunning if the consumer is already running.
+     */
+    Status startServer(uint16_t serverPort, CallbackFunc callback, BatchEndFunc batchEnd = nullptr);
+
+    /**
+     * Maps the ring created by the service on the given port and claims
+     * its single producer slot.
+     *
+     * @param serverPort The service port.
+     * @return Status::Success if the ring was mapped and claimed.
+     *         Status::MappingFailed if the service has not created the ring.
+     *         Status::EventCreationFailed if the wake-up event could not be opened.
+     *         Status::ProducerBusy if another live process owns the producer slot.
+     *         Status::ClientAlreadyRunning if already initialized.
+     */
+    Status startClient(uint16_t serverPort);
+
+    /**
+     * Appends one record to the ring. No system call is made unless the
+     * consumer is asleep.
+     *
+     * @param payload The raw record bytes.
+     * @return Status::Success if the record was published.
+     *         Status::NotInitialized if startClient() did not succeed.
+     *         Status::PayloadTooLarge if the payload does not fit a record.
+     *         Status::RingFull if the consumer has fallen a full ring behind.
+     *         The record is not published on failure; the caller has to
+     *         send it another way (CLIENT mode falls back to UDP).
+     */
+    Status send(const std::vector<uint8_t>& payload);
+
+    /**
+     * Stops the consumer thread and releases the ring.
+     * Has no effect if the server is not running.
+     */
+    void stopServer();
+
+    /**
+     * Returns the PID of the process currently owning the producer slot,
+     * or 0 if there is none. Server side only.
+     */
+    uint32_t getProducerPid();
+
+    /**
+     * Releases the producer slot and unmaps the ring.
+     */
+    void stopClient();
+
+    /**
+     * Creates the read-only input snapshot segment for the given port. The
+     * publisher overwrites a single snapshot under a seqlock, so any number
+     * of local readers can copy it without system calls or locks.
+     *
+     * @param serverPort The service port; used to name the shared object.
+     * @param stateSize  Size of the snapshots that will be published.
+     * @return Status::Success if the segment was created.
+     *         Status::MappingFailed if the file mapping could not be created.
+     *         Status::SizeMismatch if stateSize does not fit the segment.
+     *         Status::ServerAlreadyRunning if the segment is already published.
+     */
+    Status startInputPublisher(uint16_t serverPort, size_t stateSize);
+
+    /**
+     * Replaces the published snapshot. Never blocks; one thread at a time.
+     *
+     * @param state       The snapshot bytes, stateSize long.
+     * @param timestampNs Time of the snapshot, on the steady clock.
+     */
+    void publishInput(const void* state, int64_t timestampNs);
+
+    /**
+     * Stops publishing and releases the segment. Readers keep it mapped,
+     * but readInput() then reports Status::NotPublishing. Stop every
+     * thread that calls publishInput() first.
+     */
+    void stopInputPublisher();
+
+    /**
+     * Copies a consistent snapshot out of the segment of the given port,
+     * mapping it read-only on first use. Up to four ports can be read
+     * from; each keeps its own mapping.
+     *
+     * @param serverPort  The service port.
+     * @param state       Receives the snapshot, stateSize bytes.
+     * @param stateSize   Size of the snapshots the caller expects.
+     * @param sequence    Receives the number of snapshots published so far.
+     * @param timestampNs Receives the time of the snapshot.
+     * @return Status::Success if a snapshot was copied.
+     *         Status::MappingFailed if the service has not created the segment,
+     *         or four other ports are mapped already.
+     *         Status::SizeMismatch if the service publishes another layout.
+     *         Status::NoSnapshot if nothing has been published yet.
+     *         Status::SnapshotBusy if the publisher stayed mid-write (e.g. it
+     *         died while writing).
+     *         Status::NotPublishing if the service has stopped publishing;
+     *         the last snapshot is stale.
+     */
+    Status readInput(uint16_t serverPort, void* state, size_t stateSize,
+                    uint64_t& sequence, int64_t& timestampNs);
+
+    /**
+     * Unmaps the segments mapped by readInput().
+     */
+    void closeInput();
+}
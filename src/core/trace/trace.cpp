@@ -0,0 +1,159 @@
+/*
+    trace.cpp is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Span tracer. Like the metrics shards, every thread claims a buffer on its
+// first span and is its only writer; a span is three stores and a release
+// store of the count. Buffers are pushed onto a list that is never shrunk.
+// A buffer remembers the session it was filled in, so start() does not
+// have to touch the buffers of other threads: each one resets itself on
+// its next span, and the writer skips those of older sessions.
+
+#include <trace.h>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+    struct Event {
+        const char* name;
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    struct Buffer {
+        Event events[TRACE_EVENTS_PER_THREAD];
+        std::atomic<uint32_t> count;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint32_t> session;
+        std::atomic<bool> inUse;
+        uint32_t lane;              // the track it is drawn on
+        Buffer* next;
+    };
+
+    std::atomic<Buffer*> buffers = nullptr;
+    std::atomic<uint32_t> lanes = 0;
+    std::atomic<uint32_t> session = 0;
+
+    Buffer* claimBuffer() {
+        uint32_t current = session.load(std::memory_order_relaxed);
+        // a released buffer still holding spans of this session must be kept
+        for (Buffer* buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            if (buffer->session.load(std::memory_order_relaxed) == current
+                    && buffer->count.load(std::memory_order_relaxed) != 0)
+                continue;
+            bool free = false;
+            if (buffer->inUse.compare_exchange_strong(free, true, std::memory_order_acquire))
+                return buffer;
+        }
+        // value-initialized, so every atomic starts at zero
+        Buffer* buffer = new Buffer();
+        buffer->lane = lanes.fetch_add(1, std::memory_order_relaxed) + 1;
+        buffer->inUse.store(true, std::memory_order_relaxed);
+        Buffer* head = buffers.load(std::memory_order_relaxed);
+        do {
+            buffer->next = head;
+        } while (!buffers.compare_exchange_weak(head, buffer,
+                    std::memory_order_release, std::memory_order_relaxed));
+        return buffer;
+    }
+
+    struct BufferOwner {
+        Buffer* buffer = claimBuffer();
+        ~BufferOwner() { buffer->inUse.store(false, std::memory_order_release); }
+    };
+
+    Buffer& localBuffer() {
+        static thread_local BufferOwner owner;
+        return *owner.buffer;
+    }
+}
+
+namespace trace {
+
+    std::atomic<bool> active = false;
+
+    void start() {
+        session.fetch_add(1, std::memory_order_relaxed);
+        active.store(true, std::memory_order_release);
+    }
+
+    void stop() {
+        active.store(false, std::memory_order_release);
+    }
+
+    void record(const char* name, int64_t startNs, int64_t endNs) {
+        Buffer& buffer = localBuffer();
+        uint32_t current = session.load(std::memory_order_relaxed);
+        if (buffer.session.load(std::memory_order_relaxed) != current) {
+            buffer.count.store(0, std::memory_order_relaxed);
+            buffer.dropped.store(0, std::memory_order_relaxed);
+            buffer.session.store(current, std::memory_order_release);
+        }
+        uint32_t count = buffer.count.load(std::memory_order_relaxed);
+        if (count >= TRACE_EVENTS_PER_THREAD) {
+            buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[count] = { name, startNs, endNs - startNs };
+        buffer.count.store(count + 1, std::memory_order_release);
+    }
+
+    uint64_t getDropped() {
+        uint32_t current = session.load(std::memory_order_relaxed);
+        uint64_t dropped = 0;
+        for (Buffer* buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            if (buffer->session.load(std::memory_order_acquire) == current)
+                dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+
+    Status writeChromeTrace(const std::string& path, uint32_t pid) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file)
+            return Status::FileOpenFailed;
+
+        uint32_t current = session.load(std::memory_order_relaxed);
+        bool first = true;
+        fputs("{\"traceEvents\":[", file);
+        for (Buffer* buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            if (buffer->session.load(std::memory_order_acquire) != current)
+                continue;
+            uint32_t count = buffer->count.load(std::memory_order_acquire);
+            if (count == 0)
+                continue;
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+                    "\"args\":{\"name\":\"thread %u\"}}",
+                    first ? "" : ",", pid, buffer->lane, buffer->lane);
+            first = false;
+            for (uint32_t i = 0; i < count; i++) {
+                const Event& event = buffer->events[i];
+                // complete events, in microseconds of the steady clock, so
+                // the traces of a client and the service line up
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"dualsensitive\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}",
+                        event.name, event.startNs / 1e3, event.durationNs / 1e3,
+                        pid, buffer->lane);
+            }
+        }
+        fputs("\n],\"displayTimeUnit\":\"ns\"}\n", file);
+
+        bool failed = ferror(file) != 0;
+        if (fclose(file) != 0)
+            failed = true;
+        return failed ? Status::WriteFailed : Status::Success;
+    }
+
+    int64_t Span::nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
@@ -0,0 +1,103 @@
+/*
+    trace.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// spans each thread can record in one session; later ones are counted as
+// dropped
+#define TRACE_EVENTS_PER_THREAD 65536
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Records the rest of the enclosing scope as one span. name must be a
+// string literal (only the pointer is stored)
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+namespace trace {
+
+    enum class Status {
+        Success,
+        FileOpenFailed,
+        WriteFailed
+    };
+
+    // set by start() and stop(); read on every span
+    extern std::atomic<bool> active;
+
+    inline bool isActive() {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Starts a new session, discarding the spans of the previous one.
+     * Until then, and after stop(), a span costs one relaxed load.
+     */
+    void start();
+
+    /**
+     * Stops recording. Spans already open when stop() is called are still
+     * recorded when they end.
+     */
+    void stop();
+
+    /**
+     * Appends one completed span to the calling thread's buffer. Lock-free:
+     * every thread writes its own buffer, claimed on its first span.
+     */
+    void record(const char* name, int64_t startNs, int64_t endNs);
+
+    /**
+     * Returns the number of spans of the current (or last) session that
+     * did not fit their thread's buffer.
+     */
+    uint64_t getDropped();
+
+    /**
+     * Writes the spans of the current (or last) session in the Chrome trace
+     * event format, which chrome://tracing and Perfetto load. Timestamps
+     * are steady clock time, the clock of clockNs(), so traces of several
+     * processes on one machine can be merged; each thread buffer gets its
+     * own track.
+     * Meant to be called after stop(); spans recorded meanwhile may or may
+     * not be included.
+     *
+     * @param path The output file.
+     * @param pid  Process id written into the events.
+     * @return Status::Success if the file was written.
+     *         Status::FileOpenFailed if the file could not be created.
+     *         Status::WriteFailed if writing to it failed.
+     */
+    Status writeChromeTrace(const std::string& path, uint32_t pid);
+
+    /**
+     * Records the lifetime of the scope as a span, if tracing is active
+     * when the scope is entered.
+     */
+    class Span {
+    public:
+        explicit Span(const char* name)
+            : name(isActive() ? name : nullptr), startNs(this->name ? nowNs() : 0) {}
+        ~Span() {
+            if (name)
+                record(name, startNs, nowNs());
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+        // steady clock nanoseconds, the clock of every span
+        static int64_t nowNs();
+    private:
+        const char* name;
+        int64_t startNs;
+    };
+}
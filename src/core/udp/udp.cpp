@@ -15,14 +15,21 @@
 // - Sending UDP packets to a remote server (client mode)
 
 #include <udp.h>
+#include <metrics.h>
+#include <trace.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <thread>
+#include <atomic>
 #include <iostream>
-#include <iomanip>
 #pragma comment(lib, "ws2_32.lib")
 
 #define MAX_PAYLOAD_SIZE 1024
+// largest UDP payload; metrics replies run to several KB
+#define MAX_DATAGRAM_SIZE 65507
+// upper bound of datagrams handled per wakeup so batchEnd still runs
+// regularly under a flood; Winsock re-signals FD_READ for the rest
+#define MAX_BATCH_SIZE 256
 
 // TODO:
 // * add logging
@@ -34,13 +41,129 @@ static sockaddr_in serverAddress; // cached server address used by the client
 static std::thread serverThread;
 static std::atomic<bool> serverRunning = false;
 static CallbackFunc packetHandler = nullptr;
+static BatchEndFunc batchEndHandler = nullptr;
 static std::mutex initMutex;
 static WSAEVENT serverEvent = WSA_INVALID_EVENT;
+static std::thread clientThread;
+static std::atomic<bool> clientRunning = false;
+static CallbackFunc clientReplyHandler = nullptr;
+static WSAEVENT clientEvent = WSA_INVALID_EVENT;
+// host byte order; loopback unless network mode is configured
+static uint32_t bindAddress = INADDR_LOOPBACK;
+static uint32_t serverHostAddress = INADDR_LOOPBACK;
+// packet loss shim: xorshift32 state and the drop threshold out of 2^32
+static std::atomic<uint32_t> lossState = 1;
+static std::atomic<uint64_t> lossThreshold = 0;
+static std::atomic<uint64_t> shimDropped = 0;
+
+static bool parseAddress(const std::string& address, uint32_t& parsed) {
+    in_addr addr{};
+    if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+        return false;
+    parsed = ntohl(addr.s_addr);
+    return true;
+}
+
+// true if the loss shim eats this datagram
+static bool shimDrops() {
+    uint64_t threshold = lossThreshold.load(std::memory_order_relaxed);
+    if (!threshold)
+        return false;
+    uint32_t state = lossState.load(std::memory_order_relaxed);
+    uint32_t next;
+    do {
+        next = state;
+        next ^= next << 13;
+        next ^= next >> 17;
+        next ^= next << 5;
+    } while (!lossState.compare_exchange_weak(state, next, std::memory_order_relaxed));
+    if (next >= threshold)
+        return false;
+    shimDropped++;
+    return true;
+}
+
+// Waits on the socket's event and drains all pending datagrams per wakeup
+// (see startServer). Shared by the server and the client reply thread;
+// spanName (a string literal) labels the handler spans of each.
+static void receiveLoop(SOCKET sock, WSAEVENT event, std::atomic<bool>& running,
+                        CallbackFunc handler, BatchEndFunc batchEnd, const char* spanName) {
+    std::vector<char> buffer(MAX_DATAGRAM_SIZE);
+    sockaddr_in senderAddr{};
+    std::vector<uint8_t> payload;
+    payload.reserve(MAX_PAYLOAD_SIZE);
+    while (running) {
+        DWORD waitResult = WSAWaitForMultipleEvents(1, &event, FALSE, 1000, FALSE);
+        if (waitResult == WSA_WAIT_FAILED) break;
+        if (waitResult == WSA_WAIT_TIMEOUT) continue;
+
+        WSANETWORKEVENTS networkEvents;
+        if (WSAEnumNetworkEvents(sock, event, &networkEvents) == SOCKET_ERROR) break;
+
+        if (networkEvents.lNetworkEvents & FD_READ) {
+            // drain everything that queued up since the last wakeup
+            int received = 0;
+            while (received < MAX_BATCH_SIZE) {
+                int senderLen = sizeof(senderAddr);
+                int recvLen = recvfrom(sock, buffer.data(), static_cast<int>(buffer.size()), 0,
+                                       (sockaddr*)&senderAddr, &senderLen);
+                if (recvLen == SOCKET_ERROR) {
+                    int error = WSAGetLastError();
+                    // a previous reply hit a closed port; keep going
+                    if (error == WSAECONNRESET) continue;
+                    if (error != WSAEWOULDBLOCK)
+                        std::cerr << "recvfrom error: " << error << std::endl;
+                    break;
+                }
+                received++;
+                metrics::add(metrics::Counter::UdpIn);
+                if (recvLen > 0 && handler) {
+                    udp::Peer peer;
+                    peer.address = ntohl(senderAddr.sin_addr.s_addr);
+                    peer.port = ntohs(senderAddr.sin_port);
+                    payload.assign(buffer.data(), buffer.data() + recvLen);
+                    TRACE_SPAN(spanName);
+                    handler(payload, peer);
+                }
+            }
+            if (received > 0 && batchEnd) batchEnd();
+        }
+        if (networkEvents.lNetworkEvents & FD_CLOSE) {
+            break;
+        }
+    }
+}
 
 namespace udp {
 
+    Status setBindAddress(const std::string& address) {
+        std::lock_guard<std::mutex> lock(initMutex);
+        return parseAddress(address, bindAddress) ? Status::Success : Status::InvalidAddress;
+    }
+
+    Status setServerAddress(const std::string& address) {
+        std::lock_guard<std::mutex> lock(initMutex);
+        return parseAddress(address, serverHostAddress) ? Status::Success : Status::InvalidAddress;
+    }
+
+    void setPacketLoss(double lossRate, uint32_t seed) {
+        if (lossRate < 0.0) lossRate = 0.0;
+        if (lossRate > 1.0) lossRate = 1.0;
+        // xorshift has no zero state
+        lossState = seed ? seed : 1;
+        lossThreshold = static_cast<uint64_t>(lossRate * 4294967296.0);
+    }
+
+    uint64_t getShimDropped() {
+        return shimDropped;
+    }
+
+    bool isLocal(const Peer& peer) {
+        return (peer.address >> 24) == 127;
+    }
+
     // Launches a background thread to run the UDP server
-    Status startServer(uint16_t serverPort, CallbackFunc callback) {
+    Status startServer(uint16_t serverPort, CallbackFunc callback, BatchEndFunc batchEnd) {
         if (!callback) {
             //_LOG("udp::startServer - callback not set!");
             return Status::CallbackNotProvided;
@@ -52,6 +175,7 @@ namespace udp {
 
 
         packetHandler = callback;
+        batchEndHandler = batchEnd;
 
         WSADATA wsaData;
 
@@ -69,7 +193,7 @@ namespace udp {
         sockaddr_in serverAddr{};
         serverAddr.sin_family = AF_INET;
         serverAddr.sin_port = htons(serverPort);
-        serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        serverAddr.sin_addr.s_addr = htonl(bindAddress);
 
         std::cout << "[UDP Server] Starting on port: " << serverPort << std::endl;
 
@@ -87,38 +211,15 @@ namespace udp {
         // add event handle to wake up recvfrom() when either:
         // - data arrives (default behaviof)
         // - the socket is closed
+        // NOTE: WSAEventSelect() also switches the socket to non-blocking
+        // mode, which is what lets the loop below drain it
         serverEvent = WSACreateEvent();
         WSAEventSelect(serverSocket, serverEvent, FD_READ | FD_CLOSE);
 
         serverRunning = true;
         serverThread = std::thread([]() {
-            char buffer[MAX_PAYLOAD_SIZE];
-            sockaddr_in clientAddr{};
-            int clientLen = sizeof(clientAddr);
-            while (serverRunning) {
-                DWORD waitResult = WSAWaitForMultipleEvents(1, &serverEvent, FALSE, 1000, FALSE);
-                if (waitResult == WSA_WAIT_FAILED) break;
-                if (waitResult == WSA_WAIT_TIMEOUT) continue;
-
-                WSANETWORKEVENTS networkEvents;
-                if (WSAEnumNetworkEvents(serverSocket, serverEvent, &networkEvents) == SOCKET_ERROR) break;
-
-                if (networkEvents.lNetworkEvents & FD_READ) {
-                    int recvLen = recvfrom(serverSocket, buffer, sizeof(buffer), 0,
-                                           (sockaddr*)&clientAddr, &clientLen);
-                    if (recvLen == SOCKET_ERROR) {
-                        std::cerr << "recvfrom error: " << WSAGetLastError() << std::endl;
-                    }
-                    std::cout << "[UDP Server] Received packet of size " << recvLen << std::endl;
-                    if (recvLen > 0 && packetHandler) {
-                        std::vector<uint8_t> payload(buffer, buffer + recvLen);
-                        packetHandler(payload);
-                    }
-                }
-                if (networkEvents.lNetworkEvents & FD_CLOSE) {
-                    break;
-                }
-            }
+            receiveLoop(serverSocket, serverEvent, serverRunning, packetHandler, batchEndHandler,
+                        "server.receive");
         });
 
         return Status::Success;
@@ -149,7 +250,7 @@ namespace udp {
         WSACleanup();
     }
 
-    Status startClient(uint16_t serverPort) {
+    Status startClient(uint16_t serverPort, CallbackFunc replyHandler) {
         std::lock_guard<std::mutex> lock(initMutex);
         if (clientSocket != INVALID_SOCKET)
             return Status::ClientAlreadyRunning;
@@ -171,20 +272,46 @@ namespace udp {
         }
         serverAddress.sin_family = AF_INET;
         serverAddress.sin_port = htons(serverPort);
-        //inet_pton(AF_INET, "127.0.0.1", &serverAddress.sin_addr);
-        serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        serverAddress.sin_addr.s_addr = htonl(serverHostAddress);
 #endif
+        if (replyHandler) {
+            // bind now so replies have somewhere to go even before the
+            // first sendto() would have bound the socket implicitly
+            sockaddr_in localAddr{};
+            localAddr.sin_family = AF_INET;
+            localAddr.sin_port = 0;
+            // replies from another host arrive on a LAN interface
+            localAddr.sin_addr.s_addr = htonl(
+                    (serverHostAddress >> 24) == 127 ? INADDR_LOOPBACK : INADDR_ANY);
+            if (bind(clientSocket, (sockaddr*)&localAddr, sizeof(localAddr)) == SOCKET_ERROR) {
+                closesocket(clientSocket);
+                clientSocket = INVALID_SOCKET;
+                WSACleanup();
+                return Status::BindFailed;
+            }
+
+            clientReplyHandler = replyHandler;
+            clientEvent = WSACreateEvent();
+            WSAEventSelect(clientSocket, clientEvent, FD_READ | FD_CLOSE);
+            clientRunning = true;
+            clientThread = std::thread([]() {
+                receiveLoop(clientSocket, clientEvent, clientRunning, clientReplyHandler, nullptr,
+                            "client.receive");
+            });
+        }
             return Status::Success;
         }
 
-        // Sends a trigger payload to a remote UDP server
+    // Sends a trigger payload to a remote UDP server; this is on the
+    // client's send path, so it does no console output
     Status send(const std::vector<uint8_t>& payload) {
         if (clientSocket == INVALID_SOCKET)
             return Status::NotInitialized;
-        char ipStr[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &serverAddress.sin_addr, ipStr, sizeof(ipStr));
-        std::cerr << "Sending to " << ipStr << ":" << ntohs(serverAddress.sin_port)
-                  << " - payload size: " << payload.size() << std::endl;
+        TRACE_SPAN("udp.send");
+        if (shimDrops()) {
+            metrics::add(metrics::Counter::UdpDropped);
+            return Status::Success;
+        }
         int result = sendto(clientSocket,
                 reinterpret_cast<const char*>(payload.data()),
                 static_cast<int>(payload.size()),
@@ -194,24 +321,54 @@ namespace udp {
         );
 
         if (result == SOCKET_ERROR) {
-            std::cerr << "error: " << WSAGetLastError() << std::endl;
+            metrics::add(metrics::Counter::UdpDropped);
             return Status::SendFailed;
         }
+        metrics::add(metrics::Counter::UdpOut);
+        return Status::Success;
+    }
 
-        std::cerr << "payload: ";
-        for (uint8_t byte : payload) {
-            std::cerr << std::hex << std::uppercase << std::setw(2) << std::setfill('0')
-                      << static_cast<int>(byte) << " ";
+    Status sendTo(const Peer& peer, const std::vector<uint8_t>& payload) {
+        if (serverSocket == INVALID_SOCKET)
+            return Status::NotInitialized;
+        TRACE_SPAN("udp.sendTo");
+        if (shimDrops()) {
+            metrics::add(metrics::Counter::UdpDropped);
+            return Status::Success;
         }
-        std::cerr << "payload (size: " << std::dec << payload.size() << " sent successfully" << std::endl;
 
+        sockaddr_in peerAddress{};
+        peerAddress.sin_family = AF_INET;
+        peerAddress.sin_port = htons(peer.port);
+        peerAddress.sin_addr.s_addr = htonl(peer.address);
+        int result = sendto(serverSocket,
+                reinterpret_cast<const char*>(payload.data()),
+                static_cast<int>(payload.size()),
+                0,
+                reinterpret_cast<sockaddr*>(&peerAddress),
+                sizeof(peerAddress)
+        );
+        if (result == SOCKET_ERROR) {
+            metrics::add(metrics::Counter::UdpDropped);
+            return Status::SendFailed;
+        }
+        metrics::add(metrics::Counter::UdpOut);
         return Status::Success;
     }
 
     void stopClient() {
+        clientRunning = false;
         if (clientSocket != INVALID_SOCKET) {
             closesocket(clientSocket);
             clientSocket = INVALID_SOCKET;
         }
+        if (clientEvent != WSA_INVALID_EVENT) {
+            WSASetEvent(clientEvent); // Wake the reply thread NOW
+            if (clientThread.joinable()) {
+                clientThread.join();
+            }
+            WSACloseEvent(clientEvent);
+            clientEvent = WSA_INVALID_EVENT;
+        }
     }
 }
@@ -14,10 +14,27 @@
 #include <string>
 #include <mutex>
 
+namespace udp {
+    /**
+     * Identifies the sender of a payload (IPv4 address and port in host
+     * byte order). Payloads that did not arrive over UDP carry a zero peer.
+     */
+    struct Peer {
+        uint32_t address = 0;
+        uint16_t port = 0;
+    };
+}
+
 /**
  * Defines the function pointer type used for receiving raw UDP payloads.
  */
-using CallbackFunc = void(*)(const std::vector<uint8_t>& payload);
+using CallbackFunc = void(*)(const std::vector<uint8_t>& payload, const udp::Peer& peer);
+
+/**
+ * Defines the function pointer type called once after each batch of
+ * payloads received in a single wakeup has been handed to CallbackFunc.
+ */
+using BatchEndFunc = void(*)(void);
 
 
 
@@ -32,16 +49,61 @@ namespace udp {
         CallbackNotProvided,
         ServerAlreadyRunning,
         ClientAlreadyRunning,
-        NotInitialized
+        NotInitialized,
+        InvalidAddress
     };
 
+    /**
+     * Sets the address the server binds to (default: 127.0.0.1). Other
+     * hosts can only reach the server if this is not the loopback address.
+     * Takes effect on the next startServer().
+     *
+     * @param address An IPv4 address in dotted form, e.g. "0.0.0.0".
+     * @return Status::Success if the address was set.
+     *         Status::InvalidAddress if it could not be parsed.
+     */
+    Status setBindAddress(const std::string& address);
+
+    /**
+     * Sets the address of the server the client sends to (default:
+     * 127.0.0.1). Takes effect on the next startClient().
+     *
+     * @param address An IPv4 address in dotted form.
+     * @return Status::Success if the address was set.
+     *         Status::InvalidAddress if it could not be parsed.
+     */
+    Status setServerAddress(const std::string& address);
+
+    /**
+     * Test shim: drops the given fraction of outgoing datagrams of both the
+     * client and the server at random, so loss handling can be exercised on
+     * loopback. A dropped datagram still reports Status::Success.
+     *
+     * @param lossRate 0.0 (default, no loss) to 1.0.
+     * @param seed     Seed of the drop sequence.
+     */
+    void setPacketLoss(double lossRate, uint32_t seed = 1);
+
+    /**
+     * Returns the number of datagrams dropped by the setPacketLoss() shim.
+     */
+    uint64_t getShimDropped();
+
+    /**
+     * Returns true if the peer is on this host (a loopback address).
+     */
+    bool isLocal(const Peer& peer);
+
 
     /**
      * Starts a UDP server on the specified port and sets a callback to
      * handle incoming packets.
+     * Every wakeup drains all pending datagrams (up to a bounded batch),
+     * calls the callback for each of them and then calls batchEnd once.
      *
      * @param serverPort The port to listen on.
-     * @param callback   A function that receives the raw byte payload of each packet.
+     * @param callback   A function that receives the raw byte payload and the sender of each packet.
+     * @param batchEnd   (optional) Called after each drained batch.
      * @return Status::Success if the server started successfully.
      *         Status::WSAStartupFailed if Winsock initialization failed.
      *         Status::SocketCreationFailed if the server socket could not be created.
@@ -49,17 +111,21 @@ namespace udp {
      *         Status::CallbackNotProvided if no callback function was supplied.
      *         Status::ServerAlreadyRunning if the server is already running.
      */
-    Status startServer(uint16_t serverPort, CallbackFunc callback);
+    Status startServer(uint16_t serverPort, CallbackFunc callback, BatchEndFunc batchEnd = nullptr);
 
     /**
      * Starts the UDP client and initializes the destination address for sending packets.
+     * If a reply handler is given, the client socket is bound right away and a
+     * background thread hands every datagram sent back by the server to it.
      *
      * @param serverPort      The destination server's port.
+     * @param replyHandler    (optional) Receives the server's replies.
      * @return Status::Success if initialized successfully.
      *         Status::SocketCreationFailed if the client socket couldn't be created.
+     *         Status::BindFailed if the client socket couldn't be bound for replies.
      *         Status::ClientAlreadyRunning if already initialized.
      */
-    Status startClient(uint16_t serverPort);
+    Status startClient(uint16_t serverPort, CallbackFunc replyHandler = nullptr);
 
     /**
      * Sends a UDP packet to the pre-initialized server from startClient().
@@ -71,6 +137,18 @@ namespace udp {
      */
     Status send(const std::vector<uint8_t>& payload);
 
+    /**
+     * Sends a UDP packet from the server socket to a peer (e.g. a reply to
+     * the sender of a received payload).
+     *
+     * @param peer    The destination, as handed to the server callback.
+     * @param payload A vector containing the raw data to send.
+     * @return Status::Success if the packet was sent successfully.
+     *         Status::NotInitialized if the server is not running.
+     *         Status::SendFailed if the send operation failed.
+     */
+    Status sendTo(const Peer& peer, const std::vector<uint8_t>& payload);
+
     /**
      * Stops the currently running UDP server.
      * Has no effect if the server is not running.
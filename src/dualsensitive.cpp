@@ -11,6 +11,14 @@
 #include <logger.h>
 #include <dualsensitive.h>
 #include <udp.h>
+#include <shm.h>
+#include <protocol.h>
+#include <procwatch.h>
+#include <lockfree.h>
+#include <metrics.h>
+#include <trace.h>
+#include <recorder.h>
+#include <alloc.h>
 
 #include <Windows.h>
 
@@ -22,76 +30,82 @@
 #include <Helpers.h>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #define DEVICE_ENUM_INFO_SZ 16
 #define CONTROLLER_LIMIT 16
-#define TRIGGER_INDEX 0
-#define PROFILE_INDEX 1
-#define EXTRAS_SIZE_INDEX 2
-#define MIN_PAYLOAD_SIZE 3
-#define PAYLOAD_TYPE_SIZE 1
-#define PID_SIZE 4
-#define EXTRAS_BUFFER_INDEX 3
 
 // for the retry logic used for connecting to the controller
 #define MAX_RETRIES 5
 #define RETRY_DELAY_MS 500
+// a disconnected controller logs each of its messages at most this often
+#define DISCONNECT_LOG_INTERVAL_MS 5000
+
+// acknowledgement tracking in CLIENT mode
+#define ACK_WINDOW 1024 // sends tracked at once, must be a power of two
+#define RTT_WINDOW 512  // most recent RTT samples kept for percentiles
+#define ACK_TIMEOUT_MS 1000
+
+// an update equal to the setting last sent for its trigger is still sent
+// once this long after that send, in case the send got lost
+#define SHADOW_REFRESH_MS 1000
+
+// client sessions tracked by the service at once
+#define MAX_SESSIONS 16
+
+// input streaming to subscribed clients
+#define MAX_INPUT_RATE_HZ 1000
+#define INPUT_KEYFRAME_INTERVAL_MS 1000
+#define JITTER_BUFFER_SLOTS 64 // snapshots waiting for playout in network mode
+
+// commands with a deadline: timer wheel of 1 ms slots on the service; the
+// writer sleeps until this long before a deadline and yields from there on,
+// since a sleep may overshoot by a scheduler tick
+#define WHEEL_SLOTS 256 // must be a power of two
+#define WHEEL_TICK_NS 1000000LL
+#define SCHEDULE_SPIN_NS 2000000LL
+// a session may have this many commands waiting, none of them due further
+// ahead than this; the service rejects the rest
+#define MAX_SCHEDULED_PER_SESSION 64
+#define MAX_SCHEDULE_AHEAD_MS 10000
+
+// interval of the HELLO probes sent by waitForService()
+#define HELLO_RETRY_MS 10
+// interval of the HELLO probes sent along with TRIGGER payloads until the
+// service has shown it takes COMMAND payloads
+#define COMMAND_PROBE_INTERVAL_MS 1000
+// network mode: interval of the HELLOs that keep a client's session alive
+#define NETWORK_KEEPALIVE_MS 1000
+
+// CLIENT mode send queue
+#define DEFAULT_SEND_QUEUE_CAPACITY 64
+// overflow buffers per trigger under QueuePolicy::COALESCE; a producer
+// would have to lap them all while the sender copies one to tear it
+#define OVERFLOW_BUFFERS 4
+
+// actuation probe, see setActuationProbe()
+#define ACTUATION_WINDOW 1024 // most recent latencies kept per connection
+#define ACTUATION_TIMEOUT_MS 250
 
 // utils
 
-enum class Trigger : uint8_t {
-    Left = 0,
-    Right = 1
-};
-
-
-std::vector<uint8_t> serializeBindPayload(uint32_t pid) {
-    std::vector<uint8_t> buffer;
-    buffer.push_back(static_cast<uint8_t>(PayloadType::BIND));  // 1 byte
-    buffer.push_back((pid >>  0) & 0xFF);
-    buffer.push_back((pid >>  8) & 0xFF);
-    buffer.push_back((pid >> 16) & 0xFF);
-    buffer.push_back((pid >> 24) & 0xFF);
-    return buffer;
-}
-
-bool deserializeBindPayload(const std::vector<uint8_t>& buffer, uint32_t& pid) {
-
-    if (buffer.size() < PID_SIZE) {
-        ERROR_PRINT("Bind PID payload too small!");
-        return false;
-    }
-    pid = (buffer[0]) | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24);
-    INFO_PRINT("Bound to client PID: " << pid);
-    return true;
-}
-
-std::vector<uint8_t> serializeTriggerPayload(Trigger trigger, TriggerProfile profile, const std::vector<uint8_t>& extras) {
-    std::vector<uint8_t> buffer;
-    buffer.push_back(static_cast<uint8_t>(PayloadType::TRIGGER));   // 1 byte
-    buffer.push_back(static_cast<uint8_t>(trigger));                // 1 byte
-    buffer.push_back(static_cast<int8_t>(profile));                 // 1 byte
-    buffer.push_back(static_cast<uint8_t>(extras.size()));          // 1 byte
-    buffer.insert(buffer.end(), extras.begin(), extras.end());      // extras
-    return buffer;
+// monotonic clock in nanoseconds; steady_clock is QPC based on Windows, so
+// timestamps of the client and the service are comparable on one machine
+int64_t monotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-bool deserializeTriggerPayload(const std::vector<uint8_t>& buffer, Trigger& trigger, TriggerProfile& profile, std::vector<uint8_t>& extras) {
-    if (buffer.size() < MIN_PAYLOAD_SIZE) {
-        ERROR_PRINT("buffer size less than expected!");
-        return false;
-    }
-    trigger = static_cast<Trigger>(buffer[TRIGGER_INDEX]);
-    profile = static_cast<TriggerProfile>(static_cast<int8_t>(buffer[PROFILE_INDEX]));
-    uint8_t extrasSize = buffer[EXTRAS_SIZE_INDEX];
-
-    if (buffer.size() < EXTRAS_BUFFER_INDEX + extrasSize) {
-        ERROR_PRINT("extras found corrupted!");
-        return false;
-    }
-
-    extras.assign(buffer.begin() + EXTRAS_BUFFER_INDEX, buffer.begin() + EXTRAS_BUFFER_INDEX + extrasSize);
-    return true;
+// nearest-rank percentile of an already sorted vector
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0.0;
+    return sorted[static_cast<size_t>(p / 100.0 * (sorted.size() - 1))];
 }
 
 std::string wstring_to_utf8(const std::wstring& ws) {
@@ -114,7 +128,7 @@ int scanControllers(std::vector<DS5W::DeviceEnumInfo>& infosVector) {
     );
 
     if (controllersCount == 0) {
-        ERROR_PRINT("No DualSense controllers found!");
+        ERROR_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS, "No DualSense controllers found!");
         return -1;
     }
 
@@ -137,542 +151,2188 @@ int scanControllers(std::vector<DS5W::DeviceEnumInfo>& infosVector) {
     return 0;
 }
 
-#define TRIGGER_BUFFER_SZ 11
 
+namespace dualsensitive {
 
-// inner function to be callse by processTriggerSetting() in DS5_Output.cpp
-void setTriggerProfile(unsigned char *buffer, TriggerProfile profile, std::vector<uint8_t> extras) {
-    int lastIdx = 0;
-    switch (profile) {
-        case TriggerProfile::GameCube:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse);
-            buffer[1] = 144;
-            buffer[2] = 160;
-            buffer[3] = 255;
-            lastIdx = 3;
-            break;
-        case TriggerProfile::VerySoft:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse);
-            buffer[1] = 128;
-            buffer[2] = 160;
-            buffer[3] = 255;
-            lastIdx = 3;
-            break;
-        case TriggerProfile::Soft:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-            buffer[1] = 69;
-            buffer[2] = 160;
-            buffer[3] = 255;
-            lastIdx = 3;
-            break;
-        case TriggerProfile::Medium:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_A);
-            buffer[1] = 2;
-            buffer[2] = 35;
-            buffer[3] = 1;
-            buffer[4] = 6;
-            buffer[5] = 6;
-            buffer[6] = 1;
-            buffer[7] = 33;
-            lastIdx = 7;
-            break;
-        case TriggerProfile::Hard:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-            buffer[1] = 32;
-            buffer[2] = 160;
-            buffer[3] = 255;
-            buffer[4] = 255;
-            buffer[5] = 255;
-            buffer[6] = 255;
-            buffer[7] = 255;
-            lastIdx = 7;
-            break;
-        case TriggerProfile::VeryHard:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-            buffer[1] = 16;
-            buffer[2] = 160;
-            buffer[3] = 255;
-            buffer[4] = 255;
-            buffer[5] = 255;
-            buffer[6] = 255;
-            buffer[7] = 255;
-            lastIdx = 7;
-            break;
-        case TriggerProfile::Hardest:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse);
-            buffer[1] = 0;
-            buffer[2] = 255;
-            buffer[3] = 255;
-            buffer[4] = 255;
-            buffer[5] = 255;
-            buffer[6] = 255;
-            buffer[7] = 255;
-            lastIdx = 7;
-            break;
-        case TriggerProfile::Rigid:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid);
-            buffer[1] = 0;
-            buffer[2] = 255;
-            buffer[3] = 0;
-            lastIdx = 3;
-            break;
-        case TriggerProfile::Choppy:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-            buffer[1] = 2;
-            buffer[2] = 39;
-            buffer[3] = 33;
-            buffer[4] = 39;
-            buffer[5] = 38;
-            buffer[6] = 2;
-            lastIdx = 6;
-            break;
-        case TriggerProfile::VibrateTrigger:
-        case TriggerProfile::VibrateTriggerPulse:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_AB);
-            buffer[1] = 37;
-            buffer[2] = 35;
-            buffer[3] = 6;
-            buffer[4] = 39;
-            buffer[5] = 33;
-            buffer[6] = 35;
-            buffer[7] = 34;
-            lastIdx = 7;
-            break;
-        case TriggerProfile::VibrateTrigger10Hz:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_B);
-            buffer[1] = 10;
-            buffer[2] = 255;
-            buffer[3] = 40;
-            lastIdx = 3;
-            break;
-        case TriggerProfile::Bow:
-            {
-                uint8_t start = extras[0];
-                uint8_t end = extras[1];
-                uint8_t force = extras[2];
-                uint8_t snapForce = extras[3];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_A);
-                if (start <= 8 && end <= 8 && start < end && force <= 8 && snapForce <= 8 && end > 0 && force > 0 && snapForce > 0) {
-                    uint16_t num = static_cast<uint16_t>((1 << start) | (1 << end));
-                    uint32_t num2 = static_cast<uint32_t>(((force - 1) & 7) | (((snapForce - 1) & 7) << 3));
-                    buffer[1] = static_cast<unsigned char>(num & 0xFF);
-                    buffer[2] = static_cast<unsigned char>((num >> 8) & 0xFF);
-                    buffer[3] = static_cast<unsigned char>(num2 & 0xFF);
-                    buffer[4] = static_cast<unsigned char>((num2 >> 8) & 0xFF);
-                    lastIdx = 4;
-                }
+    // These control the active mode
+    static AgentMode agentMode = AgentMode::SOLO;
+    static uint16_t udpPort = 28472;
+    static Transport transport = Transport::UDP;
+    // true once the CLIENT has claimed the service's shared-memory ring
+    static bool shmActive = false;
+    // a record that found the ring full went over UDP, after a BIND that
+    // ties the UDP socket to the ring's session (under clientStateMutex)
+    static bool shmFallbackBound = false;
+    static std::mutex initMutex;
+    static bool hasInit = false;
+    // only if enabled is true, the DualSense settings will be sent to
+    // controller
+    static std::mutex enabledMutex;
+    static bool enabled = true;
+    static std::mutex clientPidMutex;
+    static uint32_t clientPid;
+    static std::atomic<ClientExitFunc> clientExitCallback = nullptr;
+    // SERVER mode state reported in READY payloads; the controller link is
+    // updated by whichever thread last did device I/O
+    static std::atomic<ControllerConnection> controllerLink = ControllerConnection::None;
+    static std::atomic<bool> shmServing = false;
+
+    // SERVER mode: the UDP and shared-memory receive threads post commands
+    // to a latest-wins mailbox with one slot per trigger; a dedicated writer
+    // thread takes the slots and does the device I/O, so a slow or
+    // disconnected controller never holds up the sockets
+    // (all under mailboxMutex)
+    struct MailboxSlot {
+        bool full = false;
+        TriggerProfile profile = TriggerProfile::Normal;
+        uint8_t extrasSize = 0;
+        uint8_t extras[TRIGGER_EXTRAS_MAX];
+    };
+    struct PendingAck {
+        udp::Peer peer;
+        uint32_t sequence;
+        int64_t receivedNs;
+        // reported instead of the write's outcome unless Applied
+        ApplyResult result = ApplyResult::Applied;
+    };
+    static std::mutex mailboxMutex;
+    static std::condition_variable mailboxCondition; // wakes the writer
+    static std::condition_variable writtenCondition; // wakes flushMailbox()
+    static MailboxSlot mailbox[2];
+    // acknowledgements owed once the mailbox contents are written
+    static std::vector<PendingAck> mailboxAcks;
+    static bool writeRequested = false;
+    static uint64_t requestedGeneration = 0;
+    static uint64_t writtenGeneration = 0;
+    static bool writerRunning = false;
+    static std::thread writerThread;
+
+    // SERVER mode: one session per client, each with its own staged trigger
+    // settings and a priority. Every trigger follows the highest priority
+    // session that has set it, and only changes of that resolved state
+    // reach the mailbox (all under mailboxMutex)
+    struct SessionTrigger {
+        bool set = false;
+        TriggerProfile profile = TriggerProfile::Normal;
+        std::vector<uint8_t> extras;
+        uint64_t stamp = 0; // orders updates of sessions with equal priority
+    };
+    struct Session {
+        udp::Peer peer;     // UDP sender, zero for ring-only clients
+        uint32_t pid = 0;   // from BIND or the ring's producer, 0 if unknown
+        uint8_t priority = 0;
+        uint64_t lastActive = 0;
+        SessionTrigger triggers[2];
+        // input streaming, see PayloadType::SUBSCRIBE
+        uint16_t inputRateHz = 0;
+        int64_t nextInputNs = 0;
+        int64_t lastKeyframeNs = 0;
+        uint32_t inputSequence = 0;
+        bool keyframeNeeded = true;
+        uint8_t lastInput[PACKED_INPUT_SIZE] = {};
+        uint8_t inputFlags = 0;     // SubscribeFlags
+        uint8_t inputRepeats = 0;   // copies of each new snapshot
+        uint8_t repeatsLeft = 0;
+        // newest unscheduled COMMAND sequence applied, so copies (network
+        // mode) and commands overtaken on the other transport (ring
+        // fallback) are dropped
+        bool commandSeen = false;
+        uint32_t lastCommandSequence = 0;
+        // token bucket, see setSessionRateLimit(); over-budget updates wait
+        // in pending, newest per trigger, until a token is back
+        double tokens = 0.0;
+        int64_t refilledNs = 0;
+        bool deferred = false;
+        SessionTrigger pending[2];
+        std::vector<PendingAck> deferredAcks;
+        uint64_t updates = 0;
+        uint64_t throttled = 0;
+        uint64_t deferredWrites = 0;
+        // commands of this session waiting in the timer wheel
+        size_t scheduled = 0;
+        uint64_t scheduleRejected = 0;
+        // network mode: the client presented the token, and is dropped
+        // once silent for sessionTimeoutMs
+        bool networked = false;
+        int64_t lastHeardNs = 0;
+    };
+    static std::vector<Session> sessions;
+    // PIDs of sessions dropped to make room; the writer stops watching
+    // them outside mailboxMutex, which their exit callbacks take
+    static std::vector<uint32_t> evictedPids;
+    static uint64_t sessionClock = 0;
+    // input reads published to shared memory besides the subscribers'
+    // see setInputPublishing()
+    static uint16_t publishRateHz = 0;
+    static int64_t nextPublishNs = 0;
+    static std::atomic<bool> inputPublished = false;
+    // token bucket of every session; a rate of 0 means no limit
+    static double sessionRate = 0.0;
+    static double sessionBurst = 1.0;
+    // state last handed to the writer; set is false while unknown
+    static SessionTrigger resolved[2];
+
+    // SERVER mode: commands sent with COMMAND_APPLY_AT wait in a hashed
+    // timer wheel, one slot per millisecond; a slot holds every command due
+    // in a tick congruent to it, so deadlines beyond one turn just stay in
+    // their slot until a later pass (all under mailboxMutex)
+    struct ScheduledCommand {
+        udp::Peer peer;
+        uint32_t pid;
+        int64_t applyAtNs;
+        int64_t receivedNs;
+        uint32_t sequence;
+        bool ackRequested;
+        std::vector<TriggerCommand> commands;
+    };
+    static std::vector<ScheduledCommand> wheel[WHEEL_SLOTS];
+    static int64_t wheelTick = 0;   // next tick to visit
+    static size_t scheduledCount = 0;
+    static int64_t nextDeadlineNs = INT64_MAX;
+
+    // CLIENT mode: sequence numbers and acknowledgement bookkeeping
+    struct PendingSend {
+        uint32_t sequence;
+        int64_t sentNs;
+        int64_t applyAtNs; // deadline on the service's clock, 0 if none
+        bool waiting;
+    };
+    // CLIENT mode: input state streamed by the service (under inputMutex)
+    static std::mutex inputMutex;
+    static uint8_t receivedInput[PACKED_INPUT_SIZE];
+    static bool inputValid = false;
+    static uint32_t lastInputSequence = 0;
+    static std::atomic<InputStateFunc> inputCallback = nullptr;
+
+    // CLIENT mode: set by a READY with READY_COMMANDS, or by claiming the
+    // ring, which only such a service creates; until then a service that
+    // predates COMMAND payloads is assumed (see sendTriggerPayloads())
+    static std::atomic<bool> commandsSupported = false;
+    static int64_t lastCommandProbeNs = 0;
+
+    static std::atomic<uint8_t> sessionPriority = 0;
+    static std::atomic<bool> acksRequested = false;
+    static std::atomic<uint32_t> nextSequence = 1;
+    static std::mutex linkMutex;
+    static PendingSend pendingSends[ACK_WINDOW];
+    static double rttSamplesUs[RTT_WINDOW];
+    static double serviceSamplesUs[RTT_WINDOW];
+    static size_t rttSampleCount = 0;
+    static double scheduleSamplesUs[RTT_WINDOW];
+    static size_t scheduleSampleCount = 0;
+    static int64_t lastAckNs = 0;
+    static int64_t lastExpiryNs = 0;
+    static LinkStats linkStats;
+
+    // CLIENT mode: per-trigger shadow of the setting last sent to the
+    // service and of the change not sent yet (under clientStateMutex)
+    struct TriggerShadow {
+        bool known = false;  // something was sent for this trigger
+        bool dirty = false;  // staged differs from sent
+        int64_t sentNs = 0;
+        TriggerProfile sentProfile = TriggerProfile::Normal;
+        std::vector<uint8_t> sentExtras;
+        TriggerProfile stagedProfile = TriggerProfile::Normal;
+        std::vector<uint8_t> stagedExtras;
+    };
+    static std::mutex clientStateMutex;
+    static TriggerShadow shadows[2];
+    // set when the service may not hold what the shadows say it does: it
+    // answered a HELLO (it may have restarted), a send went unacknowledged
+    // or was not applied; taken by the next stageClientTrigger()
+    static std::atomic<bool> shadowsStale = false;
+    // accepted updates since the last flush
+    static uint32_t stagedUpdates = 0;
+    static std::chrono::steady_clock::time_point flushDeadline;
+    static std::atomic<uint32_t> coalesceWindowMs = 0;
+    static uint64_t suppressedSends = 0;
+    static uint64_t coalescedSends = 0;
+
+    // CLIENT mode: the trigger setters only put updates into a lock-free
+    // queue; the sender thread takes them, runs the dedup and coalescing
+    // above and does the sends. It parks on the senderWake auto-reset
+    // event, which producers only signal while it is parked. With a single
+    // producer thread an update is handed over in a bounded number of
+    // steps, whatever the sender is doing (except under QueuePolicy::BLOCK)
+    struct QueuedTrigger {
+        Trigger trigger;
+        TriggerProfile profile;
+        uint8_t extrasSize;
+        uint8_t extras[TRIGGER_EXTRAS_MAX];
+        int64_t applyAtNs; // on our clock, 0 unless scheduled
+    };
+    static size_t sendQueueCapacity = DEFAULT_SEND_QUEUE_CAPACITY;
+    static QueuePolicy sendQueuePolicy = QueuePolicy::COALESCE;
+    static std::atomic<QueueSaturationFunc> saturationCallback = nullptr;
+    static std::unique_ptr<lockfree::BoundedQueue<QueuedTrigger>> sendQueue;
+    static std::thread senderThread;
+    static std::atomic<bool> senderRunning = false;
+    static std::atomic<bool> senderParked = false;
+    static HANDLE senderWake = NULL;
+    static std::atomic<bool> flushRequested = false;
+    static std::atomic<bool> queueSaturated = false;
+    // QueuePolicy::COALESCE: newest update per trigger while the queue is
+    // full; until the sender takes them, later updates land here too so
+    // they cannot overtake them. A producer claims a ticket, writes the
+    // buffer it picks under a seqlock version (odd while written) and
+    // publishes ticket + 1 to the trigger's latest with one exchange
+    struct OverflowBuffer {
+        std::atomic<uint64_t> version{0};
+        QueuedTrigger item;
+    };
+    struct OverflowSlot {
+        std::atomic<uint64_t> tickets{0};
+        std::atomic<uint64_t> latest{0};    // newest ticket + 1, 0 if taken
+        OverflowBuffer buffers[OVERFLOW_BUFFERS];
+    };
+    static std::atomic<bool> overflowPending = false;
+    static OverflowSlot overflow[2];
+    static std::atomic<uint64_t> queueDropped = 0;
+    static std::atomic<uint64_t> queueMerged = 0;
+    static std::atomic<uint64_t> queueBlocked = 0;
+    static std::atomic<uint32_t> queueHighWater = 0;
+
+    // CLIENT mode: clock offset estimate; one syncClock() exchange is in
+    // flight at a time (under clockMutex)
+    static std::mutex clockMutex;
+    static std::condition_variable clockCondition;
+    static uint32_t nextSyncId = 1;
+    static uint32_t awaitedSyncId = 0;
+    static bool syncAnswered = false;
+    static int64_t syncOffsetNs = 0;
+    static int64_t syncDelayNs = 0;
+    static std::atomic<int64_t> clockOffsetNs = 0;
+    static std::atomic<int64_t> clockSyncDelayNs = -1;
+
+    // CLIENT mode: readiness handshake of waitForService() (under readyMutex)
+    static std::mutex readyMutex;
+    static std::condition_variable readyCondition;
+    static uint32_t awaitedHelloNonce = 0;
+    static bool readyAnswered = false;
+    static ReadyPayload lastReady;
+
+    // CLIENT mode: one getServiceMetrics() request in flight at a time
+    // (under statsMutex)
+    static std::mutex statsMutex;
+    static std::condition_variable statsCondition;
+    static uint32_t nextStatsId = 1;
+    static uint32_t awaitedStatsId = 0;
+    static bool statsAnswered = false;
+    static std::string statsText;
+
+    // network streaming, see setNetworkMode()
+    static bool networkStreaming = false;
+    static NetworkOptions networkOptions;
+    // SERVER mode: commands dropped as copies or overtaken
+    // (under mailboxMutex)
+    static uint64_t staleCommands = 0;
+    // CLIENT mode: copies of the last full-state packet still to send
+    // (under clientStateMutex)
+    static std::vector<uint8_t> redundantPayload;
+    static uint8_t redundantLeft = 0;
+    static std::chrono::steady_clock::time_point redundantDeadline;
+    static std::chrono::steady_clock::time_point keepaliveDeadline;
+    static std::atomic<uint64_t> fullStateSent = 0;
+    // CLIENT mode: snapshots waiting in the jitter buffer, played out by
+    // their own thread, and the receive statistics (under inputMutex)
+    struct BufferedInput {
+        int64_t playoutNs;
+        uint8_t packed[PACKED_INPUT_SIZE];
+    };
+    static BufferedInput jitterBuffer[JITTER_BUFFER_SLOTS];
+    static size_t jitterHead = 0;
+    static size_t jitterCount = 0;
+    static std::condition_variable playoutCondition;
+    static std::thread playoutThread;
+    static bool playoutRunning = false;
+    static bool streamStarted = false;
+    static uint32_t firstStreamSequence = 0;
+    static int64_t minTransitNs = INT64_MAX;
+    static int64_t lastTransitNs = 0;
+    static double transitJitterNs = 0.0;
+    static double streamLatencyUs[RTT_WINDOW];
+    static size_t streamLatencyCount = 0;
+    static StreamStats streamStats;
+
+    // support a single controller for now (on SOLO and SERVER modes only)
+    DS5W::DeviceContext controller;
+    // structure to keep the state to send out to controller
+    // (on SOLO and CLIENT modes only)
+    DS5W::DS5OutputState outState;
+
+    // actuation probe: the thread that owns the device arms it on each
+    // write that changes a trigger setting, and every input report read
+    // after that is checked for a change of the trigger feedback bytes
+    // (all under actuationMutex)
+    struct ActuationProbe {
+        bool armed = false;
+        int64_t writeNs = 0;
+        size_t link = 0;                // 0 USB, 1 Bluetooth
+        uint8_t feedback[2] = {};       // left, right, before the write
+    };
+    struct ActuationLink {
+        ActuationStats stats;
+        double latencyUs[ACTUATION_WINDOW];
+        size_t count = 0;
+    };
+    static std::atomic<bool> actuationEnabled = false;
+    static std::mutex actuationMutex;
+    static ActuationProbe actuationProbe;
+    static bool feedbackKnown = false;
+    static uint8_t lastFeedback[2] = {};
+    static ActuationLink actuationLinks[2];
+    // trigger settings of the last write, to tell which writes change them
+    static DS5W::TriggerSetting writtenTriggers[2];
+
+    bool sameTriggerSetting(const DS5W::TriggerSetting& a, const DS5W::TriggerSetting& b) {
+        return a.profile == b.profile && a.extrasSize == b.extrasSize
+            && memcmp(a.extras, b.extras, a.extrasSize) == 0;
+    }
+
+    // checks one input report against the armed probe
+    void observeFeedback(const DS5W::DS5InputState& state, int64_t readNs) {
+        std::lock_guard<std::mutex> lock(actuationMutex);
+        uint8_t feedback[2] = { state.leftTriggerFeedback, state.rightTriggerFeedback };
+        feedbackKnown = true;
+        memcpy(lastFeedback, feedback, sizeof(feedback));
+        ActuationProbe& probe = actuationProbe;
+        if (!probe.armed)
+            return;
+        ActuationLink& link = actuationLinks[probe.link];
+        int64_t latencyNs = readNs - probe.writeNs;
+        if (memcmp(feedback, probe.feedback, sizeof(feedback)) != 0) {
+            probe.armed = false;
+            link.stats.measured++;
+            link.latencyUs[link.count++ % ACTUATION_WINDOW] = latencyNs / 1000.0;
+            metrics::observe(probe.link ? metrics::Histogram::ActuationBt
+                    : metrics::Histogram::ActuationUsb, latencyNs);
+        } else if (latencyNs > ACTUATION_TIMEOUT_MS * 1000000LL) {
+            probe.armed = false;
+            link.stats.timeouts++;
+        }
+    }
+
+    // controller report rate: reports sent (read or dropped) over at least a
+    // second of its sensor clock, by the thread that owns the device
+    static uint64_t rateReports = 0;
+    static uint64_t rateIntervalUs = 0;
+
+    // feeds the sequence fields of one report read into the metrics
+    void observeInputSequence(const DS5W::DS5InputState& state) {
+        // first report after a (re)connect, or a controller without a sensor clock
+        if (!state.reportIntervalUs)
+            return;
+        metrics::observe(metrics::Histogram::InputReportInterval, state.reportIntervalUs * 1000LL);
+        metrics::set(metrics::Gauge::InputReportJitter, state.reportJitterUs);
+        // the counter may have wrapped before the report period was known,
+        // so the drop count of this read is a guess
+        if (state.reportsAliased)
+            return;
+        if (state.reportsDropped)
+            metrics::add(metrics::Counter::InputReportsDropped, state.reportsDropped);
+        rateReports += 1 + state.reportsDropped;
+        rateIntervalUs += state.reportIntervalUs;
+        if (rateIntervalUs >= 1000000) {
+            metrics::set(metrics::Gauge::InputReportRate,
+                    static_cast<int64_t>(rateReports * 1000000 / rateIntervalUs));
+            rateReports = 0;
+            rateIntervalUs = 0;
+        }
+    }
+
+    // reads one input report, counted in the metrics
+    bool readInputReport(DS5W::DS5InputState& state) {
+        bool read;
+        {
+            metrics::ScopedTimer timer(metrics::Histogram::InputRead);
+            read = DS5W_SUCCESS(DS5W::getDeviceInputState(&controller, &state));
+        }
+        metrics::add(read ? metrics::Counter::InputReads : metrics::Counter::InputReadFailures);
+        if (read)
+            observeInputSequence(state);
+        if (read && actuationEnabled.load(std::memory_order_relaxed))
+            observeFeedback(state, monotonicNs());
+        return read;
+    }
+
+    // arms the probe if the write that just went out at writeNs changed a
+    // trigger setting; returns true if it did
+    bool armActuation(int64_t writeNs) {
+        std::lock_guard<std::mutex> lock(actuationMutex);
+        bool changed = false;
+        const DS5W::TriggerSetting* settings[2] = {
+            &outState.leftTriggerSetting, &outState.rightTriggerSetting
+        };
+        for (uint8_t i = 0; i < 2; i++) {
+            if (!sameTriggerSetting(*settings[i], writtenTriggers[i])) {
+                writtenTriggers[i] = *settings[i];
+                changed = true;
             }
-            break;
-        case TriggerProfile::Resistance:
+        }
+        // the feedback before the write is the reference
+        if (!changed || !feedbackKnown)
+            return false;
+        ActuationProbe& probe = actuationProbe;
+        if (probe.armed)
+            actuationLinks[probe.link].stats.superseded++;
+        probe.armed = true;
+        probe.writeNs = writeNs;
+        probe.link = controller._internal.connection == DS5W::DeviceConnection::BT ? 1 : 0;
+        memcpy(probe.feedback, lastFeedback, sizeof(lastFeedback));
+        actuationLinks[probe.link].stats.probes++;
+        return true;
+    }
+
+    // SOLO mode: reads the controller until the armed probe has seen the
+    // feedback change or timed out
+    void awaitActuation(void) {
+        DS5W::DS5InputState state;
+        while (true) {
             {
-                uint8_t start = extras[0];
-                uint8_t force = extras[1];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-                if (start <= 9 && force <= 8 && force > 0) {
-                    uint8_t b = (force - 1) & 7;
-                    uint32_t num = 0; uint16_t num2 = 0;
-                    for (int i = static_cast<int>(start); i < 10; ++i) {
-                        num |= (b << (3 * i));
-                        num2 |= (1 << i);
-                    }
-                    buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                    buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                    buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                    buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                    lastIdx = 6;
-                }
+                std::lock_guard<std::mutex> lock(actuationMutex);
+                if (!actuationProbe.armed)
+                    return;
             }
-            break;
-        case TriggerProfile::Galloping:
-            {
-                uint8_t start = extras[0];
-                uint8_t end = extras[1];
-                uint8_t firstFoot = extras[2];
-                uint8_t secondFoot = extras[3];
-                uint8_t frequency = extras[4];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_A2);
-                if (start <= 8 && end <= 9 && start < end && secondFoot <= 7 && firstFoot <= 6 && firstFoot < secondFoot && frequency > 0) {
-                    uint16_t mask = (1 << start) | (1 << end);
-                    uint32_t f = (secondFoot & 7) | ((firstFoot & 7) << 3);
-                    buffer[1] = static_cast<uint8_t>(mask & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((mask >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(f);
-                    buffer[4] = frequency;
-                    lastIdx = 4;
-                }
+            if (!readInputReport(state))
+                break;
+        }
+        // the controller is gone; the probe can only time out
+        std::lock_guard<std::mutex> lock(actuationMutex);
+        if (actuationProbe.armed) {
+            actuationProbe.armed = false;
+            actuationLinks[actuationProbe.link].stats.timeouts++;
+        }
+    }
+
+    bool isConnected(void) {
+        if (agentMode == AgentMode::CLIENT) {
+            ERROR_PRINT("Not applicable in CLIENT mode");
+            return false;
+        }
+        DS5W::DS5InputState inState;
+        return readInputReport(inState);
+    }
+
+    // caches the controller's link for READY payloads; call after device I/O
+    void updateControllerLink(void) {
+        if (!controller._internal.connected) {
+            controllerLink = ControllerConnection::None;
+            return;
+        }
+        controllerLink = controller._internal.connection == DS5W::DeviceConnection::BT
+            ? ControllerConnection::Bluetooth : ControllerConnection::USB;
+    }
+
+    uint32_t getClientPid(void) {
+        std::lock_guard<std::mutex> lock(clientPidMutex);
+        return clientPid;
+    }
+
+    // XXX This should be called in a block where the initMutex lock has been acquired
+    Status connectToController() {
+        std::vector<DS5W::DeviceEnumInfo> controllersInfo;
+
+        Status status;
+        for (int attempt = 0; attempt < MAX_RETRIES; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY_MS));
+            DEBUG_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS,
+                "Device disconnected! Attempt " << (attempt+1) << " to reconnect...");
+
+            if (scanControllers(controllersInfo) != 0) {
+                status = Status::NoControllersDetected;
+                continue;
             }
-            break;
-        case TriggerProfile::Machine:
-            {
-                uint8_t start = extras[0];
-                uint8_t end = extras[1];
-                uint8_t strengthA = extras[2];
-                uint8_t strengthB = extras[3];
-                uint8_t frequency = extras[4];
-                uint8_t period = extras[5];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_AB);
-                if (start <= 8 && end <= 9 && end > start && strengthA <= 7 && strengthB <= 7 && frequency > 0) {
-                    uint16_t mask = (1 << start) | (1 << end);
-                    uint32_t f = (strengthA & 7) | ((strengthB & 7) << 3);
-                    buffer[1] = static_cast<uint8_t>(mask & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((mask >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(f);
-                    buffer[4] = frequency;
-                    buffer[5] = period;
-                    lastIdx = 5;
-                }
+            // set the first DualSense controller found as our main controller
+            if (!DS5W_SUCCESS (
+                DS5W::initDeviceContext(&controllersInfo[0], &controller) )) {
+                ERROR_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS, "Init failed");
+                status = Status::InitFailed;
+                continue;
             }
+            status = Status::Ok;
+            DEBUG_PRINT("DualSense controller connnected");
+            hasInit = true;
+            ZeroMemory(&outState, sizeof(DS5W::DS5OutputState));
+
+            // enable red color by default with medium intensity
+            outState.lightbar = DS5W::color_R8G8B8_UCHAR_A32_FLOAT(255, 0, 0, 128);
+            outState.disableLeds = false;
             break;
-        case TriggerProfile::Feedback:
-            {
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-                uint8_t position = extras[0];
-                uint8_t strength = extras[1];
-                if (position <= 9 && strength <= 8) {
-                    if (strength > 0) {
-                        uint8_t b = (strength - 1) & 7;
-                        uint32_t num = 0;
-                        uint16_t num2 = 0;
-                        for (int i = position; i < 10; i++) {
-                            num |= static_cast<uint32_t>(b) << (3 * i);
-                            num2 |= static_cast<uint16_t>(1 << i);
-                        }
-                        buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                        buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                        buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                        buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                        buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                        buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                        lastIdx = 6;
-                    }
-                }
+        }
+        updateControllerLink();
+        return status;
+    }
+
+    void ensureConnected(void) {
+        if (agentMode == AgentMode::CLIENT) {
+            ERROR_PRINT("Not applicable in CLIENT mode");
+            return;
+        }
+
+        if (isConnected())
+            return;
+
+        metrics::ScopedTimer timer(metrics::Histogram::Reconnect);
+        metrics::add(metrics::Counter::ReconnectAttempts);
+        std::lock_guard<std::mutex> lock(initMutex);
+        if (hasInit) {
+            // try to reconnect to the same controller
+            ERROR_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS, "Device disconnected! Try to reconnect");
+            if (DS5W::reconnectDevice(&controller) == DS5W_OK) {
+                metrics::add(metrics::Counter::Reconnects);
+                return;
             }
-            break;
-        case TriggerProfile::Vibration:
-            {
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Vibration);
-                uint8_t position = extras[0];
-                uint8_t amplitude = extras[1];
-                uint8_t frequency = extras[2];
-                if (position <= 9 && amplitude <= 10 && amplitude > 0 && frequency > 0) {
-                    uint8_t b = (amplitude - 1) & 7;
-                    uint32_t num = 0;
-                    uint16_t num2 = 0;
-                    for (int i = position; i < 10; i++) {
-                        num |= static_cast<uint32_t>(b) << (3 * i);
-                        num2 |= static_cast<uint16_t>(1 << i);
-                    }
-                    buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                    buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                    buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                    buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                    // skip 7 and  8
-                    buffer[9] = frequency;
-                    lastIdx = 9;
-                }
+        }
+        if (connectToController() == Status::Ok)
+            metrics::add(metrics::Counter::Reconnects);
+    }
+
+    void setTransport(Transport selected) {
+        transport = selected;
+    }
+
+    void setNetworkMode(const NetworkOptions& options) {
+        networkOptions = options;
+        networkStreaming = true;
+    }
+
+    void setAcknowledgements(bool enable) {
+        acksRequested = enable;
+    }
+
+    void setPriority(uint8_t priority) {
+        sessionPriority = priority;
+    }
+
+    // sends trigger commands to the service as one COMMAND payload, to be
+    // applied at applyAtNs on the service's clock if non-zero
+    bool sendCommands(const TriggerCommand* commands, size_t count,
+                                        int64_t applyAtNs = 0);
+
+    // a HELLO, carrying the token in network mode
+    std::vector<uint8_t> helloPayload(uint32_t nonce) {
+        return serializeHelloPayload(nonce, networkStreaming ? &networkOptions.token : nullptr);
+    }
+
+    // sends every staged trigger change as one packet; in network mode the
+    // packet carries the unchanged triggers too (clientStateMutex must be held)
+    void flushStagedTriggers(void) {
+        TriggerCommand commands[2];
+        size_t count = 0;
+        size_t changed = 0;
+        for (uint8_t i = 0; i < 2; i++) {
+            const TriggerShadow& shadow = shadows[i];
+            commands[count].trigger = static_cast<Trigger>(i);
+            if (shadow.dirty) {
+                commands[count].profile = shadow.stagedProfile;
+                commands[count].extras = shadow.stagedExtras;
+                changed++;
+            } else if (networkStreaming && shadow.known) {
+                commands[count].profile = shadow.sentProfile;
+                commands[count].extras = shadow.sentExtras;
+            } else {
+                continue;
             }
-            break;
-        case TriggerProfile::SlopeFeedback:
-            {
-                uint8_t startPosition = extras[0];
-                uint8_t endPosition = extras[1];
-                uint8_t startStrength = extras[2];
-                uint8_t endStrength = extras[3];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-                if (startPosition <= 8 && startPosition >= 0 && endPosition <= 9 && endPosition > startPosition && startStrength <= 8 && startStrength >= 1 && endStrength <= 8 && endStrength >= 1) {
-                    uint8_t array[10] = { 0 };
-                    float slope = static_cast<float>(endStrength - startStrength) / static_cast<float>(endPosition - startPosition);
-                    for (int i = startPosition; i < 10; i++) {
-                        if (i <= endPosition) {
-                            float strengthFloat = static_cast<float>(startStrength) + slope * static_cast<float>(i - startPosition);
-                            array[i] = static_cast<uint8_t>(std::round(strengthFloat));
-                        } else {
-                            array[i] = endStrength;
-                        }
-                    }
-                    bool anyStrength = false;
-                    for (int i = 0; i < 10; i++) {
-                        if (array[i] > 0) anyStrength = true;
+            count++;
+        }
+        coalescedSends += stagedUpdates - (changed ? 1 : 0);
+        stagedUpdates = 0;
+        if (!changed)
+            return;
+
+        bool sent = sendCommands(commands, count);
+        for (size_t i = 0; i < count; i++) {
+            TriggerShadow& shadow = shadows[static_cast<uint8_t>(commands[i].trigger)];
+            if (!shadow.dirty)
+                continue;
+            shadow.dirty = false;
+            // the service state is unknown after a failed send, so the next
+            // update for this trigger must not be suppressed
+            shadow.known = sent;
+            shadow.sentNs = monotonicNs();
+            shadow.sentProfile = shadow.stagedProfile;
+            shadow.sentExtras.swap(shadow.stagedExtras);
+        }
+    }
+
+    void setCoalescing(uint32_t windowMs) {
+        std::lock_guard<std::mutex> lock(clientStateMutex);
+        coalesceWindowMs = windowMs;
+        if (windowMs == 0)
+            flushStagedTriggers();
+        if (senderWake)
+            SetEvent(senderWake);
+    }
+
+    // stages a CLIENT mode trigger update, dropping it if it changes nothing
+    void stageClientTrigger(Trigger trigger, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras) {
+        if (trigger != Trigger::Left && trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type!");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(clientStateMutex);
+        if (shadowsStale.exchange(false, std::memory_order_relaxed)) {
+            for (TriggerShadow& stale : shadows)
+                stale.known = false;
+        }
+        TriggerShadow& shadow = shadows[static_cast<uint8_t>(trigger)];
+        bool matchesSent = shadow.known
+            && monotonicNs() - shadow.sentNs < SHADOW_REFRESH_MS * 1000000LL
+            && shadow.sentProfile == triggerProfile && shadow.sentExtras == extras;
+        bool matchesStaged = shadow.dirty
+            ? shadow.stagedProfile == triggerProfile && shadow.stagedExtras == extras
+            : matchesSent;
+        if (matchesStaged) {
+            suppressedSends++;
+            return;
+        }
+
+        // setting a trigger back to its sent value cancels the staged change
+        shadow.dirty = !matchesSent;
+        shadow.stagedProfile = triggerProfile;
+        shadow.stagedExtras = extras;
+
+        uint32_t windowMs = coalesceWindowMs;
+        if (stagedUpdates++ == 0 && windowMs != COALESCE_UNTIL_SEND_STATE) {
+            flushDeadline = std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(windowMs);
+        }
+        if (windowMs == 0)
+            flushStagedTriggers();
+    }
+
+    void setSendQueue(size_t capacity, QueuePolicy policy, QueueSaturationFunc callback) {
+        sendQueueCapacity = std::max<size_t>(capacity, 2);
+        sendQueuePolicy = policy;
+        saturationCallback = callback;
+    }
+
+    // wakes the sender thread if it is parked; the fence pairs with the one
+    // in senderLoop(), so either it sees the new work or we see it parked
+    void wakeSender(void) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!senderParked.load(std::memory_order_relaxed))
+            return;
+        SetEvent(senderWake);
+    }
+
+    // QueuePolicy::COALESCE: replaces the trigger's overflow update
+    void putOverflow(const QueuedTrigger& item) {
+        OverflowSlot& slot = overflow[static_cast<uint8_t>(item.trigger)];
+        uint64_t ticket = slot.tickets.fetch_add(1, std::memory_order_relaxed);
+        OverflowBuffer& buffer = slot.buffers[ticket % OVERFLOW_BUFFERS];
+        buffer.version.store(ticket * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&buffer.item, &item, sizeof(item));
+        buffer.version.store(ticket * 2 + 2, std::memory_order_release);
+        slot.latest.exchange(ticket + 1);
+        overflowPending.store(true);
+    }
+
+    /**
+     * Takes the trigger's overflow update (sender thread only).
+     * @return false if there is none, or a newer producer is rewriting its
+     *         buffer; that one publishes again when done
+     */
+    bool takeOverflow(uint8_t i, QueuedTrigger& item) {
+        OverflowSlot& slot = overflow[i];
+        uint64_t published = slot.latest.exchange(0);
+        if (!published)
+            return false;
+        uint64_t ticket = published - 1;
+        const OverflowBuffer& buffer = slot.buffers[ticket % OVERFLOW_BUFFERS];
+        uint64_t version = buffer.version.load(std::memory_order_acquire);
+        if (version != ticket * 2 + 2)
+            return false;
+        memcpy(&item, &buffer.item, sizeof(item));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return buffer.version.load(std::memory_order_relaxed) == version;
+    }
+
+    // hands a CLIENT mode update to the sender thread without taking a
+    // lock; only waits under QueuePolicy::BLOCK with a full queue
+    void enqueueClientTrigger(Trigger trigger, TriggerProfile triggerProfile,
+                        const uint8_t* extras, size_t extrasSize, int64_t applyAtNs) {
+        if (trigger != Trigger::Left && trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type!");
+            return;
+        }
+        lockfree::BoundedQueue<QueuedTrigger>* queue = sendQueue.get();
+        if (!queue || !senderRunning) {
+            ERROR_PRINT("DualSensitive is not initialized in CLIENT mode");
+            return;
+        }
+        QueuedTrigger item;
+        item.trigger = trigger;
+        item.profile = triggerProfile;
+        item.extrasSize = static_cast<uint8_t>(extrasSize);
+        if (extrasSize)
+            memcpy(item.extras, extras, extrasSize);
+        item.applyAtNs = applyAtNs;
+
+        bool queued = !overflowPending.load(std::memory_order_acquire) && queue->push(item);
+        if (!queued) {
+            QueueSaturationFunc callback = saturationCallback;
+            if (!queueSaturated.exchange(true) && callback)
+                callback(true);
+            switch (sendQueuePolicy) {
+                case QueuePolicy::DROP_OLDEST: {
+                    QueuedTrigger oldest;
+                    while (!queue->push(item)) {
+                        if (queue->pop(oldest))
+                            queueDropped++;
                     }
-                    if (anyStrength) {
-                        uint32_t num = 0;
-                        uint16_t num2 = 0;
-                        for (int i = 0; i < 10; i++) {
-                            if (array[i] > 0) {
-                                uint8_t b = (array[i] - 1) & 7;
-                                num |= static_cast<uint32_t>(b) << (3 * i);
-                                num2 |= static_cast<uint16_t>(1 << i);
-                            }
-                        }
-                        buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                        buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                        buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                        buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                        buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                        buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                        lastIdx = 6;
+                    break;
+                }
+                case QueuePolicy::BLOCK:
+                    queueBlocked++;
+                    while (!queue->push(item)) {
+                        wakeSender();
+                        std::this_thread::yield();
                     }
+                    break;
+                case QueuePolicy::COALESCE:
+                default:
+                    putOverflow(item);
+                    queueMerged++;
+            }
+        }
+
+        uint32_t depth = static_cast<uint32_t>(queue->size());
+        metrics::set(metrics::Gauge::SendQueueDepth, depth);
+        uint32_t highWater = queueHighWater.load(std::memory_order_relaxed);
+        while (depth > highWater
+                && !queueHighWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {}
+        wakeSender();
+    }
+
+    // applies one dequeued update (sender thread only)
+    void processQueued(const QueuedTrigger& item) {
+        // one command serves every update, so its extras keep their capacity
+        static TriggerCommand command;
+        command.trigger = item.trigger;
+        command.profile = item.profile;
+        command.extras.assign(item.extras, item.extras + item.extrasSize);
+        if (!item.applyAtNs) {
+            stageClientTrigger(command.trigger, command.profile, command.extras);
+            return;
+        }
+        // 0 marks an unscheduled command on the wire
+        int64_t serviceApplyAtNs = std::max<int64_t>(item.applyAtNs + clockOffsetNs, 1);
+
+        std::lock_guard<std::mutex> lock(clientStateMutex);
+        // keep the wire order of earlier changes
+        flushStagedTriggers();
+        sendCommands(&command, 1, serviceApplyAtNs);
+        // the service only takes the setting at the deadline, so the next
+        // update of this trigger must not be suppressed against it
+        shadows[static_cast<uint8_t>(item.trigger)].known = false;
+    }
+
+    // takes everything queued so far, oldest first, then the updates merged
+    // while the queue was full (sender thread only)
+    void drainSendQueue(void) {
+        QueuedTrigger item;
+        while (sendQueue->pop(item))
+            processQueued(item);
+        if (overflowPending.load()) {
+            // cleared first: an update queued from here on is newer than
+            // what the slots hold and waits for the next drain, and one
+            // merged from here on sets the flag again
+            overflowPending.store(false);
+            for (uint8_t i = 0; i < 2; i++) {
+                if (takeOverflow(i, item))
+                    processQueued(item);
+            }
+        }
+        QueueSaturationFunc callback = saturationCallback;
+        if (queueSaturated.load(std::memory_order_relaxed) && sendQueue->empty()
+                && queueSaturated.exchange(false) && callback)
+            callback(false);
+    }
+
+    // CLIENT mode thread that sends the queued updates, and the staged
+    // changes when the coalescing window of their first update expires
+    void senderLoop(void) {
+        while (true) {
+            drainSendQueue();
+            bool stopping = !senderRunning;
+            std::unique_lock<std::mutex> lock(clientStateMutex);
+            if (flushRequested.exchange(false) || stopping) {
+                // sendState() or terminate(): send everything queued before
+                // it along with the staged changes
+                lock.unlock();
+                drainSendQueue();
+                lock.lock();
+                flushStagedTriggers();
+                if (stopping)
+                    break;
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            bool timed = stagedUpdates && coalesceWindowMs != COALESCE_UNTIL_SEND_STATE;
+            if (timed && now >= flushDeadline) {
+                flushStagedTriggers();
+                continue;
+            }
+            if (redundantLeft && now >= redundantDeadline) {
+                // network mode: the service drops the copies it already has
+                udp::send(redundantPayload);
+                fullStateSent++;
+                redundantLeft--;
+                redundantDeadline += std::chrono::milliseconds(networkOptions.redundancySpacingMs);
+                continue;
+            }
+            if (networkStreaming && now >= keepaliveDeadline) {
+                // network mode: the service drops sessions that go silent
+                udp::send(helloPayload(0));
+                keepaliveDeadline = now + std::chrono::milliseconds(NETWORK_KEEPALIVE_MS);
+                continue;
+            }
+
+            senderParked = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sendQueue->empty() && !overflowPending && !flushRequested && senderRunning) {
+                auto wake = std::chrono::steady_clock::time_point::max();
+                if (timed)
+                    wake = flushDeadline;
+                if (redundantLeft)
+                    wake = std::min(wake, redundantDeadline);
+                if (networkStreaming)
+                    wake = std::min(wake, keepaliveDeadline);
+                DWORD timeoutMs = INFINITE;
+                if (wake != std::chrono::steady_clock::time_point::max()) {
+                    // rounded up, so the deadline has passed on waking
+                    auto waitUs = std::chrono::duration_cast<std::chrono::microseconds>(wake - now);
+                    timeoutMs = static_cast<DWORD>(std::max<int64_t>((waitUs.count() + 999) / 1000, 0));
                 }
+                lock.unlock();
+                WaitForSingleObject(senderWake, timeoutMs);
             }
-            break;
-        case TriggerProfile::MultiplePositionFeeback:
-            {
-                uint8_t strength[10] = {0};
-                uint32_t num = 0;
-                uint16_t num2 = 0;
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_A);
-                for (int i = 0; i < 10 && i + 1 < extras.size(); ++i) {
-                    strength[i] = extras[i];
+            senderParked = false;
+        }
+    }
+
+    // counts sends whose ACK is overdue as lost; a scheduled command is
+    // only acknowledged after its deadline, so its timeout runs from there
+    // (linkMutex must be held)
+    void expireSends(int64_t now) {
+        int64_t offsetNs = clockOffsetNs;
+        for (PendingSend& send : pendingSends) {
+            if (!send.waiting)
+                continue;
+            int64_t startNs = send.sentNs;
+            if (send.applyAtNs)
+                startNs = std::max(startNs, send.applyAtNs - offsetNs);
+            if (now - startNs > ACK_TIMEOUT_MS * 1000000LL) {
+                send.waiting = false;
+                linkStats.lost++;
+                shadowsStale = true;
+            }
+        }
+    }
+
+    void trackSend(uint32_t sequence, int64_t applyAtNs) {
+        std::lock_guard<std::mutex> lock(linkMutex);
+        PendingSend& slot = pendingSends[sequence & (ACK_WINDOW - 1)];
+        // the window wrapped before this slot's ACK arrived
+        if (slot.waiting) {
+            linkStats.lost++;
+            shadowsStale = true;
+        }
+        int64_t now = monotonicNs();
+        // overdue ACKs also mark the shadows stale, so look for them
+        // between getLinkStats() calls too
+        if (now - lastExpiryNs >= ACK_TIMEOUT_MS * 1000000LL) {
+            lastExpiryNs = now;
+            expireSends(now);
+        }
+        slot.sequence = sequence;
+        slot.sentNs = now;
+        slot.applyAtNs = applyAtNs;
+        slot.waiting = true;
+        linkStats.sent++;
+    }
+
+    // CLIENT mode handler for datagrams sent back by the service
+    void handleAck(const std::vector<uint8_t>& payload) {
+        AckPayload ack;
+        if (!deserializeAckPayload(payload, ack))
+            return;
+
+        int64_t now = monotonicNs();
+        std::lock_guard<std::mutex> lock(linkMutex);
+        PendingSend& slot = pendingSends[ack.sequence & (ACK_WINDOW - 1)];
+        // late (already counted as lost) or duplicate
+        if (!slot.waiting || slot.sequence != ack.sequence)
+            return;
+        slot.waiting = false;
+
+        size_t sample = rttSampleCount++ % RTT_WINDOW;
+        rttSamplesUs[sample] = (now - slot.sentNs) / 1000.0;
+        serviceSamplesUs[sample] = (ack.appliedNs - ack.receivedNs) / 1000.0;
+        if (slot.applyAtNs && ack.result == ApplyResult::Applied) {
+            scheduleSamplesUs[scheduleSampleCount++ % RTT_WINDOW] =
+                (ack.appliedNs - slot.applyAtNs) / 1000.0;
+            linkStats.scheduled++;
+        }
+        linkStats.acknowledged++;
+        if (ack.result != ApplyResult::Applied)
+            linkStats.notApplied++;
+        // an overridden or disabled setting is still held by the session
+        if (ack.result == ApplyResult::Rejected
+                || ack.result == ApplyResult::DeviceDisconnected)
+            shadowsStale = true;
+        linkStats.lastAckedSequence = ack.sequence;
+        linkStats.lastResult = ack.result;
+        lastAckNs = now;
+    }
+
+    // network mode: takes a timestamped snapshot into the receive
+    // statistics; false for copies and snapshots overtaken by a newer one
+    // (inputMutex must be held)
+    bool acceptSnapshot(uint32_t sequence, int64_t timestampNs, int64_t now) {
+        streamStats.inputReceived++;
+        if (streamStarted) {
+            int32_t ahead = static_cast<int32_t>(sequence - lastInputSequence);
+            if (ahead == 0) {
+                streamStats.inputDuplicates++;
+                return false;
+            }
+            if (ahead < 0) {
+                streamStats.inputLate++;
+                return false;
+            }
+            streamStats.inputLost += ahead - 1;
+        } else {
+            streamStarted = true;
+            firstStreamSequence = sequence;
+        }
+        lastInputSequence = sequence;
+
+        // transit mixes both clocks, but their offset cancels out of the
+        // jitter (RFC 3550) and of the playout delay
+        int64_t transitNs = now - timestampNs;
+        if (minTransitNs != INT64_MAX) {
+            double deltaNs = static_cast<double>(std::llabs(transitNs - lastTransitNs));
+            transitJitterNs += (deltaNs - transitJitterNs) / 16.0;
+        }
+        lastTransitNs = transitNs;
+        minTransitNs = std::min(minTransitNs, transitNs);
+        streamLatencyUs[streamLatencyCount++ % RTT_WINDOW] = (transitNs + clockOffsetNs) / 1000.0;
+        return true;
+    }
+
+    // queues a snapshot for the playout thread, pushing out the oldest one
+    // if the buffer is full (inputMutex must be held)
+    void bufferSnapshot(const uint8_t* packed, int64_t playoutNs) {
+        if (jitterCount == JITTER_BUFFER_SLOTS) {
+            jitterHead = (jitterHead + 1) % JITTER_BUFFER_SLOTS;
+            jitterCount--;
+        }
+        BufferedInput& slot = jitterBuffer[(jitterHead + jitterCount++) % JITTER_BUFFER_SLOTS];
+        slot.playoutNs = playoutNs;
+        memcpy(slot.packed, packed, PACKED_INPUT_SIZE);
+        playoutCondition.notify_one();
+    }
+
+    // CLIENT mode thread that hands the buffered snapshots to the
+    // application in order, each at its playout time
+    void playoutLoop(void) {
+        std::unique_lock<std::mutex> lock(inputMutex);
+        while (playoutRunning) {
+            if (!jitterCount) {
+                playoutCondition.wait(lock);
+                continue;
+            }
+            const BufferedInput& next = jitterBuffer[jitterHead];
+            int64_t waitNs = next.playoutNs - monotonicNs();
+            if (waitNs > 0) {
+                playoutCondition.wait_for(lock, std::chrono::nanoseconds(waitNs));
+                continue;
+            }
+            memcpy(receivedInput, next.packed, PACKED_INPUT_SIZE);
+            jitterHead = (jitterHead + 1) % JITTER_BUFFER_SLOTS;
+            jitterCount--;
+            inputValid = true;
+            DS5W::DS5InputState state;
+            unpackInputState(receivedInput, state);
+            InputStateFunc callback = inputCallback;
+            lock.unlock();
+            if (callback)
+                callback(state);
+            lock.lock();
+        }
+    }
+
+    void handleInput(const std::vector<uint8_t>& payload) {
+        int64_t now = monotonicNs();
+        DS5W::DS5InputState state;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            uint32_t sequence = 0;
+            uint8_t flags = 0;
+            int64_t timestampNs = 0;
+            uint8_t packed[PACKED_INPUT_SIZE];
+            memcpy(packed, receivedInput, PACKED_INPUT_SIZE);
+            if (!deserializeInputPayload(payload, sequence, flags, packed, &timestampNs))
+                return;
+            if (flags & INPUT_TIMESTAMPED) {
+                // network mode snapshots are whole, only their order matters
+                if (!(flags & INPUT_KEYFRAME) || !acceptSnapshot(sequence, timestampNs, now))
+                    return;
+                if (playoutRunning) {
+                    bufferSnapshot(packed, timestampNs + minTransitNs
+                        + networkOptions.jitterBufferMs * 1000000LL);
+                    return;
                 }
-                for (int i = 0; i < 10; i++) {
-                    if (strength[i] > 0) {
-                        uint8_t b = (strength[i] - 1) & 7;
-                        num |= static_cast<uint32_t>(b) << (3 * i);
-                        num2 |= static_cast<uint16_t>(1 << i);
-                    }
+            } else {
+                // deltas build on each other; after a lost update wait for
+                // the next keyframe
+                if (!(flags & INPUT_KEYFRAME) && (!inputValid || sequence != lastInputSequence + 1)) {
+                    inputValid = false;
+                    return;
                 }
-                buffer[1] = static_cast<unsigned char>(num2 & 0xFF);
-                buffer[2] = static_cast<unsigned char>((num2 >> 8) & 0xFF);
-                buffer[3] = static_cast<unsigned char>(num & 0xFF);
-                buffer[4] = static_cast<unsigned char>((num >> 8) & 0xFF);
-                buffer[5] = static_cast<unsigned char>((num >> 16) & 0xFF);
-                buffer[6] = static_cast<unsigned char>((num >> 24) & 0xFF);
-                lastIdx = 6;
+                lastInputSequence = sequence;
             }
-            break;
-        case TriggerProfile::MultiplePositionVibration:
-            {
-                uint8_t frequency = extras[0];
-                uint8_t amplitudes[10];
-                std::copy(extras.begin() + 1, extras.begin() + 11, amplitudes);
-                bool anyAmplitude = std::any_of(amplitudes, amplitudes + 10, [](uint8_t a) { return a > 0; });
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_B2);
-                if (frequency > 0 && anyAmplitude) {
-                    uint32_t num = 0;
-                    uint16_t num2 = 0;
-                    for (int i = 0; i < 10; ++i) {
-                        if (amplitudes[i] > 0) {
-                            uint8_t b = (amplitudes[i] - 1) & 7;
-                            num |= static_cast<uint32_t>(b) << (3 * i);
-                            num2 |= static_cast<uint16_t>(1 << i);
-                        }
-                    }
-                    buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                    buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                    buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                    buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                    buffer[7] = 0;
-                    buffer[8] = 0;
-                    buffer[9] = frequency;
-                    lastIdx = 9;
-                }
+            memcpy(receivedInput, packed, PACKED_INPUT_SIZE);
+            inputValid = true;
+            unpackInputState(receivedInput, state);
+        }
+        InputStateFunc callback = inputCallback;
+        if (callback)
+            callback(state);
+    }
+
+    void handleTimeSync(const std::vector<uint8_t>& payload) {
+        int64_t receivedNs = monotonicNs();
+        TimeSyncPayload sync;
+        if (!deserializeTimeSyncPayload(payload, sync))
+            return;
+        std::lock_guard<std::mutex> lock(clockMutex);
+        // an answer to an exchange that already timed out
+        if (sync.id != awaitedSyncId || syncAnswered)
+            return;
+        syncDelayNs = (receivedNs - sync.clientSendNs)
+            - (sync.serviceSendNs - sync.serviceReceiveNs);
+        syncOffsetNs = ((sync.serviceReceiveNs - sync.clientSendNs)
+            + (sync.serviceSendNs - receivedNs)) / 2;
+        syncAnswered = true;
+        clockCondition.notify_one();
+    }
+
+    void handleReady(const std::vector<uint8_t>& payload) {
+        ReadyPayload ready;
+        if (!deserializeReadyPayload(payload, ready))
+            return;
+        // any READY tells, also one to the probes of sendTriggerPayloads()
+        commandsSupported = (ready.flags & READY_COMMANDS) != 0;
+        shadowsStale = true;
+        std::lock_guard<std::mutex> lock(readyMutex);
+        if (!awaitedHelloNonce || ready.nonce != awaitedHelloNonce || readyAnswered)
+            return;
+        lastReady = ready;
+        readyAnswered = true;
+        readyCondition.notify_one();
+    }
+
+    void handleStats(const std::vector<uint8_t>& payload) {
+        uint32_t id = 0;
+        std::string text;
+        if (!deserializeStatsPayload(payload, id, text))
+            return;
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (id != awaitedStatsId || statsAnswered)
+            return;
+        statsText.swap(text);
+        statsAnswered = true;
+        statsCondition.notify_one();
+    }
+
+    // CLIENT mode handler for datagrams sent back by the service
+    void handleReply(const std::vector<uint8_t>& payload, const udp::Peer&) {
+        if (payload.empty())
+            return;
+        switch (static_cast<PayloadType>(payload[0])) {
+            case PayloadType::ACK:
+                handleAck(payload);
+                break;
+            case PayloadType::INPUT:
+                handleInput(payload);
+                break;
+            case PayloadType::TIME_SYNC:
+                handleTimeSync(payload);
+                break;
+            case PayloadType::READY:
+                handleReady(payload);
+                break;
+            case PayloadType::STATS:
+                handleStats(payload);
+                break;
+            default:
+                DEBUG_PRINT("Ignoring unexpected reply from the service");
+        }
+    }
+
+    bool subscribeInput(uint16_t rateHz, InputStateFunc callback) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("subscribeInput() is only available in CLIENT mode");
+            return false;
+        }
+        if (rateHz == 0 || rateHz > MAX_INPUT_RATE_HZ) {
+            ERROR_PRINT("Input rate must be between 1 and " << MAX_INPUT_RATE_HZ << " Hz");
+            return false;
+        }
+        inputCallback = callback;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            inputValid = false;
+            streamStarted = false;
+            minTransitNs = INT64_MAX;
+            jitterCount = 0;
+            if (networkStreaming && networkOptions.jitterBufferMs && !playoutRunning) {
+                playoutRunning = true;
+                playoutThread = std::thread(playoutLoop);
             }
-            break;
-        case TriggerProfile::Weapon:
-            {
-                uint8_t startPosition = extras[0];
-                uint8_t endPosition = extras[1];
-                uint8_t strength = extras[2];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_AB);
-                if (startPosition <= 7 && startPosition >= 2 &&
-                    endPosition <= 8 && endPosition > startPosition &&
-                    strength <= 8) {
-                    if (strength > 0) {
-                        uint16_t num = static_cast<uint16_t>((1 << startPosition) | (1 << endPosition));
-                        buffer[1] = static_cast<unsigned char>(num & 0xFF);
-                        buffer[2] = static_cast<unsigned char>((num >> 8) & 0xFF);
-                        buffer[3] = strength - 1;
-                        lastIdx = 3;
-                    }
-                }
+        }
+        std::vector<uint8_t> payload = networkStreaming
+            ? serializeSubscribePayload(rateHz, SUBSCRIBE_FULL_STATE, networkOptions.redundancy)
+            : serializeSubscribePayload(rateHz);
+        return udp::send(payload) == udp::Status::Success;
+    }
+
+    void unsubscribeInput(void) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("unsubscribeInput() is only available in CLIENT mode");
+            return;
+        }
+        inputCallback = nullptr;
+        udp::send(serializeSubscribePayload(0));
+    }
+
+    bool getInputState(DS5W::DS5InputState& state) {
+        ALLOC_SCOPE("getInputState");
+        std::lock_guard<std::mutex> lock(inputMutex);
+        if (!inputValid)
+            return false;
+        unpackInputState(receivedInput, state);
+        return true;
+    }
+
+    int64_t clockNs(void) {
+        return monotonicNs();
+    }
+
+    bool syncClock(uint32_t samples, uint32_t timeoutMs) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("syncClock() is only available in CLIENT mode");
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(timeoutMs);
+        uint32_t answered = 0;
+        int64_t bestOffsetNs = 0;
+        int64_t bestDelayNs = INT64_MAX;
+
+        std::unique_lock<std::mutex> lock(clockMutex);
+        // one exchange at a time, so a queued request cannot inflate the
+        // round trip of the next one
+        for (uint32_t i = 0; i < samples; i++) {
+            TimeSyncPayload sync = { nextSyncId++, 0, 0, 0 };
+            awaitedSyncId = sync.id;
+            syncAnswered = false;
+            sync.clientSendNs = monotonicNs();
+            if (udp::send(serializeTimeSyncPayload(sync)) != udp::Status::Success)
+                break;
+            if (!clockCondition.wait_until(lock, deadline, [] { return syncAnswered; }))
+                break;
+            answered++;
+            // the shortest round trip has the least asymmetric queuing
+            if (syncDelayNs < bestDelayNs) {
+                bestDelayNs = syncDelayNs;
+                bestOffsetNs = syncOffsetNs;
             }
-            break;
-        case TriggerProfile::SemiAutomaticGun:
-            {
-                uint8_t start = extras[0];
-                uint8_t end = extras[1];
-                uint8_t force = extras[2];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_AB);
-                if (start <= 7 && start >= 2 && end <= 8 && end > start && force <= 8 && force > 0) {
-                    uint16_t num = static_cast<uint16_t>((1 << start) | (1 << end));
-                    buffer[1] = static_cast<unsigned char>(num & 0xFF);
-                    buffer[2] = static_cast<unsigned char>((num >> 8) & 0xFF);
-                    buffer[3] = force - 1;
-                    lastIdx = 3;
-                }
+        }
+        awaitedSyncId = 0;
+        if (!answered) {
+            ERROR_PRINT("Clock sync got no answer from the service");
+            return false;
+        }
+        clockOffsetNs = bestOffsetNs;
+        clockSyncDelayNs = bestDelayNs;
+        DEBUG_PRINT("Clock offset " << bestOffsetNs << " ns (delay " << bestDelayNs
+            << " ns, " << answered << "/" << samples << " answered)");
+        return true;
+    }
+
+    LinkStats getLinkStats(void) {
+        uint64_t suppressed, coalesced;
+        {
+            std::lock_guard<std::mutex> lock(clientStateMutex);
+            suppressed = suppressedSends;
+            coalesced = coalescedSends;
+        }
+
+        int64_t now = monotonicNs();
+        std::lock_guard<std::mutex> lock(linkMutex);
+        expireSends(now);
+
+        LinkStats stats = linkStats;
+        stats.suppressed = suppressed;
+        stats.coalesced = coalesced;
+        stats.queueDropped = queueDropped;
+        stats.queueMerged = queueMerged;
+        stats.queueBlocked = queueBlocked;
+        stats.queueHighWater = queueHighWater;
+        stats.clockOffsetNs = clockOffsetNs;
+        stats.clockSyncDelayNs = clockSyncDelayNs;
+        for (const PendingSend& send : pendingSends) {
+            if (send.waiting)
+                stats.pending++;
+        }
+
+        size_t samples = std::min<size_t>(rttSampleCount, RTT_WINDOW);
+        std::vector<double> rtts(rttSamplesUs, rttSamplesUs + samples);
+        std::vector<double> serviceTimes(serviceSamplesUs, serviceSamplesUs + samples);
+        std::sort(rtts.begin(), rtts.end());
+        std::sort(serviceTimes.begin(), serviceTimes.end());
+        stats.rttP50Us = percentile(rtts, 50.0);
+        stats.rttP90Us = percentile(rtts, 90.0);
+        stats.rttP99Us = percentile(rtts, 99.0);
+        stats.rttMaxUs = rtts.empty() ? 0.0 : rtts.back();
+        stats.serviceTimeP50Us = percentile(serviceTimes, 50.0);
+
+        size_t scheduleSamples = std::min<size_t>(scheduleSampleCount, RTT_WINDOW);
+        std::vector<double> errors(scheduleSamplesUs, scheduleSamplesUs + scheduleSamples);
+        std::sort(errors.begin(), errors.end());
+        stats.scheduleErrorP50Us = percentile(errors, 50.0);
+        stats.scheduleErrorP99Us = percentile(errors, 99.0);
+        stats.scheduleErrorMaxUs = errors.empty() ? 0.0 : errors.back();
+        stats.msSinceLastAck = lastAckNs ? (now - lastAckNs) / 1000000 : -1;
+        return stats;
+    }
+
+    StreamStats getStreamStats(void) {
+        StreamStats stats;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            stats = streamStats;
+            stats.jitterUs = transitJitterNs / 1000.0;
+            if (streamStarted) {
+                uint64_t sent = static_cast<uint32_t>(lastInputSequence - firstStreamSequence) + 1ULL;
+                stats.inputLossRate = static_cast<double>(stats.inputLost) / sent;
             }
-            break;
-        case TriggerProfile::AutomaticGun:
-            {
-                uint8_t start = extras[0];
-                uint8_t strength = extras[1];
-                uint8_t frequency = extras[2];
-                buffer[0] = static_cast<unsigned char>(TriggerMode::Pulse_B2);
-                if (start <= 9 && strength <= 8 && strength > 0 && frequency > 0) {
-                    uint8_t b = (strength - 1) & 7;
-                    uint32_t num = 0;
-                    uint16_t num2 = 0;
-                    for (int i = static_cast<int>(start); i < 10; i++) {
-                        num |= static_cast<uint32_t>(b) << (3 * i);
-                        num2 |= static_cast<uint16_t>(1 << i);
-                    }
-                    buffer[1] = static_cast<uint8_t>(num2 & 0xFF);
-                    buffer[2] = static_cast<uint8_t>((num2 >> 8) & 0xFF);
-                    buffer[3] = static_cast<uint8_t>(num & 0xFF);
-                    buffer[4] = static_cast<uint8_t>((num >> 8) & 0xFF);
-                    buffer[5] = static_cast<uint8_t>((num >> 16) & 0xFF);
-                    buffer[6] = static_cast<uint8_t>((num >> 24) & 0xFF);
-                    buffer[8] = frequency;
-                    lastIdx = 8;
-                }
+            size_t samples = std::min<size_t>(streamLatencyCount, RTT_WINDOW);
+            std::vector<double> latencies(streamLatencyUs, streamLatencyUs + samples);
+            std::sort(latencies.begin(), latencies.end());
+            stats.latencyP50Us = percentile(latencies, 50.0);
+            stats.latencyP99Us = percentile(latencies, 99.0);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            stats.staleCommands = staleCommands;
+        }
+        stats.fullStateSent = fullStateSent;
+        stats.shimDropped = udp::getShimDropped();
+        return stats;
+    }
+
+    // updates the trigger in outState without writing to the controller
+    bool stageTrigger(Trigger trigger, TriggerProfile triggerProfile,
+                                        const uint8_t* extras, size_t extrasSize) {
+        DS5W::TriggerSetting* setting;
+        if (trigger == Trigger::Left) {
+            setting = &outState.leftTriggerSetting;
+        } else if (trigger == Trigger::Right) {
+            setting = &outState.rightTriggerSetting;
+        } else {
+            ERROR_PRINT("Unknown trigger type!");
+            return false;
+        }
+        // the encoders read at most 11 extras
+        extrasSize = std::min<size_t>(extrasSize, TRIGGER_EXTRAS_MAX);
+        outState.triggerSettingEnabled = true;
+        setting->profile = triggerProfile;
+        setting->extrasSize = static_cast<unsigned char>(extrasSize);
+        if (extrasSize)
+            memcpy(setting->extras, extras, extrasSize);
+        return true;
+    }
+
+    // writes outState to the controller and reports the outcome
+    ApplyResult writeState(void) {
+        {
+            std::lock_guard<std::mutex> lock(enabledMutex);
+            if (!enabled) {
+                DEBUG_PRINT("DualSensitive is disabled... Don't send any state");
+                return ApplyResult::Disabled;
             }
-            break;
-        case TriggerProfile::Custom:
-            {
-                // First byte of extras determines TriggerMode (0–16 for predefined values)
-                buffer[0] = static_cast<unsigned char>(extras[0]); // TriggerMode
-                for (int i = 1; i <= 7 && i < extras.size(); ++i) {
-                    buffer[i] = extras[i]; // Next 7 bytes are force parameters
+        }
+        ensureConnected();
+        bool written;
+        int64_t writeNs = monotonicNs();
+        {
+            metrics::ScopedTimer timer(metrics::Histogram::HidWrite);
+            written = DS5W_SUCCESS(DS5W::setDeviceOutputState(&controller, &outState));
+        }
+        metrics::add(written ? metrics::Counter::HidWrites : metrics::Counter::HidWriteFailures);
+        updateControllerLink();
+        // SERVER mode: the writer loop keeps reading while the probe is on
+        if (written && actuationEnabled.load(std::memory_order_relaxed)
+                && armActuation(writeNs) && agentMode == AgentMode::SOLO)
+            awaitActuation();
+        if (!written)
+            return ApplyResult::DeviceDisconnected;
+        return ApplyResult::Applied;
+    }
+
+    // replaces the mailbox slot of the trigger (mailboxMutex must be held)
+    bool postTrigger(Trigger trigger, TriggerProfile triggerProfile,
+                                        const uint8_t* extras, size_t extrasSize) {
+        if (trigger != Trigger::Left && trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type!");
+            return false;
+        }
+        MailboxSlot& slot = mailbox[static_cast<uint8_t>(trigger)];
+        slot.full = true;
+        slot.profile = triggerProfile;
+        // payloads may carry up to 255; the encoders read at most 11
+        extrasSize = std::min<size_t>(extrasSize, TRIGGER_EXTRAS_MAX);
+        slot.extrasSize = static_cast<uint8_t>(extrasSize);
+        if (extrasSize)
+            memcpy(slot.extras, extras, extrasSize);
+        writeRequested = true;
+        return true;
+    }
+
+    // finds the session of a sender: UDP senders by address, ring records
+    // by the producer's PID (mailboxMutex must be held)
+    Session* findSession(const udp::Peer& peer, uint32_t pid) {
+        for (Session& session : sessions) {
+            bool match = peer.port
+                ? session.peer.address == peer.address && session.peer.port == peer.port
+                : session.pid == pid && (pid || !session.peer.port);
+            if (match)
+                return &session;
+        }
+        return nullptr;
+    }
+
+    void publishResolved(void);
+
+    // finds or adds the session of a sender; a full table drops its least
+    // recently active session first (mailboxMutex must be held)
+    Session& openSession(const udp::Peer& peer, uint32_t pid) {
+        Session* session = findSession(peer, pid);
+        if (session)
+            return *session;
+        if (sessions.size() >= MAX_SESSIONS) {
+            // make room by dropping the least recently active session
+            auto oldest = std::min_element(sessions.begin(), sessions.end(),
+                [](const Session& a, const Session& b) { return a.lastActive < b.lastActive; });
+            INFO_PRINT("Too many clients, dropping the session of PID " << oldest->pid);
+            uint32_t evicted = oldest->pid;
+            sessions.erase(oldest);
+            // its triggers go with it, and its process no longer needs
+            // watching unless another session shares the PID
+            publishResolved();
+            bool shared = std::any_of(sessions.begin(), sessions.end(),
+                [evicted](const Session& session) { return session.pid == evicted; });
+            if (evicted && !shared) {
+                evictedPids.push_back(evicted);
+                mailboxCondition.notify_one();
+            }
+        }
+        sessions.emplace_back();
+        sessions.back().peer = peer;
+        sessions.back().pid = pid;
+        sessions.back().tokens = sessionBurst;
+        sessions.back().refilledNs = monotonicNs();
+        for (int i = 0; i < 2; i++) {
+            sessions.back().triggers[i].extras.reserve(TRIGGER_EXTRAS_MAX);
+            sessions.back().pending[i].extras.reserve(TRIGGER_EXTRAS_MAX);
+        }
+        return sessions.back();
+    }
+
+    // the ring carries no return address, so its records belong to the
+    // process owning its producer slot
+    uint32_t senderPid(const udp::Peer& peer) {
+        return peer.port ? 0 : shm::getProducerPid();
+    }
+
+    // compares in time independent of where the tokens differ
+    bool tokenMatches(const std::string& token) {
+        const std::string& expected = networkOptions.token;
+        if (token.size() != expected.size())
+            return false;
+        uint8_t difference = 0;
+        for (size_t i = 0; i < token.size(); i++)
+            difference |= static_cast<uint8_t>(token[i] ^ expected[i]);
+        return difference == 0;
+    }
+
+    // network mode gate for each UDP datagram: a HELLO carrying the token
+    // opens a networked session for its sender, and nothing else gets
+    // through before, so strangers and spoofed senders get neither
+    // sessions nor replies. A service without a token serves this host
+    // only, and its clients need no HELLO (mailboxMutex must not be held)
+    bool admitPeer(const udp::Peer& peer, const std::vector<uint8_t>& payload, int64_t now) {
+        bool local = udp::isLocal(peer);
+        bool open = local && networkOptions.token.empty();
+        std::string token;
+        if (static_cast<PayloadType>(payload[0]) == PayloadType::HELLO
+                && deserializeHelloToken(payload, token)) {
+            if (tokenMatches(token) && (open || !networkOptions.token.empty())) {
+                std::lock_guard<std::mutex> lock(mailboxMutex);
+                Session& session = openSession(peer, 0);
+                if (!session.networked)
+                    session.lastActive = ++sessionClock;
+                session.networked = true;
+                session.lastHeardNs = now;
+                return true;
+            }
+        } else {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            Session* session = findSession(peer, 0);
+            if (session && session->networked) {
+                session->lastHeardNs = now;
+                return true;
+            }
+            if (open)
+                return true;
+        }
+        metrics::add(metrics::Counter::PayloadsUnauthorized);
+        DEBUG_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS, "Ignoring datagrams from unauthorized peer "
+            << (peer.address >> 24) << "." << ((peer.address >> 16) & 0xFF) << "."
+            << ((peer.address >> 8) & 0xFF) << "." << (peer.address & 0xFF) << ":" << peer.port);
+        return false;
+    }
+
+    bool setSessionTrigger(Session& session, Trigger trigger,
+                TriggerProfile triggerProfile, const std::vector<uint8_t>& extras) {
+        if (trigger != Trigger::Left && trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type!");
+            return false;
+        }
+        SessionTrigger& setting = session.triggers[static_cast<uint8_t>(trigger)];
+        setting.set = true;
+        setting.profile = triggerProfile;
+        setting.extras.assign(extras.begin(), extras.end());
+        setting.stamp = ++sessionClock;
+        session.lastActive = sessionClock;
+        return true;
+    }
+
+    // tops up the session's bucket; true if it holds a token
+    // (mailboxMutex must be held)
+    bool refillTokens(Session& session, int64_t now) {
+        if (sessionRate <= 0.0)
+            return true;
+        session.tokens = std::min(sessionBurst,
+            session.tokens + (now - session.refilledNs) * sessionRate / 1e9);
+        session.refilledNs = now;
+        return session.tokens >= 1.0;
+    }
+
+    void takeToken(Session& session) {
+        if (sessionRate > 0.0)
+            session.tokens -= 1.0;
+    }
+
+    // applies trigger commands to the session if its bucket allows, or
+    // merges them into its deferred updates otherwise
+    // (mailboxMutex must be held)
+    // @return true if applied, false if deferred
+    bool applySessionCommands(Session& session, const TriggerCommand* commands,
+                                        size_t count, int64_t now) {
+        session.updates++;
+        // once deferred, later updates queue behind so the newest one wins
+        if (!session.deferred && refillTokens(session, now)) {
+            takeToken(session);
+            for (size_t i = 0; i < count; i++) {
+                if (!setSessionTrigger(session, commands[i].trigger,
+                            commands[i].profile, commands[i].extras))
+                    ERROR_PRINT("Could not set triggers from command!");
+            }
+            return true;
+        }
+
+        session.throttled++;
+        for (size_t i = 0; i < count; i++) {
+            uint8_t index = static_cast<uint8_t>(commands[i].trigger);
+            if (index > 1) {
+                ERROR_PRINT("Unknown trigger type!");
+                continue;
+            }
+            SessionTrigger& pending = session.pending[index];
+            pending.set = true;
+            pending.profile = commands[i].profile;
+            pending.extras.assign(commands[i].extras.begin(), commands[i].extras.end());
+            session.deferred = true;
+        }
+        session.lastActive = ++sessionClock;
+        return false;
+    }
+
+    // true if the controller gets the session's setting for the trigger
+    bool sessionApplies(const Session& session, Trigger trigger) {
+        uint8_t i = static_cast<uint8_t>(trigger);
+        if (i > 1)
+            return false;
+        return session.triggers[i].profile == resolved[i].profile
+            && session.triggers[i].extras == resolved[i].extras;
+    }
+
+    // resolves each trigger across the sessions and posts the triggers
+    // whose resolved setting changed (mailboxMutex must be held)
+    void publishResolved(void) {
+        static const SessionTrigger normal;
+        for (uint8_t i = 0; i < 2; i++) {
+            const SessionTrigger* winner = nullptr;
+            uint8_t winnerPriority = 0;
+            for (const Session& session : sessions) {
+                const SessionTrigger& candidate = session.triggers[i];
+                if (!candidate.set)
+                    continue;
+                if (!winner || session.priority > winnerPriority
+                        || (session.priority == winnerPriority && candidate.stamp > winner->stamp)) {
+                    winner = &candidate;
+                    winnerPriority = session.priority;
                 }
-                lastIdx = 7;
             }
-            break;
-        case TriggerProfile::Normal:
-        default:
-            buffer[0] = static_cast<unsigned char>(TriggerMode::Rigid_B);
-            lastIdx = 0;
-            break;
+            // a trigger nobody has set goes back to Normal
+            const SessionTrigger& target = winner ? *winner : normal;
+            if (resolved[i].set && resolved[i].profile == target.profile
+                    && resolved[i].extras == target.extras)
+                continue;
+            resolved[i].set = true;
+            resolved[i].profile = target.profile;
+            resolved[i].extras = target.extras;
+            postTrigger(static_cast<Trigger>(i), target.profile, target.extras.data(), target.extras.size());
+        }
+    }
+
+    // earliest time a throttled session gets a token back, INT64_MAX if
+    // no session is throttled (mailboxMutex must be held)
+    int64_t nextReleaseNs(void) {
+        int64_t next = INT64_MAX;
+        for (const Session& session : sessions) {
+            if (!session.deferred)
+                continue;
+            if (sessionRate <= 0.0)
+                return 0;
+            int64_t waitNs = static_cast<int64_t>((1.0 - session.tokens) * 1e9 / sessionRate);
+            next = std::min(next, session.refilledNs + std::max<int64_t>(waitNs, 0));
+        }
+        return next;
+    }
+
+    // earliest time a networked session goes silent for too long,
+    // INT64_MAX if there is none (mailboxMutex must be held)
+    int64_t nextSessionExpiryNs(void) {
+        int64_t next = INT64_MAX;
+        for (const Session& session : sessions) {
+            if (session.networked) {
+                next = std::min<int64_t>(next, session.lastHeardNs
+                        + networkOptions.sessionTimeoutMs * 1000000LL);
+            }
+        }
+        return next;
+    }
+
+    // drops the networked sessions silent for sessionTimeoutMs and
+    // releases their triggers, as onClientExit() does for local clients
+    // (mailboxMutex must be held)
+    void expireSessions(int64_t now) {
+        int64_t timeoutNs = networkOptions.sessionTimeoutMs * 1000000LL;
+        auto silent = [now, timeoutNs](const Session& session) {
+            return session.networked && now - session.lastHeardNs >= timeoutNs;
+        };
+        auto expired = std::remove_if(sessions.begin(), sessions.end(), silent);
+        if (expired == sessions.end())
+            return;
+        INFO_PRINT("Releasing the triggers of " << (sessions.end() - expired)
+            << " network client(s) silent for " << networkOptions.sessionTimeoutMs << " ms");
+        sessions.erase(expired, sessions.end());
+        publishResolved();
+    }
+
+    // applies the merged updates of every throttled session that has a
+    // token again (mailboxMutex must be held)
+    void releaseDeferred(int64_t now) {
+        for (Session& session : sessions) {
+            if (!session.deferred || !refillTokens(session, now))
+                continue;
+            takeToken(session);
+            session.deferred = false;
+            session.deferredWrites++;
+            for (uint8_t i = 0; i < 2; i++) {
+                SessionTrigger& pending = session.pending[i];
+                if (!pending.set)
+                    continue;
+                pending.set = false;
+                setSessionTrigger(session, static_cast<Trigger>(i), pending.profile, pending.extras);
+            }
+            publishResolved();
+
+            if (session.deferredAcks.empty())
+                continue;
+            ApplyResult result = ApplyResult::Applied;
+            for (uint8_t i = 0; i < 2; i++) {
+                if (session.triggers[i].set && !sessionApplies(session, static_cast<Trigger>(i)))
+                    result = ApplyResult::Overridden;
+            }
+            for (PendingAck& pending : session.deferredAcks) {
+                pending.result = result;
+                mailboxAcks.push_back(pending);
+            }
+            session.deferredAcks.clear();
+            // the ACKs go out with the next write
+            writeRequested = true;
+        }
+    }
+
+    void setSessionRateLimit(uint32_t updatesPerSecond, uint32_t burst) {
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        sessionRate = updatesPerSecond;
+        sessionBurst = std::max<uint32_t>(burst, 1);
+        for (Session& session : sessions)
+            session.tokens = std::min(session.tokens, sessionBurst);
+        // lifting the limit releases throttled sessions right away
+        mailboxCondition.notify_one();
+    }
+
+    std::string getMetrics(void) {
+        if (agentMode == AgentMode::SERVER) {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            metrics::set(metrics::Gauge::Sessions, static_cast<int64_t>(sessions.size()));
+            metrics::set(metrics::Gauge::ScheduledCommands, static_cast<int64_t>(scheduledCount));
+        }
+        return metrics::exposition(metrics::snapshot());
+    }
+
+    std::string getAllocationReport(void) {
+        return alloc::report();
+    }
+
+    bool getServiceMetrics(std::string& text, uint32_t timeoutMs) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("getServiceMetrics() is only available in CLIENT mode");
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(statsMutex);
+        awaitedStatsId = nextStatsId++;
+        statsAnswered = false;
+        if (udp::send(serializeStatsPayload(awaitedStatsId)) != udp::Status::Success) {
+            awaitedStatsId = 0;
+            return false;
+        }
+        bool answered = statsCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                [] { return statsAnswered; });
+        awaitedStatsId = 0;
+        if (!answered)
+            return false;
+        text.swap(statsText);
+        statsText.clear();
+        return true;
+    }
+
+    void startTrace(void) {
+        trace::start();
+    }
+
+    void stopTrace(void) {
+        trace::stop();
+    }
+
+    bool writeTrace(const std::string& path) {
+        trace::Status status = trace::writeChromeTrace(path, GetCurrentProcessId());
+        if (status != trace::Status::Success) {
+            ERROR_PRINT("Failed to write trace to " << path << " (status: "
+                    << static_cast<int>(status) << ")");
+            return false;
+        }
+        uint64_t dropped = trace::getDropped();
+        if (dropped)
+            INFO_PRINT("Trace written to " << path << ", " << dropped << " spans did not fit");
+        else
+            INFO_PRINT("Trace written to " << path);
+        return true;
+    }
+
+    bool startRecording(const std::string& path) {
+        recorder::Status status = recorder::start(path);
+        if (status != recorder::Status::Success) {
+            ERROR_PRINT("Failed to start recording to " << path << " (status: "
+                    << static_cast<int>(status) << ")");
+            return false;
+        }
+        INFO_PRINT("Recording HID reports to " << path);
+        return true;
+    }
+
+    void stopRecording(void) {
+        uint64_t captured = recorder::getCaptured();
+        recorder::stop();
+        INFO_PRINT("Recording stopped after " << captured << " reports");
+    }
+
+    void setActuationProbe(bool enable) {
+        if (agentMode == AgentMode::CLIENT) {
+            ERROR_PRINT("Not applicable in CLIENT mode");
+            return;
+        }
+        if (enable) {
+            std::lock_guard<std::mutex> lock(actuationMutex);
+            actuationProbe = ActuationProbe();
+            for (ActuationLink& link : actuationLinks) {
+                link.stats = ActuationStats();
+                link.count = 0;
+            }
+            feedbackKnown = false;
+        }
+        actuationEnabled = enable;
+        INFO_PRINT("Actuation probe " << (enable ? "enabled" : "disabled"));
+        if (agentMode == AgentMode::SERVER) {
+            // the writer starts (or stops) reading between writes
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            mailboxCondition.notify_one();
+        } else if (enable) {
+            // the first probe needs the feedback from before its write
+            DS5W::DS5InputState state;
+            readInputReport(state);
+        }
+    }
+
+    ActuationStats getActuationStats(ControllerConnection connection) {
+        if (connection == ControllerConnection::None)
+            return ActuationStats();
+        std::lock_guard<std::mutex> lock(actuationMutex);
+        const ActuationLink& link = actuationLinks[connection == ControllerConnection::Bluetooth ? 1 : 0];
+        ActuationStats stats = link.stats;
+        size_t samples = std::min<size_t>(link.count, ACTUATION_WINDOW);
+        std::vector<double> latencies(link.latencyUs, link.latencyUs + samples);
+        std::sort(latencies.begin(), latencies.end());
+        if (!latencies.empty()) {
+            stats.minUs = latencies.front();
+            stats.maxUs = latencies.back();
+        }
+        stats.p50Us = percentile(latencies, 50.0);
+        stats.p90Us = percentile(latencies, 90.0);
+        stats.p99Us = percentile(latencies, 99.0);
+        return stats;
+    }
+
+    void setInputPublishing(uint16_t rateHz) {
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        publishRateHz = std::min<uint16_t>(rateHz, MAX_INPUT_RATE_HZ);
+        nextPublishNs = monotonicNs();
+        // the device thread picks up the new deadline
+        mailboxCondition.notify_one();
+    }
+
+    bool readInputSnapshot(DS5W::DS5InputState& state, uint64_t* sequence,
+                    int64_t* timestampNs, uint16_t port) {
+        ALLOC_SCOPE("readInputSnapshot");
+        uint64_t published = 0;
+        int64_t readNs = 0;
+        if (shm::readInput(port, &state, sizeof(state), published, readNs) != shm::Status::Success)
+            return false;
+        if (sequence)
+            *sequence = published;
+        if (timestampNs)
+            *timestampNs = readNs;
+        return true;
+    }
+
+    std::vector<ClientStats> getClientStats(void) {
+        std::vector<ClientStats> stats;
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        for (const Session& session : sessions) {
+            ClientStats client;
+            client.pid = session.pid;
+            client.priority = session.priority;
+            client.updates = session.updates;
+            client.throttled = session.throttled;
+            client.deferredWrites = session.deferredWrites;
+            client.scheduleRejected = session.scheduleRejected;
+            stats.push_back(client);
+        }
+        return stats;
     }
-    for (int i = lastIdx + 1; i < TRIGGER_BUFFER_SZ; i++) {
-        buffer[i] = 0;
+
+    // ties a UDP sender to its client PID and priority
+    // (mailboxMutex must be held)
+    void bindSession(const udp::Peer& peer, uint32_t pid, uint8_t priority) {
+        Session* session = findSession(peer, pid);
+        // the client may have used the ring before binding its UDP socket
+        if (!session)
+            session = findSession(udp::Peer(), pid);
+        if (!session)
+            session = &openSession(peer, pid);
+        session->peer = peer;
+        session->pid = pid;
+        session->priority = priority;
+        session->lastActive = ++sessionClock;
+        publishResolved();
     }
-}
 
-// create a vector by adding first as the first elment and and the provided
-// vector as the rest
-template<typename T>
-std::vector<T> prepend(const T& first, const std::vector<T>& rest) {
-    std::vector<T> result;
-    result.reserve(1 + rest.size());
-    result.push_back(first);
-    result.insert(result.end(), rest.begin(), rest.end());
-    return result;
-}
+    void setClientExitCallback(ClientExitFunc callback) {
+        clientExitCallback = callback;
+    }
 
+    // runs on a thread pool thread once a bound client process has exited
+    void onClientExit(uint32_t pid) {
+        INFO_PRINT("Client PID " << pid << " exited, releasing its triggers");
+        uint32_t remaining = 0;
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                    [pid](const Session& session) { return session.pid == pid; }),
+                sessions.end());
+            publishResolved();
+            if (writeRequested)
+                mailboxCondition.notify_one();
+            for (const Session& session : sessions) {
+                if (session.pid)
+                    remaining++;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(clientPidMutex);
+            if (clientPid == pid)
+                clientPid = 0;
+        }
+        ClientExitFunc callback = clientExitCallback;
+        if (callback)
+            callback(pid, remaining);
+    }
 
-namespace dualsensitive {
+    // adds a command to the timer wheel (mailboxMutex must be held)
+    void scheduleCommand(ScheduledCommand&& scheduled) {
+        int64_t tick = scheduled.applyAtNs / WHEEL_TICK_NS;
+        if (scheduledCount == 0)
+            wheelTick = monotonicNs() / WHEEL_TICK_NS;
+        // late commands go to the next slot visited
+        if (tick < wheelTick)
+            tick = wheelTick;
+        nextDeadlineNs = std::min(nextDeadlineNs, scheduled.applyAtNs);
+        wheel[tick & (WHEEL_SLOTS - 1)].push_back(std::move(scheduled));
+        scheduledCount++;
+    }
 
-    // These control the active mode
-    static AgentMode agentMode = AgentMode::SOLO;
-    static uint16_t udpPort = 28472;
-    static std::mutex initMutex;
-    static bool hasInit = false;
-    // only if enabled is true, the DualSense settings will be sent to
-    // controller
-    static std::mutex enabledMutex;
-    static bool enabled = true;
-    static std::mutex clientPidMutex;
-    static uint32_t clientPid;
+    // visits the slots from the last visited tick up to now and moves the
+    // commands whose deadline has passed into due (mailboxMutex must be held)
+    void takeDueCommands(int64_t now, std::vector<ScheduledCommand>& due) {
+        int64_t nowTick = now / WHEEL_TICK_NS;
+        // one full turn visits every slot
+        if (nowTick - wheelTick >= WHEEL_SLOTS)
+            wheelTick = nowTick - WHEEL_SLOTS + 1;
+        for (; scheduledCount; wheelTick++) {
+            std::vector<ScheduledCommand>& slot = wheel[wheelTick & (WHEEL_SLOTS - 1)];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].applyAtNs > now) {
+                    i++;
+                    continue;
+                }
+                due.push_back(std::move(slot[i]));
+                slot[i] = std::move(slot.back());
+                slot.pop_back();
+                scheduledCount--;
+            }
+            // the current tick's slot may still hold commands due later
+            if (wheelTick == nowTick)
+                break;
+        }
 
-    // support a single controller for now (on SOLO and SERVER modes only)
-    DS5W::DeviceContext controller;
-    // structure to keep the state to send out to controller
-    // (on SOLO and CLIENT modes only)
-    DS5W::DS5OutputState outState;
+        nextDeadlineNs = INT64_MAX;
+        if (!scheduledCount)
+            return;
+        for (const std::vector<ScheduledCommand>& slot : wheel) {
+            for (const ScheduledCommand& scheduled : slot)
+                nextDeadlineNs = std::min(nextDeadlineNs, scheduled.applyAtNs);
+        }
+    }
 
-    bool isConnected(void) {
-        if (agentMode == AgentMode::CLIENT) {
-            ERROR_PRINT("Not applicable in CLIENT mode");
-            return false;
+    // applies the commands whose deadline has passed to their sessions and
+    // requests a write even if the resolved state does not change, so the
+    // controller is written at the deadline (mailboxMutex must be held)
+    void fireScheduled(int64_t now) {
+        static std::vector<ScheduledCommand> due;
+        takeDueCommands(now, due);
+        for (const ScheduledCommand& scheduled : due) {
+            // the client has exited or was evicted meanwhile
+            Session* session = findSession(scheduled.peer, scheduled.pid);
+            if (!session)
+                continue;
+            // a session opened after an eviction has none of these
+            if (session->scheduled)
+                session->scheduled--;
+            PendingAck pending = { scheduled.peer, scheduled.sequence, scheduled.receivedNs };
+            if (!applySessionCommands(*session, scheduled.commands.data(),
+                        scheduled.commands.size(), now)) {
+                if (scheduled.ackRequested)
+                    session->deferredAcks.push_back(pending);
+                continue;
+            }
+            publishResolved();
+            writeRequested = true;
+            if (!scheduled.ackRequested)
+                continue;
+            for (const TriggerCommand& command : scheduled.commands) {
+                if (!sessionApplies(*session, command.trigger))
+                    pending.result = ApplyResult::Overridden;
+            }
+            mailboxAcks.push_back(pending);
         }
-        DS5W::DS5InputState inState;
-        return DS5W_SUCCESS(DS5W::getDeviceInputState(&controller, &inState));
+        due.clear();
     }
 
-    uint32_t getClientPid(void) {
-        std::lock_guard<std::mutex> lock(clientPidMutex);
-        return clientPid;
+    // earliest input update due to a subscriber or the actuation probe,
+    // INT64_MAX if there is none (mailboxMutex must be held)
+    int64_t nextInputPollNs(void) {
+        // the probe watches every report; a read waits for the next one
+        if (actuationEnabled.load(std::memory_order_relaxed) && controller._internal.connected)
+            return 0;
+        int64_t next = publishRateHz ? nextPublishNs : INT64_MAX;
+        for (const Session& session : sessions) {
+            if (session.inputRateHz)
+                next = std::min(next, session.nextInputNs);
+        }
+        return next;
     }
 
-    // XXX This should be called in a block where the initMutex lock has been acquired
-    Status connectToController() {
-        std::vector<DS5W::DeviceEnumInfo> controllersInfo;
+    // reads the controller once, publishes the state to shared memory and
+    // sends every due subscriber the bytes that changed since its previous
+    // update; runs on the writer thread, which owns the device (lock holds
+    // mailboxMutex, released around the read and the sends)
+    void streamInput(std::unique_lock<std::mutex>& lock) {
+        static std::vector<std::pair<udp::Peer, std::vector<uint8_t>>> updates;
+
+        lock.unlock();
+        DS5W::DS5InputState state;
+        uint8_t packed[PACKED_INPUT_SIZE];
+        bool read = readInputReport(state);
+        updateControllerLink();
+        int64_t now = monotonicNs();
+        if (read) {
+            packInputState(state, packed);
+            if (inputPublished)
+                shm::publishInput(&state, now);
+        }
+        lock.lock();
 
-        Status status;
-        for (int attempt = 0; attempt < MAX_RETRIES; ++attempt) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY_MS));
-            DEBUG_PRINT("Device disconnected! Attempt " << (attempt+1) << " to reconnect...");
+        if (publishRateHz && nextPublishNs <= now) {
+            nextPublishNs += 1000000000LL / publishRateHz;
+            if (nextPublishNs < now)
+                nextPublishNs = now;
+        }
 
-            if (scanControllers(controllersInfo) != 0) {
-                status = Status::NoControllersDetected;
+        for (Session& session : sessions) {
+            if (!session.inputRateHz || session.nextInputNs > now)
+                continue;
+            session.nextInputNs += 1000000000LL / session.inputRateHz;
+            if (session.nextInputNs < now)
+                session.nextInputNs = now;
+            if (!read)
+                continue;
+
+            bool keyframe = session.keyframeNeeded
+                || now - session.lastKeyframeNs >= INPUT_KEYFRAME_INTERVAL_MS * 1000000LL;
+            if (session.inputFlags & SUBSCRIBE_FULL_STATE) {
+                // network mode: every update is a timestamped keyframe, and
+                // a new snapshot goes out again on the following ticks
+                // under the same sequence
+                bool changed = session.keyframeNeeded
+                    || memcmp(session.lastInput, packed, PACKED_INPUT_SIZE) != 0;
+                if (changed) {
+                    session.inputSequence++;
+                    session.repeatsLeft = session.inputRepeats;
+                } else if (session.repeatsLeft) {
+                    session.repeatsLeft--;
+                } else if (!keyframe) {
+                    continue;
+                }
+                session.keyframeNeeded = false;
+                session.lastKeyframeNs = now;
+                memcpy(session.lastInput, packed, PACKED_INPUT_SIZE);
+                updates.emplace_back(session.peer,
+                        serializeInputPayload(session.inputSequence, packed, nullptr, now));
                 continue;
             }
-            // set the first DualSense controller found as our main controller
-            if (!DS5W_SUCCESS (
-                DS5W::initDeviceContext(&controllersInfo[0], &controller) )) {
-                ERROR_PRINT("Init failed");
-                status = Status::InitFailed;
+            std::vector<uint8_t> payload = serializeInputPayload(
+                    session.inputSequence + 1, packed, keyframe ? nullptr : session.lastInput);
+            // unchanged state costs nothing
+            if (!keyframe && payload.size() == INPUT_HEADER_SIZE)
                 continue;
+            session.inputSequence++;
+            if (keyframe) {
+                session.keyframeNeeded = false;
+                session.lastKeyframeNs = now;
             }
-            status = Status::Ok;
-            DEBUG_PRINT("DualSense controller connnected");
-            hasInit = true;
-            ZeroMemory(&outState, sizeof(DS5W::DS5OutputState));
+            memcpy(session.lastInput, packed, PACKED_INPUT_SIZE);
+            updates.emplace_back(session.peer, std::move(payload));
+        }
 
-            // enable red color by default with medium intensity
-            outState.lightbar = DS5W::color_R8G8B8_UCHAR_A32_FLOAT(255, 0, 0, 128);
-            outState.disableLeds = false;
-            break;
+        lock.unlock();
+        for (const auto& update : updates)
+            udp::sendTo(update.first, update.second);
+        updates.clear();
+        lock.lock();
+    }
+
+    // SERVER mode device thread: each wakeup takes the latest command of
+    // each trigger and writes them to the controller at once, fires the
+    // scheduled commands that are due, and polls the controller's input
+    // when a subscriber is due
+    void writerLoop(void) {
+        MailboxSlot taken[2];
+        std::vector<PendingAck> acks;
+        std::vector<uint32_t> unwatched;
+
+        std::unique_lock<std::mutex> lock(mailboxMutex);
+        while (true) {
+            if (!evictedPids.empty()) {
+                unwatched.swap(evictedPids);
+                lock.unlock();
+                for (uint32_t pid : unwatched)
+                    procwatch::unwatch(pid);
+                unwatched.clear();
+                lock.lock();
+            }
+            int64_t now = monotonicNs();
+            int64_t releaseNs = nextReleaseNs();
+            if (releaseNs <= now) {
+                releaseDeferred(now);
+                releaseNs = nextReleaseNs();
+            }
+            int64_t expiryNs = nextSessionExpiryNs();
+            if (expiryNs <= now) {
+                expireSessions(now);
+                expiryNs = nextSessionExpiryNs();
+            }
+            if (nextDeadlineNs <= now) {
+                fireScheduled(now);
+            } else if (nextDeadlineNs - now <= SCHEDULE_SPIN_NS && !writeRequested
+                    && writerRunning) {
+                // too close to sleep; yield until the deadline unless
+                // something else needs writing first
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
+            }
+            int64_t pollNs = nextInputPollNs();
+            bool pollDue = pollNs <= now;
+            if (!writeRequested) {
+                if (!writerRunning)
+                    break;
+                int64_t wakeNs = nextDeadlineNs == INT64_MAX
+                    ? pollNs : std::min<int64_t>(pollNs, nextDeadlineNs - SCHEDULE_SPIN_NS);
+                wakeNs = std::min({ wakeNs, releaseNs, expiryNs });
+                if (pollDue) {
+                    streamInput(lock);
+                } else if (wakeNs == INT64_MAX) {
+                    mailboxCondition.wait(lock);
+                } else {
+                    mailboxCondition.wait_until(lock, std::chrono::steady_clock::time_point(
+                            std::chrono::nanoseconds(wakeNs)));
+                }
+                continue;
+            }
+            for (uint8_t i = 0; i < 2; i++) {
+                std::swap(taken[i], mailbox[i]);
+                mailbox[i].full = false;
+            }
+            acks.swap(mailboxAcks);
+            uint64_t generation = requestedGeneration;
+            writeRequested = false;
+            lock.unlock();
+
+            ApplyResult result;
+            {
+                ALLOC_SCOPE("writer: mailbox write");
+                for (uint8_t i = 0; i < 2; i++) {
+                    if (taken[i].full)
+                        stageTrigger(static_cast<Trigger>(i), taken[i].profile, taken[i].extras, taken[i].extrasSize);
+                }
+                result = writeState();
+            }
+
+            // every acknowledged command of the write shares its outcome
+            int64_t appliedNs = monotonicNs();
+            for (const PendingAck& pending : acks) {
+                AckPayload ack = {
+                    pending.sequence,
+                    pending.result == ApplyResult::Applied ? result : pending.result,
+                    pending.receivedNs,
+                    appliedNs
+                };
+                udp::sendTo(pending.peer, serializeAckPayload(ack));
+            }
+            acks.clear();
+
+            lock.lock();
+            writtenGeneration = generation;
+            writtenCondition.notify_all();
+
+            // a steady stream of writes must not starve the subscribers
+            if (pollDue)
+                streamInput(lock);
         }
-        return status;
+        writtenCondition.notify_all();
     }
 
-    void ensureConnected(void) {
-        if (agentMode == AgentMode::CLIENT) {
-            ERROR_PRINT("Not applicable in CLIENT mode");
-            return;
+    void stopWriter(void) {
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            writerRunning = false;
         }
+        mailboxCondition.notify_one();
+        if (writerThread.joinable())
+            writerThread.join();
+    }
 
-        if (isConnected())
-            return;
+    // batch end handler of the SERVER transports: a burst of trigger
+    // payloads wakes the writer once
+    void wakeWriter(void) {
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        if (writeRequested)
+            mailboxCondition.notify_one();
+    }
 
-        std::lock_guard<std::mutex> lock(initMutex);
-        if (hasInit) {
-            // try to reconnect to the same controller
-            ERROR_PRINT("Device disconnected! Try to reconnect");
-            if (DS5W::reconnectDevice(&controller) == DS5W_OK)
-                return;
-        }
-        connectToController();
+    // wakes the writer and waits until everything posted so far has been
+    // written (lock must hold mailboxMutex)
+    void flushMailbox(std::unique_lock<std::mutex>& lock) {
+        writeRequested = true;
+        uint64_t generation = ++requestedGeneration;
+        mailboxCondition.notify_one();
+        writtenCondition.wait(lock, [generation] {
+            return writtenGeneration >= generation || !writerRunning;
+        });
     }
 
-    bool assignTriggersFromPayload(const std::vector<uint8_t> payload) {
-        Trigger trigger;
-        TriggerProfile profile;
-        std::vector<uint8_t> extras;
+    // data starts after the payload type byte
+    bool assignTriggersFromPayload(const uint8_t* data, size_t size, const udp::Peer& peer) {
+        // one command per receive thread, so its extras keep their capacity
+        static thread_local TriggerCommand command;
 
-        if (!deserializeTriggerPayload(payload, trigger, profile, extras)) {
+        if (!deserializeTriggerPayload(data, size, command)) {
             ERROR_PRINT("failed to deserialize payload!");
             return false;
         }
-        outState.triggerSettingEnabled = true;
-        switch (trigger) {
-            case Trigger::Left:
-                setLeftTrigger(profile, extras);
-                break;
-            case Trigger::Right:
-                setRightTrigger(profile, extras);
-                break;
-            default:
-                DEBUG_PRINT("Unknown trigger type!");
-                return false;
-        };
+        if (command.trigger != Trigger::Left && command.trigger != Trigger::Right) {
+            ERROR_PRINT("Unknown trigger type!");
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        Session& session = openSession(peer, senderPid(peer));
+        if (applySessionCommands(session, &command, 1, monotonicNs()))
+            publishResolved();
+        else
+            mailboxCondition.notify_one(); // the writer picks up the release time
         return true;
     }
 
@@ -691,22 +2351,95 @@ namespace dualsensitive {
         switch (mode) {
             case AgentMode::CLIENT:
                 udpPort = port;
-                if (udp::startClient(udpPort) != udp::Status::Success)
+                if (networkStreaming) {
+                    if (!networkOptions.address.empty()
+                            && udp::setServerAddress(networkOptions.address) != udp::Status::Success) {
+                        ERROR_PRINT("Invalid service address: " << networkOptions.address);
+                        return Status::InitFailed;
+                    }
+                    udp::setPacketLoss(networkOptions.packetLoss);
+                }
+                // kept across init() calls, like the send queue
+                if (!senderWake)
+                    senderWake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+                if (!senderWake) {
+                    ERROR_PRINT("Failed to create the sender wake event");
+                    return Status::InitFailed;
+                }
+                if (udp::startClient(udpPort, handleReply) != udp::Status::Success)
                     return Status::InitFailed;
+                // the ring only reaches a service on this host
+                commandsSupported = false;
+                lastCommandProbeNs = 0;
+                if (transport == Transport::SHARED_MEMORY && !networkStreaming) {
+                    shm::Status shmStatus = shm::startClient(udpPort);
+                    shmActive = shmStatus == shm::Status::Success;
+                    if (shmActive)
+                        commandsSupported = true;
+                    if (!shmActive) {
+                        INFO_PRINT("Shared-memory ring unavailable (status: "
+                            << static_cast<int>(shmStatus) << "), using UDP");
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lock(clientStateMutex);
+                    for (TriggerShadow& shadow : shadows)
+                        shadow = TriggerShadow();
+                    shadowsStale = false;
+                    stagedUpdates = 0;
+                    shmFallbackBound = false;
+                }
+                if (!sendQueue || sendQueue->capacity() < sendQueueCapacity)
+                    sendQueue.reset(new lockfree::BoundedQueue<QueuedTrigger>(sendQueueCapacity));
+                senderRunning = true;
+                keepaliveDeadline = std::chrono::steady_clock::now();
+                senderThread = std::thread(senderLoop);
                 hasInit = true;
                 return Status::Ok;
             case AgentMode::SERVER: {
                 udpPort = port;
-                auto callback = [](const std::vector<uint8_t>& payload) {
+                if (networkStreaming) {
+                    if (!networkOptions.address.empty()
+                            && udp::setBindAddress(networkOptions.address) != udp::Status::Success) {
+                        ERROR_PRINT("Invalid bind address: " << networkOptions.address);
+                        return Status::InitFailed;
+                    }
+                    udp::setPacketLoss(networkOptions.packetLoss);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mailboxMutex);
+                    sessions.clear();
+                    sessions.reserve(MAX_SESSIONS);
+                    evictedPids.clear();
+                    // the resolved state is assigned on every update, so
+                    // it never has to grow once this room is there
+                    for (SessionTrigger& setting : resolved)
+                        setting.extras.reserve(TRIGGER_EXTRAS_MAX);
+                    for (std::vector<ScheduledCommand>& slot : wheel)
+                        slot.clear();
+                    scheduledCount = 0;
+                    nextDeadlineNs = INT64_MAX;
+                    writerRunning = true;
+                }
+                writerThread = std::thread(writerLoop);
+
+                // runs on both receive threads
+                auto callback = [](const std::vector<uint8_t>& payload, const udp::Peer& peer) {
+                    static thread_local std::vector<TriggerCommand> receivedCommands;
+                    int64_t receivedNs = monotonicNs();
                     if (payload.empty()) {
+                        metrics::add(metrics::Counter::PayloadsMalformed);
                         ERROR_PRINT("Payload empty!");
                         return;
                     }
                     PayloadType type = static_cast<PayloadType>(payload[0]);
+                    if (networkStreaming && peer.port && !admitPeer(peer, payload, receivedNs))
+                        return;
 
                     switch (type) {
                         case PayloadType::BIND: {
                             if (payload.size() < PAYLOAD_TYPE_SIZE + PID_SIZE) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
                                 ERROR_PRINT("Bind PID payload too small!");
                                 return;
                             }
@@ -715,38 +2448,224 @@ namespace dualsensitive {
                                     payload.begin() + 1,
                                     payload.end()
                             );
+                            uint32_t pid = 0;
+                            uint8_t priority = 0;
+                            if (!deserializeBindPayload(trimmed, pid, priority)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                ERROR_PRINT("failed to deserialize Bind PID payload!");
+                                return;
+                            }
                             {
                                 std::lock_guard<std::mutex> lock(clientPidMutex);
-                                if (!deserializeBindPayload(trimmed, clientPid)) {
-                                    ERROR_PRINT("failed to deserialize Bind PID payload!");
-                                    return;
-                                }
+                                clientPid = pid;
+                            }
+                            {
+                                std::lock_guard<std::mutex> lock(mailboxMutex);
+                                bindSession(peer, pid, priority);
+                            }
+                            // processes on other hosts cannot be watched
+                            if (peer.port && !udp::isLocal(peer))
+                                break;
+                            procwatch::Status watchStatus = procwatch::watch(pid, onClientExit);
+                            if (watchStatus == procwatch::Status::ProcessNotFound) {
+                                // exited before we could watch it
+                                onClientExit(pid);
+                            } else if (watchStatus != procwatch::Status::Success) {
+                                ERROR_PRINT("Cannot watch client PID " << pid << " (status: "
+                                    << static_cast<int>(watchStatus) << ")");
                             }
                             break;
                         }
                         case PayloadType::TRIGGER: {
                             if (payload.size() < MIN_PAYLOAD_SIZE + PAYLOAD_TYPE_SIZE) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
                                 ERROR_PRINT("Trigger payload size less than expected!");
                                 return;
                             }
-                            // skip the payload type
-                            std::vector<uint8_t> trimmed (
-                                    payload.begin() + 1,
-                                    payload.end()
-                            );
-                            if(!assignTriggersFromPayload(trimmed)) {
+                            if (!assignTriggersFromPayload(payload.data() + PAYLOAD_TYPE_SIZE,
+                                    payload.size() - PAYLOAD_TYPE_SIZE, peer)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
                                 ERROR_PRINT("Could not set triggers from payload!");
                                 return;
                             }
                             break;
                         }
+                        case PayloadType::COMMAND: {
+                            uint8_t flags = 0;
+                            uint32_t sequence = 0;
+                            int64_t applyAtNs = 0;
+                            // only UDP senders can be answered
+                            bool ackRequested = false;
+                            if (!deserializeCommandPayload(payload, flags, sequence, receivedCommands, applyAtNs)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                ERROR_PRINT("failed to deserialize command payload!");
+                                if ((flags & COMMAND_ACK_REQUESTED) && peer.port) {
+                                    AckPayload ack = { sequence, ApplyResult::Rejected, receivedNs, receivedNs };
+                                    udp::sendTo(peer, serializeAckPayload(ack));
+                                }
+                                return;
+                            }
+                            ackRequested = (flags & COMMAND_ACK_REQUESTED) && peer.port;
+                            if (flags & COMMAND_APPLY_AT) {
+                                // held in the timer wheel, acknowledged
+                                // once written at the deadline
+                                std::lock_guard<std::mutex> lock(mailboxMutex);
+                                Session& session = openSession(peer, senderPid(peer));
+                                session.lastActive = ++sessionClock;
+                                // bounds the wheel a single client can fill
+                                if (session.scheduled >= MAX_SCHEDULED_PER_SESSION
+                                        || applyAtNs - receivedNs > MAX_SCHEDULE_AHEAD_MS * 1000000LL) {
+                                    session.scheduleRejected++;
+                                    DEBUG_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS,
+                                        "Rejected a scheduled command: " << session.scheduled
+                                        << " waiting, due in " << (applyAtNs - receivedNs) / 1000000 << " ms");
+                                    if (ackRequested) {
+                                        AckPayload ack = { sequence, ApplyResult::Rejected, receivedNs, receivedNs };
+                                        udp::sendTo(peer, serializeAckPayload(ack));
+                                    }
+                                    break;
+                                }
+                                session.scheduled++;
+                                scheduleCommand({ peer, session.pid, applyAtNs, receivedNs,
+                                        sequence, ackRequested, receivedCommands });
+                                mailboxCondition.notify_one();
+                                break;
+                            }
+                            // commands that change nothing on the controller
+                            // are acknowledged right away
+                            bool ackNow = false;
+                            ApplyResult result = ApplyResult::Applied;
+                            {
+                                std::lock_guard<std::mutex> lock(mailboxMutex);
+                                Session& session = openSession(peer, senderPid(peer));
+                                // a copy, or overtaken by a newer command
+                                if (session.commandSeen && static_cast<int32_t>(
+                                            sequence - session.lastCommandSequence) <= 0) {
+                                    staleCommands++;
+                                    break;
+                                }
+                                session.commandSeen = true;
+                                session.lastCommandSequence = sequence;
+                                if (!applySessionCommands(session, receivedCommands.data(),
+                                            receivedCommands.size(), receivedNs)) {
+                                    // over budget: acknowledged once the
+                                    // merged update is written
+                                    if (ackRequested)
+                                        session.deferredAcks.push_back({ peer, sequence, receivedNs });
+                                    mailboxCondition.notify_one();
+                                    break;
+                                }
+                                publishResolved();
+                                for (const TriggerCommand& command : receivedCommands) {
+                                    if (!sessionApplies(session, command.trigger))
+                                        result = ApplyResult::Overridden;
+                                }
+                                if (ackRequested) {
+                                    ackNow = result == ApplyResult::Overridden || !writeRequested;
+                                    if (!ackNow)
+                                        mailboxAcks.push_back({ peer, sequence, receivedNs });
+                                }
+                            }
+                            if (ackNow) {
+                                AckPayload ack = { sequence, result, receivedNs, monotonicNs() };
+                                udp::sendTo(peer, serializeAckPayload(ack));
+                            }
+                            break;
+                        }
+                        case PayloadType::HELLO: {
+                            ReadyPayload ready;
+                            if (!deserializeHelloPayload(payload, ready.nonce)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                return;
+                            }
+                            if (!peer.port)
+                                return;
+                            ready.connection = controllerLink;
+                            ready.flags = (ready.connection != ControllerConnection::None
+                                    ? READY_CONTROLLER_CONNECTED : 0)
+                                | (isEnabled() ? READY_ENABLED : 0)
+                                | (shmServing ? READY_SHARED_MEMORY : 0)
+                                | READY_COMMANDS;
+                            udp::sendTo(peer, serializeReadyPayload(ready));
+                            break;
+                        }
+                        case PayloadType::TIME_SYNC: {
+                            TimeSyncPayload sync;
+                            if (!deserializeTimeSyncPayload(payload, sync)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                return;
+                            }
+                            if (!peer.port) {
+                                ERROR_PRINT("Clock sync needs the UDP transport!");
+                                return;
+                            }
+                            sync.serviceReceiveNs = receivedNs;
+                            sync.serviceSendNs = monotonicNs();
+                            udp::sendTo(peer, serializeTimeSyncPayload(sync));
+                            break;
+                        }
+                        case PayloadType::SUBSCRIBE: {
+                            uint16_t rateHz = 0;
+                            uint8_t flags = 0;
+                            uint8_t repeats = 0;
+                            if (!deserializeSubscribePayload(payload, rateHz, flags, repeats)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                return;
+                            }
+                            if (!peer.port) {
+                                ERROR_PRINT("Input subscriptions need the UDP transport!");
+                                return;
+                            }
+                            std::lock_guard<std::mutex> lock(mailboxMutex);
+                            Session& session = openSession(peer, 0);
+                            session.inputRateHz = std::min<uint16_t>(rateHz, MAX_INPUT_RATE_HZ);
+                            session.nextInputNs = monotonicNs();
+                            session.keyframeNeeded = true;
+                            session.inputFlags = flags;
+                            session.inputRepeats = repeats;
+                            session.repeatsLeft = 0;
+                            session.lastActive = ++sessionClock;
+                            // the device thread picks up the new deadline
+                            mailboxCondition.notify_one();
+                            break;
+                        }
+                        case PayloadType::STATS: {
+                            uint32_t id = 0;
+                            std::string text;
+                            if (!deserializeStatsPayload(payload, id, text)) {
+                                metrics::add(metrics::Counter::PayloadsMalformed);
+                                return;
+                            }
+                            if (!peer.port)
+                                return;
+                            udp::sendTo(peer, serializeStatsPayload(id, getMetrics()));
+                            break;
+                        }
                         default:
+                            metrics::add(metrics::Counter::PayloadsMalformed);
                             ERROR_PRINT("Unknown payload type: " << static_cast<uint8_t>(type) << "!");
                     };
                 };
 
-                if (udp::startServer(udpPort, callback) != udp::Status::Success)
+                // clients may also use the shared-memory ring; UDP keeps
+                // working if it cannot be created. It goes first, so a
+                // client answered by READY can count on it
+                shmServing = shm::startServer(udpPort, callback, wakeWriter) == shm::Status::Success;
+                if (!shmServing)
+                    ERROR_PRINT("Failed to create the shared-memory ring");
+                inputPublished = shm::startInputPublisher(udpPort, sizeof(DS5W::DS5InputState))
+                    == shm::Status::Success;
+                if (!inputPublished)
+                    ERROR_PRINT("Failed to create the input snapshot segment");
+                if (udp::startServer(udpPort, callback, wakeWriter) != udp::Status::Success) {
+                    shm::stopServer();
+                    shmServing = false;
+                    // the writer publishes input until it is joined
+                    stopWriter();
+                    inputPublished = false;
+                    shm::stopInputPublisher();
                     return Status::InitFailed;
+                }
                 break;
             }
             case AgentMode::SOLO:
@@ -770,10 +2689,33 @@ namespace dualsensitive {
 
         switch (agentMode) {
             case AgentMode::CLIENT:
+                // the sender sends what is still queued, then exits
+                senderRunning = false;
+                if (senderWake)
+                    SetEvent(senderWake);
+                if (senderThread.joinable())
+                    senderThread.join();
+                {
+                    std::lock_guard<std::mutex> lock(inputMutex);
+                    playoutRunning = false;
+                }
+                playoutCondition.notify_one();
+                if (playoutThread.joinable())
+                    playoutThread.join();
+                shm::stopClient();
+                shmActive = false;
                 udp::stopClient();
+                Logger::flush();
                 return;
             case AgentMode::SERVER:
+                shm::stopServer();
+                shmServing = false;
                 udp::stopServer();
+                procwatch::unwatchAll();
+                // the writer publishes input until it is joined
+                stopWriter();
+                inputPublished = false;
+                shm::stopInputPublisher();
                 break;
             case AgentMode::SOLO:
                 sendState();
@@ -784,6 +2726,7 @@ namespace dualsensitive {
         // only on SERVER and SOLO mode
 
         DS5W::freeDeviceContext(&controller);
+        Logger::flush();
     }
 
     void sendPidToServer(void) {
@@ -791,83 +2734,257 @@ namespace dualsensitive {
             ERROR_PRINT("sendPidToServer() is only available in CLIENT mode");
             return;
         }
-        udp::send(serializeBindPayload(GetCurrentProcessId()));
+        udp::send(serializeBindPayload(GetCurrentProcessId(), sessionPriority));
+    }
+
+    bool waitForService(uint32_t timeoutMs, ServiceState* state) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("waitForService() is only available in CLIENT mode");
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::milliseconds(timeoutMs);
+        ReadyPayload ready;
+        {
+            std::unique_lock<std::mutex> lock(readyMutex);
+            awaitedHelloNonce = static_cast<uint32_t>(monotonicNs()) | 1;
+            readyAnswered = false;
+            // datagrams to a port nobody listens on yet are lost, so probe
+            // again until the service is up
+            while (!readyAnswered) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= deadline)
+                    break;
+                udp::send(helloPayload(awaitedHelloNonce));
+                readyCondition.wait_until(lock,
+                    std::min(deadline, now + std::chrono::milliseconds(HELLO_RETRY_MS)),
+                    [] { return readyAnswered; });
+            }
+            awaitedHelloNonce = 0;
+            if (!readyAnswered) {
+                ERROR_PRINT("The service did not answer within " << timeoutMs << " ms");
+                return false;
+            }
+            ready = lastReady;
+        }
+        DEBUG_PRINT("Service ready after " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count() << " ms");
+
+        if (transport == Transport::SHARED_MEMORY && !networkStreaming
+                && (ready.flags & READY_SHARED_MEMORY)) {
+            std::lock_guard<std::mutex> lock(clientStateMutex);
+            if (!shmActive)
+                shmActive = shm::startClient(udpPort) == shm::Status::Success;
+            if (shmActive)
+                commandsSupported = true;
+        }
+        if (state) {
+            state->listening = true;
+            state->controllerConnected = (ready.flags & READY_CONTROLLER_CONNECTED) != 0;
+            state->connection = ready.connection;
+            state->enabled = (ready.flags & READY_ENABLED) != 0;
+            state->sharedMemory = (ready.flags & READY_SHARED_MEMORY) != 0;
+        }
+        return true;
+    }
+
+    // sends each command as a TRIGGER payload, for a service that may
+    // predate COMMAND payloads: no acknowledgement, no deadline and no
+    // sequence; a HELLO goes along now and then, and once its READY shows
+    // COMMAND support, sendCommands() switches over
+    // (clientStateMutex must be held)
+    bool sendTriggerPayloads(const TriggerCommand* commands, size_t count,
+                                        int64_t applyAtNs) {
+        int64_t now = monotonicNs();
+        if (now - lastCommandProbeNs >= COMMAND_PROBE_INTERVAL_MS * 1000000LL) {
+            lastCommandProbeNs = now;
+            udp::send(helloPayload(0));
+        }
+        if (applyAtNs) {
+            DEBUG_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS,
+                "The service has not shown it takes scheduled commands, applying now");
+        }
+        bool sent = true;
+        for (size_t i = 0; i < count; i++) {
+            std::vector<uint8_t> payload;
+            {
+                TRACE_SPAN("client.serialize");
+                payload = serializeTriggerPayload(
+                        commands[i].trigger, commands[i].profile, commands[i].extras);
+            }
+            if (udp::send(payload) != udp::Status::Success)
+                sent = false;
+        }
+        return sent;
+    }
+
+    bool sendCommands(const TriggerCommand* commands, size_t count,
+                                        int64_t applyAtNs) {
+        if (!commandsSupported.load(std::memory_order_relaxed))
+            return sendTriggerPayloads(commands, count, applyAtNs);
+        uint32_t sequence = nextSequence++;
+        // acknowledgements come back over UDP only
+        bool ackRequested = acksRequested && !shmActive;
+        // network mode: each packet carries the whole trigger state, so
+        // copies of it are harmless
+        bool fullState = networkStreaming && !applyAtNs;
+        uint8_t flags = (ackRequested ? COMMAND_ACK_REQUESTED : 0)
+            | (applyAtNs ? COMMAND_APPLY_AT : 0)
+            | (fullState ? COMMAND_FULL_STATE : 0);
+        std::vector<uint8_t> payload;
+        {
+            TRACE_SPAN("client.serialize");
+            payload = serializeCommandPayload(
+                    flags,
+                    sequence,
+                    commands,
+                    count,
+                    applyAtNs
+            );
+        }
+        if (shmActive) {
+            shm::Status shmStatus = shm::send(payload);
+            if (shmStatus == shm::Status::Success)
+                return true;
+            // e.g. the service has fallen a full ring behind; the service
+            // drops whichever of this and the records still in the ring
+            // comes out of order, by sequence, once both land in the same
+            // session
+            metrics::add(metrics::Counter::ShmFallbacks);
+            DEBUG_PRINT_LIMITED(DISCONNECT_LOG_INTERVAL_MS, "shm::send failed (status: "
+                << static_cast<int>(shmStatus) << "), sending over UDP");
+            if (!shmFallbackBound) {
+                udp::send(serializeBindPayload(GetCurrentProcessId(), sessionPriority));
+                shmFallbackBound = true;
+            }
+        }
+        if (ackRequested)
+            trackSend(sequence, applyAtNs);
+        bool sent = udp::send(payload) == udp::Status::Success;
+        if (fullState) {
+            fullStateSent++;
+            redundantPayload.swap(payload);
+            redundantLeft = networkOptions.redundancy;
+            redundantDeadline = std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(networkOptions.redundancySpacingMs);
+        } else {
+            // copies of an older state must not land after this command
+            redundantLeft = 0;
+        }
+        return sent;
+    }
+
+    void setTriggerAt(int64_t applyAtNs, Trigger trigger, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras) {
+        if (agentMode != AgentMode::CLIENT) {
+            ERROR_PRINT("Scheduled triggers are only available in CLIENT mode");
+            return;
+        }
+        if (extras.size() > TRIGGER_EXTRAS_MAX) {
+            ERROR_PRINT("Too many trigger parameters: " << extras.size());
+            return;
+        }
+        enqueueClientTrigger(trigger, triggerProfile, extras.data(), extras.size(),
+                std::max<int64_t>(applyAtNs, 1));
     }
 
+    // takes the extras as a plain array, so none of the modes needs a copy
+    // of them on the heap
     void setTrigger(Trigger trigger, TriggerProfile triggerProfile,
-                                                std::vector<uint8_t> extras){
+                                        const uint8_t* extras, size_t extrasSize) {
+        if (extrasSize > TRIGGER_EXTRAS_MAX) {
+            ERROR_PRINT("Too many trigger parameters: " << extrasSize);
+            return;
+        }
         switch (agentMode) {
-            case AgentMode::CLIENT: {
-                std::vector<uint8_t> payload = serializeTriggerPayload(
-                        trigger,
-                        triggerProfile,
-                        extras
-                );
-                udp::send(payload);
+            case AgentMode::CLIENT:
+                enqueueClientTrigger(trigger, triggerProfile, extras, extrasSize, 0);
+                break;
+            case AgentMode::SERVER: {
+                // direct calls made by the service itself (e.g. reset()) go
+                // through the writer too and return once written, so a
+                // following disable() cannot overtake them
+                // they bypass the sessions; the next change of a client's
+                // resolved state overrides them again
+                std::unique_lock<std::mutex> lock(mailboxMutex);
+                if (!postTrigger(trigger, triggerProfile, extras, extrasSize))
+                    break;
+                SessionTrigger& current = resolved[static_cast<uint8_t>(trigger)];
+                current.set = true;
+                current.profile = triggerProfile;
+                current.extras.assign(extras, extras + extrasSize);
+                flushMailbox(lock);
                 break;
             }
-            case AgentMode::SERVER:
-                // we need this so that assignTriggersFromPayload sets the
-                // triggers in server mode here
             case AgentMode::SOLO:
             default:
-                outState.triggerSettingEnabled = true;
-                if (trigger == Trigger::Left) {
-                    outState.leftTriggerSetting.profile = triggerProfile;
-                    outState.leftTriggerSetting.extras = extras;
-                } else if (trigger == Trigger::Right) {
-                    outState.rightTriggerSetting.profile = triggerProfile;
-                    outState.rightTriggerSetting.extras = extras;
-                } else {
-                    ERROR_PRINT("Unknown trigger type!");
+                if (!stageTrigger(trigger, triggerProfile, extras, extrasSize))
                     break;
-                }
                 sendState();
         }
     }
 
-    void setLeftTrigger(TriggerProfile triggerProfile, std::vector<uint8_t> extras) {
-       setTrigger(Trigger::Left, triggerProfile, extras);
+    // Custom profile: the mode goes first, then the extras
+    void setCustomTrigger(Trigger trigger, TriggerMode customMode,
+                                        const std::vector<uint8_t>& extras) {
+        if (extras.size() >= TRIGGER_EXTRAS_MAX) {
+            ERROR_PRINT("Too many trigger parameters: " << extras.size());
+            return;
+        }
+        uint8_t extendedExtras[TRIGGER_EXTRAS_MAX];
+        extendedExtras[0] = static_cast<uint8_t>(customMode);
+        if (!extras.empty())
+            memcpy(&extendedExtras[1], extras.data(), extras.size());
+        setTrigger(trigger, TriggerProfile::Custom, extendedExtras, extras.size() + 1);
+    }
+
+    void setLeftTrigger(TriggerProfile triggerProfile, const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setLeftTrigger");
+        setTrigger(Trigger::Left, triggerProfile, extras.data(), extras.size());
+    }
+
+    void setRightTrigger(TriggerProfile triggerProfile, const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setRightTrigger");
+        setTrigger(Trigger::Right, triggerProfile, extras.data(), extras.size());
     }
 
-    void setRightTrigger(TriggerProfile triggerProfile, std::vector<uint8_t> extras) {
-       setTrigger(Trigger::Right, triggerProfile, extras);
+    void setLeftTriggerAt(int64_t applyAtNs, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setLeftTriggerAt");
+        setTriggerAt(applyAtNs, Trigger::Left, triggerProfile, extras);
+    }
+
+    void setRightTriggerAt(int64_t applyAtNs, TriggerProfile triggerProfile,
+                                        const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setRightTriggerAt");
+        setTriggerAt(applyAtNs, Trigger::Right, triggerProfile, extras);
     }
 
     void setLeftCustomTrigger(TriggerMode customMode,
-                                        std::vector<uint8_t> extras) {
-        TriggerProfile profile = TriggerProfile::Custom;
-        std::vector<uint8_t> extendedExtras = prepend (
-                static_cast<uint8_t>(customMode),
-                extras
-        );
-        setTrigger(Trigger::Left, profile, extendedExtras);
+                                        const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setLeftCustomTrigger");
+        setCustomTrigger(Trigger::Left, customMode, extras);
     }
 
     void setRightCustomTrigger(TriggerMode customMode,
-                                        std::vector<uint8_t> extras) {
-        TriggerProfile profile = TriggerProfile::Custom;
-        std::vector<uint8_t> extendedExtras = prepend (
-                static_cast<uint8_t>(customMode),
-                extras
-        );
-        setTrigger(Trigger::Right, profile, extendedExtras);
+                                        const std::vector<uint8_t>& extras) {
+        ALLOC_SCOPE("setRightCustomTrigger");
+        setCustomTrigger(Trigger::Right, customMode, extras);
     }
 
     void sendState(void) {
-        {
-            std::lock_guard<std::mutex> lock(enabledMutex);
-            if (!enabled) {
-                DEBUG_PRINT("DualSensitive is disabled... Don't send any state");
-                return;
-            }
-        }
+        ALLOC_SCOPE("sendState");
         if (agentMode == AgentMode::CLIENT) {
-            ERROR_PRINT("Not applicable in CLIENT mode");
+            flushRequested = true;
+            wakeSender();
             return;
         }
-        ensureConnected();
-        DS5W::setDeviceOutputState(&controller, &outState);
+        if (agentMode == AgentMode::SERVER) {
+            std::unique_lock<std::mutex> lock(mailboxMutex);
+            flushMailbox(lock);
+            return;
+        }
+        writeState();
     }
 
     void disable(void) {
@@ -876,8 +2993,18 @@ namespace dualsensitive {
     }
 
     void enable(void) {
-        std::lock_guard<std::mutex> lock(enabledMutex);
-        enabled = true;
+        {
+            std::lock_guard<std::mutex> lock(enabledMutex);
+            enabled = true;
+        }
+        if (agentMode != AgentMode::SERVER)
+            return;
+        // bring the controller back to what the clients have asked for
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        for (SessionTrigger& current : resolved)
+            current.set = false;
+        publishResolved();
+        mailboxCondition.notify_one();
     }
 
     bool isEnabled(void) {
@@ -4,8 +4,6 @@
 #include <dualsensitive.h>
 #include <windows.h>
 #include <shellapi.h>
-#include <thread>
-#include <atomic>
 
 #include "resource.h"
 // Tray icon definitions
@@ -15,13 +13,20 @@
 #define ID_TRAY_DISABLE 1003
 #define TRAY_UID        1337
 
+// per-client trigger update budget; updates beyond it are merged, not lost
+#define SESSION_UPDATES_PER_SECOND 500
+#define SESSION_UPDATE_BURST 20
+// controller reads published to shared memory for local tools
+#define INPUT_PUBLISH_RATE_HZ 250
+// if set, the service traces its trigger path from start to exit and
+// writes the Chrome trace JSON to the file it names
+#define TRACE_ENV_VARIABLE "DUALSENSITIVE_TRACE"
+
 NOTIFYICONDATAW g_nid = {};
 HINSTANCE g_hInstance;
 HMENU g_hMenu;
 HWND g_hWnd;
-
-std::thread monitorThread;
-std::atomic<bool> monitorRunning = true;
+std::string g_tracePath;
 
 void setTrayIcon() {
     g_nid.cbSize = sizeof(NOTIFYICONDATA);
@@ -101,7 +106,6 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                     break;
                 case ID_TRAY_EXIT:
                     // Remove tray icon BEFORE window is destroyed to avoid ghosting
-                    monitorRunning = false;
                     Shell_NotifyIcon(NIM_DELETE, &g_nid);
                     PostMessage(g_hWnd, WM_CLOSE, 0, 0);
                     break;
@@ -111,10 +115,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             DestroyWindow(g_hWnd); // triggers WM_DESTROY
             break;
         case WM_DESTROY:
-            monitorRunning = false;
             dualsensitive::reset();
+            if (!g_tracePath.empty()) {
+                dualsensitive::stopTrace();
+                dualsensitive::writeTrace(g_tracePath);
+            }
             dualsensitive::terminate();
-            if (monitorThread.joinable()) monitorThread.join();
             PostQuitMessage(0);
             break;
         case WM_QUERYENDSESSION:
@@ -129,26 +135,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 }
 
 
-bool isProcessAlive(DWORD pid) {
-    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
-    if (!h) return false;
-    DWORD result = WaitForSingleObject(h, 0);
-    CloseHandle(h);
-    return result == WAIT_TIMEOUT;
-}
-
-void startMonitorThread() {
-    monitorThread = std::thread([] {
-        while (monitorRunning) {
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-            DWORD pid = (DWORD) dualsensitive::getClientPid();
-            if (pid && !isProcessAlive(pid)) {
-                // Client process exited, shutting down DualSensitive service...
-                PostMessage(g_hWnd, WM_CLOSE, 0, 0);
-                break;
-            }
-        }
-    });
+// the library has already released the exited client's triggers
+void onClientExit(uint32_t pid, uint32_t remainingClients) {
+    if (remainingClients == 0) {
+        // Last client process exited, shutting down DualSensitive service...
+        PostMessage(g_hWnd, WM_CLOSE, 0, 0);
+    }
 }
 
 // Entry point
@@ -186,6 +178,23 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     setTrayIcon();
     updateMenuState();
 
+    // make sure we shutdown the DualSensitive Service when the client app
+    // turns off
+    dualsensitive::setClientExitCallback(onClientExit);
+
+    // keep one chatty client from saturating the controller link
+    dualsensitive::setSessionRateLimit(SESSION_UPDATES_PER_SECOND, SESSION_UPDATE_BURST);
+
+    // overlays and other local tools read the live input without asking us
+    dualsensitive::setInputPublishing(INPUT_PUBLISH_RATE_HZ);
+
+    char tracePath[MAX_PATH];
+    DWORD tracePathLength = GetEnvironmentVariableA(TRACE_ENV_VARIABLE, tracePath, MAX_PATH);
+    if (tracePathLength > 0 && tracePathLength < MAX_PATH) {
+        g_tracePath = tracePath;
+        dualsensitive::startTrace();
+    }
+
     // Start DualSensitive UDP server
     OutputDebugStringW(L"Starting Dualsensitive Service...\n");
     auto status = dualsensitive::init(AgentMode::SERVER, "dualsensitive-service.log", false);
@@ -196,10 +205,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     }
     updateTrayIcon();
 
-    // Start monitor thread to make sure we shutdown the DualSensitive Service
-    // when the client app turns off
-    startMonitorThread();
-
     // Message loop
     MSG msg;
     while (GetMessage(&msg, nullptr, 0, 0)) {
@@ -0,0 +1,90 @@
+/*
+    Zero-allocation test of the hot path, for builds with
+    DUALSENSITIVE_ALLOC_TRACKING. Runs the library in-process in SOLO or
+    SERVER mode against DS5W's simulated controller, warms it up with a
+    rotation of trigger profiles, then checks that further
+    setLeftTrigger() / setRightTrigger() / sendState() calls, and in
+    SERVER mode the writer's mailbox writes, allocate nothing.
+
+    usage: alloc-test solo|server
+*/
+
+#include "../common/harness.h"
+#include <alloc.h>
+
+#include <string>
+#include <vector>
+
+#define TEST_PORT 28476
+#define WARMUP_ROUNDS 200
+#define MEASURED_ROUNDS 1000
+// time the writer gets to drain the last updates before the counts are read
+#define DRAIN_MS 200
+
+struct Update {
+    TriggerProfile profile;
+    std::vector<uint8_t> extras;
+};
+
+// held for the whole run, so the callers' vectors are not counted
+static const std::vector<Update> updates = {
+    { TriggerProfile::Normal, {} },
+    { TriggerProfile::Hard, {} },
+    { TriggerProfile::Resistance, { 2, 5 } },
+    { TriggerProfile::Machine, { 1, 8, 3, 3, 184, 0 } },
+    { TriggerProfile::SlopeFeedback, { 0, 5, 1, 8 } },
+};
+
+static void runRounds(int rounds) {
+    for (int i = 0; i < rounds; i++) {
+        const Update& left = updates[i % updates.size()];
+        const Update& right = updates[(i + 1) % updates.size()];
+        dualsensitive::setLeftTrigger(left.profile, left.extras);
+        dualsensitive::setRightTrigger(right.profile, right.extras);
+        dualsensitive::sendState();
+    }
+}
+
+static bool checkSite(const char* name) {
+    uint64_t calls = 0;
+    alloc::Counts counts = alloc::siteCounts(name, &calls);
+    std::cout << name << ": " << calls << " calls, " << counts.allocations
+              << " allocations, " << counts.bytes << " bytes" << std::endl;
+    bool passed = harness::check(calls > 0, "a site was never entered");
+    return harness::check(counts.allocations == 0, "a site allocated after warm-up") && passed;
+}
+
+int main(int argc, char** argv) {
+    if (!harness::check(alloc::isTracking(), "built without DUALSENSITIVE_ALLOC_TRACKING"))
+        return 1;
+    std::string modeName = argc == 2 ? argv[1] : "";
+    if (modeName != "solo" && modeName != "server") {
+        std::cerr << "usage: alloc-test solo|server" << std::endl;
+        return 1;
+    }
+    AgentMode mode = modeName == "solo" ? AgentMode::SOLO : AgentMode::SERVER;
+
+    harness::simulateController();
+    if (dualsensitive::init(mode, "alloc-test.log", false, TEST_PORT)
+            != dualsensitive::Status::Ok) {
+        std::cerr << "FAIL: could not start the library" << std::endl;
+        return 1;
+    }
+
+    runRounds(WARMUP_ROUNDS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+    alloc::reset();
+    runRounds(MEASURED_ROUNDS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+
+    int failures = 0;
+    for (const char* site : { "setLeftTrigger", "setRightTrigger", "sendState" })
+        if (!checkSite(site))
+            failures++;
+    if (mode == AgentMode::SERVER && !checkSite("writer: mailbox write"))
+        failures++;
+
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return failures ? 1 : 0;
+}
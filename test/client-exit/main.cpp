@@ -0,0 +1,88 @@
+/*
+    Client exit test. The service runs in-process against DS5W's simulated
+    controller; a client process (this executable with --client) sends
+    its PID and holds the right trigger on Hard. Checks that once the
+    client is killed the service sees the exit through the process handle
+    and puts the trigger back to Normal within EXIT_TIMEOUT_MS, well
+    before any session timeout would.
+
+    usage: client-exit-test
+           client-exit-test --client PORT
+*/
+
+#include "../common/harness.h"
+
+#include <cstdlib>
+#include <string>
+
+#define TEST_PORT 28477
+#define CLIENT_WAIT_MS 2000
+#define CLIENT_UPDATE_MS 50
+#define APPLY_TIMEOUT_MS 3000
+// the exit is signalled by the kernel, so the release has no timer to wait
+// for; this only bounds the scheduling of the wait callback and the write
+#define EXIT_TIMEOUT_MS 1000
+
+static std::atomic<uint32_t> exitedPid{0};
+
+static void onClientExit(uint32_t pid, uint32_t) {
+    exitedPid.store(pid);
+}
+
+// binds its PID and sets the right trigger to Hard until killed
+static int runClient(uint16_t port) {
+    if (dualsensitive::init(AgentMode::CLIENT, "client-exit-test-client.log", false, port)
+            != dualsensitive::Status::Ok)
+        return 1;
+    if (!dualsensitive::waitForService(CLIENT_WAIT_MS))
+        return 1;
+    dualsensitive::sendPidToServer();
+    while (true) {
+        dualsensitive::setRightTrigger(TriggerProfile::Hard);
+        std::this_thread::sleep_for(std::chrono::milliseconds(CLIENT_UPDATE_MS));
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::string(argv[1]) == "--client")
+        return runClient(static_cast<uint16_t>(std::atoi(argv[2])));
+
+    harness::simulateController();
+    dualsensitive::setClientExitCallback(onClientExit);
+    if (dualsensitive::init(AgentMode::SERVER, "client-exit-test.log", false, TEST_PORT)
+            != dualsensitive::Status::Ok) {
+        std::cerr << "FAIL: could not start the in-process service" << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    auto hard = [] { return harness::rightModeIs(TriggerMode::Rigid_A); };
+    auto normal = [] { return harness::rightModeIs(TriggerMode::Rigid_B); };
+
+    PROCESS_INFORMATION client;
+    if (!harness::spawnSelf(L"--client " + std::to_wstring(TEST_PORT), client)) {
+        std::cerr << "FAIL: could not start the client process" << std::endl;
+        return 1;
+    }
+    uint32_t clientPid = client.dwProcessId;
+    int64_t appliedMs = harness::waitFor(hard, APPLY_TIMEOUT_MS);
+    if (!harness::check(appliedMs >= 0, "the trigger of the client did not arrive"))
+        failures++;
+    harness::kill(client);
+
+    int64_t releasedMs = harness::waitFor(normal, EXIT_TIMEOUT_MS);
+    if (!harness::check(appliedMs < 0 || releasedMs >= 0,
+                "the trigger of a killed client was not released in time"))
+        failures++;
+    auto reported = [clientPid] { return exitedPid.load() == clientPid; };
+    if (!harness::check(appliedMs < 0 || harness::waitFor(reported, EXIT_TIMEOUT_MS) >= 0,
+                "the exit callback did not report the killed client"))
+        failures++;
+
+    std::cout << "applied after " << appliedMs << " ms, released " << releasedMs
+              << " ms after the kill" << std::endl;
+
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return failures ? 1 : 0;
+}
@@ -4,6 +4,8 @@
 #include <windows.h>
 #include <iostream>
 
+// covers the UAC prompt of the elevated launch
+#define SERVICE_START_TIMEOUT_MS 30000
 
 bool launchServerElevated(const std::wstring& exePath = L"./dualsensitive-service.exe") {
     wchar_t fullExePath[MAX_PATH];
@@ -71,8 +73,6 @@ int main() {
         return 1;
     }
 
-    std::this_thread::sleep_for(std::chrono::seconds(2)); // Give server time to start
-
     std::vector<uint8_t> payload;
 
     auto status = dualsensitive::init(AgentMode::CLIENT);
@@ -81,6 +81,18 @@ int main() {
         return 1;
     }
 
+    dualsensitive::ServiceState serviceState;
+    if (!dualsensitive::waitForService(SERVICE_START_TIMEOUT_MS, &serviceState)) {
+        std::cout << "DualSensitive Service did not start" << std::endl;
+        return 1;
+    }
+    std::cout << "Service ready, controller "
+        << (serviceState.controllerConnected
+            ? (serviceState.connection == dualsensitive::ControllerConnection::Bluetooth
+                ? "connected (Bluetooth)" : "connected (USB)")
+            : "not connected yet")
+        << std::endl;
+
     dualsensitive::sendPidToServer();
 
     std::cout << "mode changed to soft" << std::endl;
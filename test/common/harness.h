@@ -0,0 +1,109 @@
+/*
+    harness.h is part of DualSensitive
+    https://github.com/tpetsas/dualsensitive
+
+    Contributors of this file:
+    10.2026 Thanasis Petsas
+
+    Licensed under the MIT License
+*/
+
+// Shared by the tests: a simulated USB controller that remembers the
+// trigger modes of the last output report written to it, and helpers to
+// run the test executable again as a client process.
+
+#pragma once
+#include <dualsensitive.h>
+#include <IO.h>
+#include <Device.h>
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// USB output report: the report id, then the output buffer with the right
+// and left trigger blocks at 0x0A and 0x15; their first byte is the mode
+#define RIGHT_TRIGGER_MODE_OFFSET (1 + 0x0A)
+#define LEFT_TRIGGER_MODE_OFFSET (1 + 0x15)
+
+#define WAIT_POLL_MS 1
+
+namespace harness {
+
+    inline std::atomic<uint8_t> rightMode{0};
+    inline std::atomic<uint8_t> leftMode{0};
+    inline std::atomic<uint64_t> outputReports{0};
+
+    inline void onOutputReport(const unsigned char* report, unsigned short length, void*) {
+        if (length > LEFT_TRIGGER_MODE_OFFSET) {
+            rightMode.store(report[RIGHT_TRIGGER_MODE_OFFSET]);
+            leftMode.store(report[LEFT_TRIGGER_MODE_OFFSET]);
+        }
+        outputReports.fetch_add(1);
+    }
+
+    // points DS5W at a simulated USB controller for the rest of the process
+    inline void simulateController(void) {
+        static DS5W::SimulatedDevice device = {};
+        device.connection = DS5W::DeviceConnection::USB;
+        device.onOutputReport = onOutputReport;
+        DS5W::setSimulatedDevice(&device);
+    }
+
+    inline bool rightModeIs(TriggerMode mode) {
+        return rightMode.load() == static_cast<uint8_t>(mode);
+    }
+
+    /**
+     * Polls until done() holds or the timeout passes.
+     * @return the milliseconds it took, or -1 on timeout
+     */
+    inline int64_t waitFor(const std::function<bool()>& done, uint32_t timeoutMs) {
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::milliseconds(timeoutMs);
+        while (!done()) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_POLL_MS));
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * Starts this executable again with the given arguments.
+     * @return false if the process could not be created
+     */
+    inline bool spawnSelf(const std::wstring& arguments, PROCESS_INFORMATION& process) {
+        wchar_t path[MAX_PATH];
+        if (!GetModuleFileNameW(nullptr, path, MAX_PATH))
+            return false;
+        std::wstring commandLine = L"\"" + std::wstring(path) + L"\" " + arguments;
+        STARTUPINFOW startup = {};
+        startup.cb = sizeof(startup);
+        process = {};
+        return CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, FALSE, 0,
+                nullptr, nullptr, &startup, &process) != 0;
+    }
+
+    // kills a process started by spawnSelf() and waits until it is gone
+    inline void kill(PROCESS_INFORMATION& process) {
+        TerminateProcess(process.hProcess, 1);
+        WaitForSingleObject(process.hProcess, INFINITE);
+        CloseHandle(process.hThread);
+        CloseHandle(process.hProcess);
+        process = {};
+    }
+
+    // prints the failure; the tests count them for their exit code
+    inline bool check(bool condition, const char* what) {
+        if (!condition)
+            std::cerr << "FAIL: " << what << std::endl;
+        return condition;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+    Input snapshots of two service ports. The service runs in-process on
+    one port against DS5W's simulated controller and publishes its reads;
+    a second segment is published by hand on another port once the
+    service has stopped. Checks that:
+      - a port nobody publishes on reads nothing, rather than the snapshot
+        of the port read first,
+      - each port then returns its own snapshot, and the stopped service's
+        port reports that it stopped publishing.
+
+    usage: input-ports-test
+*/
+
+#include "../common/harness.h"
+#include <shm.h>
+
+#include <cstring>
+
+#define SERVICE_PORT 28478
+#define OTHER_PORT 28479
+#define PUBLISH_RATE_HZ 250
+#define SNAPSHOT_TIMEOUT_MS 2000
+// left stick position of the hand-made snapshot; the simulated
+// controller reports a centred stick
+#define MARKER_X 77
+
+int main() {
+    harness::simulateController();
+    if (dualsensitive::init(AgentMode::SERVER, "input-ports-test.log", false, SERVICE_PORT)
+            != dualsensitive::Status::Ok) {
+        std::cerr << "FAIL: could not start the in-process service" << std::endl;
+        return 1;
+    }
+    dualsensitive::setInputPublishing(PUBLISH_RATE_HZ);
+
+    int failures = 0;
+    DS5W::DS5InputState state = {};
+    auto published = [&state] { return dualsensitive::readInputSnapshot(state, nullptr, nullptr, SERVICE_PORT); };
+    if (!harness::check(harness::waitFor(published, SNAPSHOT_TIMEOUT_MS) >= 0,
+                "the service port published no snapshot"))
+        failures++;
+    if (!harness::check(!dualsensitive::readInputSnapshot(state, nullptr, nullptr, OTHER_PORT),
+                "a port without a service returned a snapshot"))
+        failures++;
+
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+
+    if (shm::startInputPublisher(OTHER_PORT, sizeof(DS5W::DS5InputState)) != shm::Status::Success) {
+        std::cerr << "FAIL: could not publish on the second port" << std::endl;
+        return 1;
+    }
+    DS5W::DS5InputState marker = {};
+    marker.leftStick.x = MARKER_X;
+    shm::publishInput(&marker, 0);
+
+    state = {};
+    if (!harness::check(dualsensitive::readInputSnapshot(state, nullptr, nullptr, OTHER_PORT)
+                && state.leftStick.x == MARKER_X,
+                "the second port did not return its own snapshot"))
+        failures++;
+    uint64_t sequence = 0;
+    int64_t timestampNs = 0;
+    if (!harness::check(shm::readInput(SERVICE_PORT, &state, sizeof(state), sequence, timestampNs)
+                == shm::Status::NotPublishing,
+                "the stopped service's port did not report that it stopped"))
+        failures++;
+
+    shm::stopInputPublisher();
+    shm::closeInput();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+    Loopback test of network mode. The service runs in-process against
+    DS5W's simulated controller, with a token, a short session timeout and
+    the packet loss shim on; client processes (this executable with
+    --client) stream the right trigger to it through the same shim.
+    Checks that:
+      - a client with the wrong token gets no answer and moves nothing,
+      - with the right token its trigger reaches the controller despite
+        the loss,
+      - once that client is killed, the service releases its trigger
+        within the session timeout.
+
+    usage: network-test
+           network-test --client PORT TOKEN
+*/
+
+#include "../common/harness.h"
+
+#include <cstdlib>
+#include <string>
+
+#define TEST_PORT 28475
+#define TEST_TOKEN "loopback-test-token"
+#define PACKET_LOSS 0.2
+#define SESSION_TIMEOUT_MS 2500
+#define CLIENT_WAIT_MS 2000
+#define CLIENT_UPDATE_MS 50
+// time the trigger gets to arrive, and the slack on top of the timeout
+#define APPLY_TIMEOUT_MS 3000
+#define RELEASE_SLACK_MS 1000
+
+static dualsensitive::NetworkOptions networkOptions(const std::string& token) {
+    dualsensitive::NetworkOptions options;
+    options.address = "127.0.0.1";
+    options.redundancy = 2;
+    options.packetLoss = PACKET_LOSS;
+    options.token = token;
+    options.sessionTimeoutMs = SESSION_TIMEOUT_MS;
+    return options;
+}
+
+// sets the right trigger to Hard until killed
+static int runClient(uint16_t port, const std::string& token) {
+    dualsensitive::setNetworkMode(networkOptions(token));
+    if (dualsensitive::init(AgentMode::CLIENT, "network-test-client.log", false, port)
+            != dualsensitive::Status::Ok)
+        return 1;
+    // a client with the wrong token goes on regardless, to prove the
+    // service ignores it
+    dualsensitive::waitForService(CLIENT_WAIT_MS);
+    while (true) {
+        dualsensitive::setRightTrigger(TriggerProfile::Hard);
+        std::this_thread::sleep_for(std::chrono::milliseconds(CLIENT_UPDATE_MS));
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && std::string(argv[1]) == "--client")
+        return runClient(static_cast<uint16_t>(std::atoi(argv[2])), argv[3]);
+
+    harness::simulateController();
+    dualsensitive::setNetworkMode(networkOptions(TEST_TOKEN));
+    if (dualsensitive::init(AgentMode::SERVER, "network-test.log", false, TEST_PORT)
+            != dualsensitive::Status::Ok) {
+        std::cerr << "FAIL: could not start the in-process service" << std::endl;
+        return 1;
+    }
+
+    int failures = 0;
+    auto hard = [] { return harness::rightModeIs(TriggerMode::Rigid_A); };
+    auto normal = [] { return harness::rightModeIs(TriggerMode::Rigid_B); };
+    std::wstring port = std::to_wstring(TEST_PORT);
+
+    PROCESS_INFORMATION stranger;
+    if (!harness::spawnSelf(L"--client " + port + L" wrong-token", stranger)) {
+        std::cerr << "FAIL: could not start the client process" << std::endl;
+        return 1;
+    }
+    if (!harness::check(harness::waitFor(hard, APPLY_TIMEOUT_MS) < 0,
+                "a client with the wrong token set a trigger"))
+        failures++;
+    harness::kill(stranger);
+
+    PROCESS_INFORMATION client;
+    if (!harness::spawnSelf(L"--client " + port + L" " TEST_TOKEN, client)) {
+        std::cerr << "FAIL: could not start the client process" << std::endl;
+        return 1;
+    }
+    int64_t appliedMs = harness::waitFor(hard, APPLY_TIMEOUT_MS);
+    if (!harness::check(appliedMs >= 0, "the trigger of a client with the token did not arrive"))
+        failures++;
+    harness::kill(client);
+
+    int64_t releasedMs = harness::waitFor(normal, SESSION_TIMEOUT_MS + RELEASE_SLACK_MS);
+    if (!harness::check(appliedMs < 0 || releasedMs >= 0,
+                "the trigger of a killed network client was not released"))
+        failures++;
+
+    dualsensitive::StreamStats stats = dualsensitive::getStreamStats();
+    std::cout << "applied after " << appliedMs << " ms, released " << releasedMs
+              << " ms after the kill, " << stats.shimDropped << " datagrams dropped by the shim"
+              << std::endl;
+
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/*
+    Measures actuation latency: the time from writing a trigger change to
+    the controller until the controller's input reports show it in their
+    trigger feedback bytes, per connection type.
+
+    The right trigger alternates between two profiles of different trigger
+    modes, one update every --interval-ms, through setRightTrigger() in
+    SOLO or SERVER mode with setActuationProbe() on. Comparing runs shows
+    the difference between USB and Bluetooth and what the update pacing
+    does to the latency. Keep the trigger untouched during a run.
+
+    --simulate DELAY_MS runs against DS5W's simulated controller instead,
+    which reports the new trigger mode in its feedback bytes DELAY_MS after
+    the write (with --bt, as a Bluetooth controller); this checks the
+    measurement itself without hardware.
+
+    Results go to stdout as a table, or as a single JSON object with --json.
+
+    usage: ds-actuation [--mode solo|server] [--updates N] [--interval-ms N]
+                        [--simulate DELAY_MS] [--bt] [--port P] [--json]
+*/
+
+#include <dualsensitive.h>
+#include <IO.h>
+#include <Device.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#define DEFAULT_PORT 28475
+// time left for the last probe in SERVER mode; the probe gives up after 250 ms
+#define DRAIN_MS 300
+// input report intervals of the simulated controller
+#define SIMULATED_USB_INTERVAL_US 1000
+#define SIMULATED_BT_INTERVAL_US 4000
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    AgentMode mode = AgentMode::SOLO;
+    unsigned updates = 200;
+    unsigned intervalMs = 50;
+    int simulateDelayMs = -1;   // < 0: real controller
+    bool bluetooth = false;
+    uint16_t port = DEFAULT_PORT;
+    bool json = false;
+};
+
+// simulated controller: the right trigger's mode byte of the last write
+// shows in the feedback once its delay has passed
+static Clock::duration simulatedDelay;
+static std::atomic<uint8_t> writtenMode{0};
+static std::atomic<int64_t> appliedAtNs{0};
+static uint8_t feedback = 0;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+}
+
+static void onOutputReport(const unsigned char* report, unsigned short, void*) {
+    size_t offset = report[0] == 0x31 ? 2 : 1;
+    writtenMode.store(report[offset + 0x0A]);
+    appliedAtNs.store(nowNs() + std::chrono::duration_cast<std::chrono::nanoseconds>(simulatedDelay).count());
+}
+
+static bool onInputReport(unsigned char* report, unsigned short, void* userData) {
+    const DS5W::SimulatedDevice* device = static_cast<const DS5W::SimulatedDevice*>(userData);
+    bool bluetooth = device->connection == DS5W::DeviceConnection::BT;
+    // a read waits for the next report, like HID reads do
+    std::this_thread::sleep_for(std::chrono::microseconds(
+            bluetooth ? SIMULATED_BT_INTERVAL_US : SIMULATED_USB_INTERVAL_US));
+    if (nowNs() >= appliedAtNs.load())
+        feedback = writtenMode.load();
+    size_t offset = bluetooth ? 2 : 1;
+    report[offset + 0x29] = feedback;
+    report[offset + 0x2A] = 0;
+    return true;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--bt") {
+            options.bluetooth = true;
+        } else if (arg == "--mode" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "solo") {
+                options.mode = AgentMode::SOLO;
+            } else if (mode == "server") {
+                options.mode = AgentMode::SERVER;
+            } else {
+                std::cerr << "unknown mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--updates" && hasValue) {
+            options.updates = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--interval-ms" && hasValue) {
+            options.intervalMs = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--simulate" && hasValue) {
+            options.simulateDelayMs = std::max(0l, std::strtol(argv[++i], nullptr, 10));
+        } else if (arg == "--port" && hasValue) {
+            options.port = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            std::cerr << "unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printJson(const char* name, const dualsensitive::ActuationStats& stats) {
+    std::cout << "\"" << name << "\":{\"probes\":" << stats.probes
+              << ",\"measured\":" << stats.measured
+              << ",\"superseded\":" << stats.superseded
+              << ",\"timeouts\":" << stats.timeouts
+              << ",\"latencyUs\":{\"min\":" << stats.minUs
+              << ",\"p50\":" << stats.p50Us
+              << ",\"p90\":" << stats.p90Us
+              << ",\"p99\":" << stats.p99Us
+              << ",\"max\":" << stats.maxUs << "}}";
+}
+
+static void printRow(const char* name, const dualsensitive::ActuationStats& stats) {
+    std::cout << std::left << std::setw(6) << name << std::right
+              << std::setw(8) << stats.probes << std::setw(10) << stats.measured
+              << std::setw(12) << stats.superseded << std::setw(10) << stats.timeouts
+              << std::setw(10) << stats.minUs << std::setw(10) << stats.p50Us
+              << std::setw(10) << stats.p90Us << std::setw(10) << stats.p99Us
+              << std::setw(10) << stats.maxUs << "\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: ds-actuation [--mode solo|server] [--updates N] [--interval-ms N]"
+                     " [--simulate DELAY_MS] [--bt] [--port P] [--json]" << std::endl;
+        return 2;
+    }
+
+    DS5W::SimulatedDevice device = {};
+    if (options.simulateDelayMs >= 0) {
+        simulatedDelay = std::chrono::milliseconds(options.simulateDelayMs);
+        device.connection = options.bluetooth ? DS5W::DeviceConnection::BT : DS5W::DeviceConnection::USB;
+        device.onOutputReport = onOutputReport;
+        device.onInputReport = onInputReport;
+        device.userData = &device;
+        DS5W::setSimulatedDevice(&device);
+    }
+
+    if (dualsensitive::init(options.mode, "ds-actuation.log", false, options.port) != dualsensitive::Status::Ok) {
+        std::cerr << "failed to start dualsensitive" << std::endl;
+        return 1;
+    }
+    // start from a known setting, so the first update is a change
+    dualsensitive::setRightTrigger(TriggerProfile::Normal);
+    dualsensitive::setActuationProbe(true);
+
+    Clock::time_point start = Clock::now();
+    for (unsigned i = 0; i < options.updates; i++) {
+        if (i & 1)
+            dualsensitive::setRightTrigger(TriggerProfile::Normal);
+        else
+            dualsensitive::setRightTrigger(TriggerProfile::Weapon, { 2, 5, 5 });
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(
+                static_cast<int64_t>(options.intervalMs) * (i + 1)));
+    }
+    if (options.mode == AgentMode::SERVER)
+        std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+
+    using dualsensitive::ControllerConnection;
+    dualsensitive::ActuationStats usb = dualsensitive::getActuationStats(ControllerConnection::USB);
+    dualsensitive::ActuationStats bt = dualsensitive::getActuationStats(ControllerConnection::Bluetooth);
+    dualsensitive::setActuationProbe(false);
+
+    const char* modeName = options.mode == AgentMode::SERVER ? "server" : "solo";
+    if (options.json) {
+        std::cout << std::fixed << std::setprecision(1)
+                  << "{\"tool\":\"ds-actuation\""
+                  << ",\"mode\":\"" << modeName << "\""
+                  << ",\"updates\":" << options.updates
+                  << ",\"intervalMs\":" << options.intervalMs
+                  << ",\"simulated\":" << (options.simulateDelayMs >= 0 ? "true" : "false") << ",";
+        printJson("usb", usb);
+        std::cout << ",";
+        printJson("bt", bt);
+        std::cout << "}" << std::endl;
+    } else {
+        std::cout << std::fixed << std::setprecision(1)
+                  << options.updates << " updates every " << options.intervalMs << " ms in "
+                  << modeName << " mode" << (options.simulateDelayMs >= 0 ? " (simulated)" : "") << "\n"
+                  << std::left << std::setw(6) << "link" << std::right
+                  << std::setw(8) << "probes" << std::setw(10) << "measured"
+                  << std::setw(12) << "superseded" << std::setw(10) << "timeouts"
+                  << std::setw(10) << "min us" << std::setw(10) << "p50 us"
+                  << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+                  << std::setw(10) << "max us" << "\n";
+        printRow("USB", usb);
+        printRow("BT", bt);
+        std::cout << std::flush;
+    }
+
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return 0;
+}
@@ -0,0 +1,409 @@
+/*
+    Load generator for the SERVER path of dualsensitive.cpp.
+
+    Starts the service in-process against DS5W's simulated device and
+    drives it from N client threads, each with its own UDP socket (and so
+    its own service session), at a target aggregate rate. The traffic is a
+    mix of BIND payloads, trigger COMMANDs with random profiles and
+    malformed packets, optionally sent in bursts.
+
+    Trigger commands request an acknowledgement. The service acknowledges
+    a command once the write carrying it (or a newer state for the same
+    trigger) has reached the controller, with the time of that write on
+    the shared monotonic clock, so:
+      - latency = ACK appliedNs - time of the sendto() call
+      - dropped = trigger commands that were never acknowledged
+    Commands acknowledged without a write (unchanged or overridden
+    triggers: appliedNs equals receivedNs) are counted as immediate and
+    kept out of the latency percentiles.
+
+    Results go to stdout as a table, or as a single JSON object with
+    --json for regression tracking. --trace FILE writes the service's
+    per-stage spans of the run as Chrome trace JSON.
+
+    usage: ds-loadgen [--clients N] [--rate PACKETS_PER_S] [--duration S]
+                      [--burst N] [--bind-ratio R] [--invalid-ratio R]
+                      [--port P] [--seed S] [--json] [--trace FILE]
+*/
+
+#include <dualsensitive.h>
+#include <protocol.h>
+#include <IO.h>
+#include <Device.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define DEFAULT_PORT 28474
+#define SEND_WINDOW 65536 // in-flight commands tracked per client
+#define DRAIN_MS 500      // time left for late ACKs after the run
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    unsigned clients = 4;
+    double rate = 20000.0;
+    double durationS = 5.0;
+    unsigned burst = 1;
+    double bindRatio = 0.01;
+    double invalidRatio = 0.05;
+    uint16_t port = DEFAULT_PORT;
+    unsigned seed = 1;
+    bool json = false;
+    std::string tracePath;
+};
+
+struct ClientResult {
+    uint64_t triggers = 0;
+    uint64_t binds = 0;
+    uint64_t invalid = 0;
+    uint64_t sendErrors = 0;
+    uint64_t acked = 0;
+    uint64_t rejected = 0;
+    uint64_t overridden = 0;
+    uint64_t immediate = 0;  // acknowledged without waiting for a write
+    std::vector<double> latenciesUs;
+};
+
+static std::atomic<uint64_t> deviceWrites{0};
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+}
+
+static void onOutputReport(const unsigned char*, unsigned short, void*) {
+    deviceWrites.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct ProfileChoice {
+    TriggerProfile profile;
+    std::vector<uint8_t> extras;
+};
+
+// profiles with valid extras; Custom gets random force bytes per packet
+static const ProfileChoice PROFILES[] = {
+    { TriggerProfile::Normal, {} },
+    { TriggerProfile::Soft, {} },
+    { TriggerProfile::Hard, {} },
+    { TriggerProfile::VeryHard, {} },
+    { TriggerProfile::Rigid, {} },
+    { TriggerProfile::Choppy, {} },
+    { TriggerProfile::VibrateTrigger10Hz, {} },
+    { TriggerProfile::Resistance, { 2, 5 } },
+    { TriggerProfile::Feedback, { 3, 3 } },
+    { TriggerProfile::Vibration, { 3, 4, 14 } },
+    { TriggerProfile::Weapon, { 2, 5, 5 } },
+    { TriggerProfile::Machine, { 1, 8, 3, 3, 184, 0 } },
+    { TriggerProfile::SlopeFeedback, { 0, 5, 1, 8 } },
+    { TriggerProfile::Custom, {} },
+};
+
+// malformed payloads the service must reject without side effects
+static std::vector<uint8_t> invalidPayload(std::mt19937& rng, uint32_t sequence) {
+    switch (rng() % 4) {
+        case 0:
+            // unknown payload type
+            return { 0xEE, static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()) };
+        case 1:
+            // COMMAND cut short inside its header
+            return { static_cast<uint8_t>(PayloadType::COMMAND), COMMAND_ACK_REQUESTED, 1, 2 };
+        case 2: {
+            // COMMAND whose extras run past the end; answered with Rejected
+            std::vector<uint8_t> payload = {
+                static_cast<uint8_t>(PayloadType::COMMAND), COMMAND_ACK_REQUESTED,
+                static_cast<uint8_t>(sequence), static_cast<uint8_t>(sequence >> 8),
+                static_cast<uint8_t>(sequence >> 16), static_cast<uint8_t>(sequence >> 24),
+                1, 0, static_cast<uint8_t>(TriggerProfile::Custom), 40, 1, 2
+            };
+            return payload;
+        }
+        default:
+            // TRIGGER shorter than one trigger record
+            return { static_cast<uint8_t>(PayloadType::TRIGGER), 1 };
+    }
+}
+
+static void runClient(const Options& options, unsigned index, const sockaddr_in& service,
+                        const std::atomic<bool>& start, ClientResult& result) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sock, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+    u_long nonBlocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+
+    std::mt19937 rng(options.seed * 7919 + index);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::vector<int64_t> sentNs(SEND_WINDOW, 0);
+    result.latenciesUs.reserve(static_cast<size_t>(options.rate * options.durationS / options.clients));
+
+    uint32_t sequence = 0;
+    std::vector<uint8_t> reply(ACK_PAYLOAD_SIZE + 16);
+    std::vector<uint8_t> ackBuffer;
+
+    // drains pending ACKs without blocking
+    auto receiveAcks = [&]() {
+        while (true) {
+            int received = recv(sock, reinterpret_cast<char*>(reply.data()),
+                                static_cast<int>(reply.size()), 0);
+            if (received <= 0)
+                return;
+            ackBuffer.assign(reply.begin(), reply.begin() + received);
+            AckPayload ack;
+            if (static_cast<PayloadType>(ackBuffer[0]) != PayloadType::ACK
+                    || !deserializeAckPayload(ackBuffer, ack))
+                continue;
+            if (ack.result == dualsensitive::ApplyResult::Rejected) {
+                result.rejected++;
+                continue;
+            }
+            int64_t& sent = sentNs[ack.sequence & (SEND_WINDOW - 1)];
+            if (!sent)
+                continue;
+            result.acked++;
+            if (ack.result == dualsensitive::ApplyResult::Overridden)
+                result.overridden++;
+            if (ack.appliedNs == ack.receivedNs)
+                result.immediate++;
+            else
+                result.latenciesUs.push_back((ack.appliedNs - sent) / 1000.0);
+            sent = 0;
+        }
+    };
+
+    auto send = [&](const std::vector<uint8_t>& payload) {
+        int sent = sendto(sock, reinterpret_cast<const char*>(payload.data()),
+                          static_cast<int>(payload.size()), 0,
+                          reinterpret_cast<const sockaddr*>(&service), sizeof(service));
+        if (sent == SOCKET_ERROR)
+            result.sendErrors++;
+        return sent != SOCKET_ERROR;
+    };
+
+    while (!start.load())
+        std::this_thread::yield();
+
+    double perClientRate = options.rate / options.clients;
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.burst / perClientRate));
+    auto next = Clock::now();
+    auto end = next + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(options.durationS));
+
+    while (next < end) {
+        for (unsigned i = 0; i < options.burst; i++) {
+            double pick = chance(rng);
+            if (pick < options.bindRatio) {
+                send(serializeBindPayload(static_cast<uint32_t>(GetCurrentProcessId()), 0));
+                result.binds++;
+            } else if (pick < options.bindRatio + options.invalidRatio) {
+                send(invalidPayload(rng, ++sequence));
+                result.invalid++;
+            } else {
+                const ProfileChoice& choice = PROFILES[rng() % (sizeof(PROFILES) / sizeof(PROFILES[0]))];
+                TriggerCommand command = {
+                    (rng() & 1) ? Trigger::Right : Trigger::Left, choice.profile, choice.extras
+                };
+                if (choice.profile == TriggerProfile::Custom) {
+                    command.extras = { static_cast<uint8_t>(TriggerMode::Rigid_A) };
+                    for (int b = 0; b < 7; b++)
+                        command.extras.push_back(static_cast<uint8_t>(rng()));
+                }
+                ++sequence;
+                std::vector<uint8_t> payload = serializeCommandPayload(
+                        COMMAND_ACK_REQUESTED, sequence, &command, 1);
+                sentNs[sequence & (SEND_WINDOW - 1)] = nowNs();
+                if (!send(payload))
+                    sentNs[sequence & (SEND_WINDOW - 1)] = 0;
+                result.triggers++;
+            }
+        }
+        receiveAcks();
+
+        // sleep while there is time to spare, spin for the last stretch
+        next += interval;
+        while (Clock::now() < next) {
+            receiveAcks();
+            if (next - Clock::now() > std::chrono::milliseconds(2))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    auto drainEnd = Clock::now() + std::chrono::milliseconds(DRAIN_MS);
+    while (Clock::now() < drainEnd) {
+        receiveAcks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    closesocket(sock);
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1));
+    return sorted[index];
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--clients" && hasValue) {
+            options.clients = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--rate" && hasValue) {
+            options.rate = std::max(1.0, std::strtod(argv[++i], nullptr));
+        } else if (arg == "--duration" && hasValue) {
+            options.durationS = std::max(0.1, std::strtod(argv[++i], nullptr));
+        } else if (arg == "--burst" && hasValue) {
+            options.burst = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--bind-ratio" && hasValue) {
+            options.bindRatio = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--invalid-ratio" && hasValue) {
+            options.invalidRatio = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--port" && hasValue) {
+            options.port = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else {
+            std::cerr << "unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: ds-loadgen [--clients N] [--rate PACKETS_PER_S] [--duration S]"
+                     " [--burst N] [--bind-ratio R] [--invalid-ratio R] [--port P]"
+                     " [--seed S] [--json] [--trace FILE]" << std::endl;
+        return 2;
+    }
+
+    DS5W::SimulatedDevice device = {};
+    device.connection = DS5W::DeviceConnection::USB;
+    device.onOutputReport = onOutputReport;
+    DS5W::setSimulatedDevice(&device);
+
+    if (dualsensitive::init(AgentMode::SERVER, "ds-loadgen.log", false, options.port) != dualsensitive::Status::Ok) {
+        std::cerr << "failed to start the in-process service" << std::endl;
+        return 1;
+    }
+
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+    sockaddr_in service = {};
+    service.sin_family = AF_INET;
+    service.sin_port = htons(options.port);
+    service.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::atomic<bool> start{false};
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> clients;
+    for (unsigned i = 0; i < options.clients; i++) {
+        clients.emplace_back(runClient, std::cref(options), i, std::cref(service),
+                             std::cref(start), std::ref(results[i]));
+    }
+    uint64_t writesBefore = deviceWrites.load();
+    if (!options.tracePath.empty())
+        dualsensitive::startTrace();
+    start = true;
+    for (std::thread& client : clients)
+        client.join();
+    uint64_t writes = deviceWrites.load() - writesBefore;
+    if (!options.tracePath.empty()) {
+        dualsensitive::stopTrace();
+        if (!dualsensitive::writeTrace(options.tracePath))
+            std::cerr << "failed to write " << options.tracePath << std::endl;
+    }
+
+    ClientResult total;
+    for (ClientResult& result : results) {
+        total.triggers += result.triggers;
+        total.binds += result.binds;
+        total.invalid += result.invalid;
+        total.sendErrors += result.sendErrors;
+        total.acked += result.acked;
+        total.rejected += result.rejected;
+        total.overridden += result.overridden;
+        total.immediate += result.immediate;
+        total.latenciesUs.insert(total.latenciesUs.end(),
+                                 result.latenciesUs.begin(), result.latenciesUs.end());
+    }
+    std::sort(total.latenciesUs.begin(), total.latenciesUs.end());
+
+    uint64_t dropped = total.triggers > total.acked ? total.triggers - total.acked : 0;
+    double dropRate = total.triggers ? static_cast<double>(dropped) / total.triggers : 0.0;
+    double throughput = total.acked / options.durationS;
+    double p50 = percentile(total.latenciesUs, 50.0);
+    double p99 = percentile(total.latenciesUs, 99.0);
+    double p999 = percentile(total.latenciesUs, 99.9);
+    double maxUs = total.latenciesUs.empty() ? 0.0 : total.latenciesUs.back();
+
+    if (options.json) {
+        std::cout << std::fixed << std::setprecision(3)
+                  << "{\"tool\":\"ds-loadgen\""
+                  << ",\"clients\":" << options.clients
+                  << ",\"targetRate\":" << options.rate
+                  << ",\"durationS\":" << options.durationS
+                  << ",\"burst\":" << options.burst
+                  << ",\"sent\":{\"trigger\":" << total.triggers
+                  << ",\"bind\":" << total.binds
+                  << ",\"invalid\":" << total.invalid
+                  << ",\"errors\":" << total.sendErrors << "}"
+                  << ",\"acked\":" << total.acked
+                  << ",\"overridden\":" << total.overridden
+                  << ",\"immediate\":" << total.immediate
+                  << ",\"rejected\":" << total.rejected
+                  << ",\"dropped\":" << dropped
+                  << ",\"dropRate\":" << dropRate
+                  << ",\"throughputPerS\":" << throughput
+                  << ",\"deviceWrites\":" << writes
+                  << ",\"latencyUs\":{\"p50\":" << p50
+                  << ",\"p99\":" << p99
+                  << ",\"p999\":" << p999
+                  << ",\"max\":" << maxUs << "}}" << std::endl;
+    } else {
+        std::cout << std::fixed << std::setprecision(1)
+                  << "clients " << options.clients << ", target " << options.rate
+                  << " packets/s for " << options.durationS << " s, burst " << options.burst << "\n"
+                  << "sent          " << total.triggers << " trigger, " << total.binds
+                  << " bind, " << total.invalid << " invalid, " << total.sendErrors << " errors\n"
+                  << "acked         " << total.acked << " (" << total.overridden << " overridden, "
+                  << total.immediate << " without a write), "
+                  << total.rejected << " rejected\n"
+                  << "dropped       " << dropped << " (" << std::setprecision(3) << dropRate * 100.0
+                  << std::setprecision(1) << " %)\n"
+                  << "throughput    " << throughput << " commands/s, "
+                  << writes << " device writes\n"
+                  << "latency (us)  p50 " << p50 << ", p99 " << p99 << ", p999 " << p999
+                  << ", max " << maxUs << std::endl;
+    }
+
+    WSACleanup();
+    dualsensitive::terminate();
+    DS5W::setSimulatedDevice(nullptr);
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+    Replays HID captures made with dualsensitive::startRecording().
+
+    The capture is played back through DS5W against the simulated
+    controller:
+      - every recorded input report is handed out by the simulated device
+        to getDeviceInputState(), and so goes through
+        evaluateHidInputBuffer
+      - every recorded output report is decoded back into a DS5OutputState
+        (trigger effect blocks pass through the Custom profile) and written
+        again with setDeviceOutputState(); the report that reaches the
+        simulated device must match the recorded one byte for byte
+
+    Records play at their recorded pace, or back to back with --max-speed,
+    which turns a field capture into a benchmark of the decode and encode
+    paths. Results go to stdout as a table, or as a single JSON object with
+    --json.
+
+    usage: ds-replay FILE [--max-speed] [--loops N] [--json]
+*/
+
+#include <dualsensitive.h>
+#include <recorder.h>
+#include <IO.h>
+#include <Device.h>
+#include <DS5State.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// bytes of one trigger effect block in the output report
+#define TRIGGER_EFFECT_SIZE 11
+// the decoded part of the output report, after the report header
+#define OUTPUT_STATE_SIZE 0x2F
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string path;
+    bool maxSpeed = false;
+    unsigned loops = 1;
+    bool json = false;
+};
+
+struct Stats {
+    uint64_t inputs = 0;
+    uint64_t outputs = 0;
+    uint64_t mismatches = 0;    // re-encoded output reports that differ
+    uint64_t skipped = 0;       // reports too short to decode, failed calls
+    int64_t inputNs = 0;
+    int64_t outputNs = 0;
+    int64_t maxLateNs = 0;      // real-time mode: worst delay behind the capture
+};
+
+// record the simulated controller hands out on the next read
+static const recorder::Record* pendingInput = nullptr;
+// last report written to the simulated controller
+static std::vector<uint8_t> lastOutput;
+
+static bool onInputReport(unsigned char* report, unsigned short length, void*) {
+    if (!pendingInput)
+        return false;
+    memcpy(report, pendingInput->report.data(), std::min<size_t>(length, pendingInput->report.size()));
+    return true;
+}
+
+static void onOutputReport(const unsigned char* report, unsigned short length, void*) {
+    lastOutput.assign(report, report + length);
+}
+
+static int64_t elapsedNs(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+static size_t reportHeaderSize(uint8_t connection) {
+    return connection == static_cast<uint8_t>(DS5W::DeviceConnection::BT) ? 2 : 1;
+}
+
+// inverse of createHidOutputBuffer
+static bool decodeOutputReport(const recorder::Record& record, DS5W::DS5OutputState& state) {
+    size_t offset = reportHeaderSize(record.connection);
+    if (record.report.size() < offset + OUTPUT_STATE_SIZE)
+        return false;
+    const uint8_t* out = record.report.data() + offset;
+
+    state.rightRumble = out[0x02];
+    state.leftRumble = out[0x03];
+    state.microphoneLed = static_cast<DS5W::MicLed>(out[0x08]);
+    state.disableLeds = out[0x29] == 0x01;
+    state.playerLeds.brightness = static_cast<DS5W::LedBrightness>(out[0x2A]);
+    state.playerLeds.bitmask = out[0x2B] & ~0x20;
+    state.playerLeds.playerLedFade = !(out[0x2B] & 0x20);
+    state.lightbar.r = out[0x2C];
+    state.lightbar.g = out[0x2D];
+    state.lightbar.b = out[0x2E];
+
+    state.triggerSettingEnabled = true;
+    state.rightTriggerSetting.profile = TriggerProfile::Custom;
+    memcpy(state.rightTriggerSetting.extras, &out[0x0A], TRIGGER_EFFECT_SIZE);
+    state.rightTriggerSetting.extrasSize = TRIGGER_EFFECT_SIZE;
+    state.leftTriggerSetting.profile = TriggerProfile::Custom;
+    memcpy(state.leftTriggerSetting.extras, &out[0x15], TRIGGER_EFFECT_SIZE);
+    state.leftTriggerSetting.extrasSize = TRIGGER_EFFECT_SIZE;
+    return true;
+}
+
+// (re)opens the simulated controller with the connection of a record
+static bool openDevice(DS5W::SimulatedDevice& device, DS5W::DeviceContext& context,
+                       uint8_t connection, bool& open) {
+    if (open)
+        DS5W::freeDeviceContext(&context);
+    open = false;
+    device.connection = static_cast<DS5W::DeviceConnection>(connection);
+    DS5W::setSimulatedDevice(&device);
+    DS5W::DeviceEnumInfo info = {};
+    unsigned int count = 0;
+    if (DS5W::enumDevices(&info, 1, &count) != DS5W_OK
+            || DS5W::initDeviceContext(&info, &context) != DS5W_OK)
+        return false;
+    open = true;
+    return true;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--max-speed") {
+            options.maxSpeed = true;
+        } else if (arg == "--loops" && hasValue) {
+            options.loops = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (options.path.empty() && arg.compare(0, 2, "--") != 0) {
+            options.path = arg;
+        } else {
+            std::cerr << "unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return !options.path.empty();
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "usage: ds-replay FILE [--max-speed] [--loops N] [--json]" << std::endl;
+        return 2;
+    }
+
+    // load everything up front so file reads stay out of the timings
+    recorder::Reader reader;
+    recorder::Status status = reader.open(options.path);
+    if (status != recorder::Status::Success) {
+        std::cerr << "cannot read " << options.path << " (status: "
+                  << static_cast<int>(status) << ")" << std::endl;
+        return 1;
+    }
+    std::vector<recorder::Record> records;
+    recorder::Record record;
+    while (reader.next(record))
+        records.push_back(record);
+    reader.close();
+    if (records.empty()) {
+        std::cerr << options.path << " holds no reports" << std::endl;
+        return 1;
+    }
+
+    DS5W::SimulatedDevice device = {};
+    device.onOutputReport = onOutputReport;
+    device.onInputReport = onInputReport;
+    DS5W::DeviceContext context = {};
+    bool open = false;
+    uint8_t connection = records.front().connection;
+    if (!openDevice(device, context, connection, open)) {
+        std::cerr << "failed to open the simulated controller" << std::endl;
+        return 1;
+    }
+
+    Stats stats;
+    DS5W::DS5InputState inputState = {};
+    DS5W::DS5OutputState outputState = {};
+    int64_t firstNs = records.front().timestampNs;
+    Clock::time_point runStart = Clock::now();
+    for (unsigned loop = 0; loop < options.loops; loop++) {
+        Clock::time_point loopStart = Clock::now();
+        for (const recorder::Record& current : records) {
+            if (!options.maxSpeed) {
+                // sleep while there is time to spare, spin for the last stretch
+                Clock::time_point due = loopStart + std::chrono::nanoseconds(current.timestampNs - firstNs);
+                while (Clock::now() < due) {
+                    if (due - Clock::now() > std::chrono::milliseconds(2))
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    else
+                        std::this_thread::yield();
+                }
+                stats.maxLateNs = std::max(stats.maxLateNs, elapsedNs(due));
+            }
+            if (current.connection != connection) {
+                connection = current.connection;
+                if (!openDevice(device, context, connection, open)) {
+                    std::cerr << "failed to reopen the simulated controller" << std::endl;
+                    return 1;
+                }
+            }
+            if (current.report.size() > sizeof(context._internal.hidBuffer)) {
+                stats.skipped++;
+                continue;
+            }
+
+            Clock::time_point start = Clock::now();
+            if (current.direction == recorder::Direction::Input) {
+                pendingInput = &current;
+                context._internal.inputReportLen = static_cast<unsigned short>(current.report.size());
+                if (DS5W::getDeviceInputState(&context, &inputState) != DS5W_OK) {
+                    stats.skipped++;
+                    continue;
+                }
+                stats.inputNs += elapsedNs(start);
+                stats.inputs++;
+            } else {
+                if (!decodeOutputReport(current, outputState)) {
+                    stats.skipped++;
+                    continue;
+                }
+                context._internal.outputReportLen = static_cast<unsigned short>(current.report.size());
+                if (DS5W::setDeviceOutputState(&context, &outputState) != DS5W_OK) {
+                    stats.skipped++;
+                    continue;
+                }
+                stats.outputNs += elapsedNs(start);
+                stats.outputs++;
+                if (lastOutput != current.report)
+                    stats.mismatches++;
+            }
+        }
+    }
+    double elapsedS = elapsedNs(runStart) / 1e9;
+
+    pendingInput = nullptr;
+    DS5W::freeDeviceContext(&context);
+    DS5W::setSimulatedDevice(nullptr);
+
+    double inputNsPerReport = stats.inputs ? static_cast<double>(stats.inputNs) / stats.inputs : 0.0;
+    double outputNsPerReport = stats.outputs ? static_cast<double>(stats.outputNs) / stats.outputs : 0.0;
+    double capturedS = (records.back().timestampNs - firstNs) / 1e9;
+
+    if (options.json) {
+        std::cout << std::fixed << std::setprecision(3)
+                  << "{\"tool\":\"ds-replay\""
+                  << ",\"records\":" << records.size()
+                  << ",\"loops\":" << options.loops
+                  << ",\"maxSpeed\":" << (options.maxSpeed ? "true" : "false")
+                  << ",\"capturedS\":" << capturedS
+                  << ",\"elapsedS\":" << elapsedS
+                  << ",\"inputs\":" << stats.inputs
+                  << ",\"outputs\":" << stats.outputs
+                  << ",\"mismatches\":" << stats.mismatches
+                  << ",\"skipped\":" << stats.skipped
+                  << ",\"inputNsPerReport\":" << inputNsPerReport
+                  << ",\"outputNsPerReport\":" << outputNsPerReport
+                  << ",\"maxLateUs\":" << stats.maxLateNs / 1e3 << "}" << std::endl;
+    } else {
+        std::cout << std::fixed << std::setprecision(1)
+                  << records.size() << " records (" << capturedS << " s captured), "
+                  << options.loops << " loop(s) in " << elapsedS << " s"
+                  << (options.maxSpeed ? " at max speed" : " in real time") << "\n"
+                  << "input         " << stats.inputs << " reports, "
+                  << inputNsPerReport << " ns/report\n"
+                  << "output        " << stats.outputs << " reports, "
+                  << outputNsPerReport << " ns/report, " << stats.mismatches << " mismatched\n"
+                  << "skipped       " << stats.skipped << "\n";
+        if (!options.maxSpeed)
+            std::cout << "max late (us) " << stats.maxLateNs / 1e3 << "\n";
+        std::cout << std::flush;
+    }
+    return stats.mismatches ? 3 : 0;
+}